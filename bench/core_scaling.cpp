@@ -0,0 +1,76 @@
+//
+// Benchmark: echo throughput against the number of cores
+//
+// A fixed set of connections, each doing back-to-back round trips, spread
+// round robin over an io_context_pool of 1..N pinned contexts. The server
+// gets its own N threads.
+//
+
+#include "io_pool.hpp"
+#include "loopback.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+
+static constexpr std::size_t connection_count = 128;
+static constexpr std::size_t round_trips = 1000;
+
+static net::awaitable<void>
+client(unsigned short port, std::string const &payload)
+{
+    auto exec = co_await net::this_coro::executor;
+    websocket::stream<tcp::socket> ws{exec};
+    co_await ws.next_layer().async_connect({net::ip::make_address("127.0.0.1"), port}, net::use_awaitable);
+    ws.next_layer().set_option(tcp::no_delay(true));
+    co_await ws.async_handshake("127.0.0.1", "/", net::use_awaitable);
+    beast::flat_buffer buffer;
+    for (std::size_t i = 0; i < round_trips; ++i)
+    {
+        co_await ws.async_write(net::buffer(payload), net::use_awaitable);
+        co_await ws.async_read(buffer, net::use_awaitable);
+        buffer.clear();
+    }
+    co_await ws.async_close(websocket::close_code::normal, net::use_awaitable);
+}
+
+int
+main()
+{
+    unsigned const cores = (std::max)(1u, std::thread::hardware_concurrency());
+    loopback::server srv{loopback::mode::echo, cores};
+    std::string const payload(64, 'x');
+
+    std::printf("%-8s %14s %10s\n", "cores", "messages/s", "scaling");
+    // Powers of two, then every core
+    std::vector<unsigned> counts;
+    for (unsigned n = 1; n < cores; n *= 2)
+        counts.push_back(n);
+    counts.push_back(cores);
+
+    double base = 0;
+    for (unsigned n : counts)
+    {
+        runtime::io_context_pool pool{n};
+        for (std::size_t i = 0; i < connection_count; ++i)
+            net::co_spawn(pool.pick(), client(srv.port(), payload), net::detached);
+
+        auto const t0 = std::chrono::steady_clock::now();
+        pool.run();
+        auto const t1 = std::chrono::steady_clock::now();
+        double const rate = double(connection_count * round_trips) /
+                            std::chrono::duration<double>(t1 - t0).count();
+        if (n == 1)
+            base = rate;
+        std::printf("%-8u %14.0f %10.2f\n", n, rate, rate / base);
+    }
+}
@@ -0,0 +1,158 @@
+//
+// Benchmark: coroutine overhead, net::awaitable against coro::task
+//
+// Three workloads on one single-threaded io_context:
+//
+//   call       a coroutine awaiting a child that returns without suspending
+//   post       a coroutine awaiting net::post, one trip through the queue
+//   handshake  connect, TLS and WebSocket handshake against a loopback
+//              server, the flow of async_test
+//
+// The first two isolate the cost of frames, resumption and completion
+// plumbing; the last shows how much of it is left once real I/O is in
+// the way.
+//
+
+#include "loopback.hpp"
+#include "task.hpp"
+
+#include <boost/asio/post.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+
+namespace net = boost::asio;
+namespace ssl = net::ssl;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+
+using tls_stream = websocket::stream<beast::ssl_stream<tcp::socket>>;
+
+static double
+ns_per(std::size_t n, std::function<void(net::io_context &)> start)
+{
+    net::io_context ioc{1};
+    start(ioc);
+    auto const t0 = std::chrono::steady_clock::now();
+    ioc.run();
+    auto const t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / double(n);
+}
+
+static void
+rethrow(std::exception_ptr e)
+{
+    if (e)
+        std::rethrow_exception(e);
+}
+
+//------------------------------------------------------------------------------
+
+static net::awaitable<int>
+awaitable_leaf(int i)
+{
+    co_return i;
+}
+
+static coro::task<int>
+task_leaf(int i)
+{
+    co_return i;
+}
+
+static net::awaitable<void>
+awaitable_calls(std::size_t n)
+{
+    int sum = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        sum += co_await awaitable_leaf(int(i));
+    (void) sum;
+}
+
+static coro::task<void>
+task_calls(std::size_t n)
+{
+    int sum = 0;
+    for (std::size_t i = 0; i < n; ++i)
+        sum += co_await task_leaf(int(i));
+    (void) sum;
+}
+
+static net::awaitable<void>
+awaitable_posts(net::io_context &ioc, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        co_await net::post(ioc, net::use_awaitable);
+}
+
+static coro::task<void>
+task_posts(net::io_context &ioc, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+        co_await net::post(ioc, coro::use_task);
+}
+
+static net::awaitable<void>
+awaitable_handshakes(net::io_context &ioc, ssl::context &ctx, tcp::endpoint ep, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        tls_stream ws{ioc, ctx};
+        co_await get_lowest_layer(ws).async_connect(ep, net::use_awaitable);
+        co_await ws.next_layer().async_handshake(ssl::stream_base::client, net::use_awaitable);
+        co_await ws.async_handshake("127.0.0.1", "/", net::use_awaitable);
+    }
+}
+
+static coro::task<void>
+task_handshakes(net::io_context &ioc, ssl::context &ctx, tcp::endpoint ep, std::size_t n)
+{
+    for (std::size_t i = 0; i < n; ++i)
+    {
+        tls_stream ws{ioc, ctx};
+        co_await get_lowest_layer(ws).async_connect(ep, coro::use_task);
+        co_await ws.next_layer().async_handshake(ssl::stream_base::client, coro::use_task);
+        co_await ws.async_handshake("127.0.0.1", "/", coro::use_task);
+    }
+}
+
+int
+main()
+{
+    ssl::context server_ctx{ssl::context::tlsv12_server};
+    loopback::use_self_signed(server_ctx);
+    ssl::context client_ctx{ssl::context::tlsv12_client};
+    client_ctx.set_verify_mode(ssl::verify_none);
+    loopback::server tls{loopback::mode::echo, 1, &server_ctx};
+    tcp::endpoint const ep{net::ip::make_address("127.0.0.1"), tls.port()};
+
+    std::printf("%-10s %14s %14s\n", "workload", "awaitable ns", "task ns");
+
+    std::size_t const calls = 2000000;
+    double const a_call = ns_per(calls, [&](net::io_context &ioc) {
+        net::co_spawn(ioc, awaitable_calls(calls), rethrow);
+    });
+    double const t_call = ns_per(calls, [&](net::io_context &ioc) {
+        coro::spawn(ioc.get_executor(), task_calls(calls), rethrow);
+    });
+    std::printf("%-10s %14.1f %14.1f\n", "call", a_call, t_call);
+
+    std::size_t const posts = 1000000;
+    double const a_post = ns_per(posts, [&](net::io_context &ioc) {
+        net::co_spawn(ioc, awaitable_posts(ioc, posts), rethrow);
+    });
+    double const t_post = ns_per(posts, [&](net::io_context &ioc) {
+        coro::spawn(ioc.get_executor(), task_posts(ioc, posts), rethrow);
+    });
+    std::printf("%-10s %14.1f %14.1f\n", "post", a_post, t_post);
+
+    std::size_t const handshakes = 200;
+    double const a_hs = ns_per(handshakes, [&](net::io_context &ioc) {
+        net::co_spawn(ioc, awaitable_handshakes(ioc, client_ctx, ep, handshakes), rethrow);
+    });
+    double const t_hs = ns_per(handshakes, [&](net::io_context &ioc) {
+        coro::spawn(ioc.get_executor(), task_handshakes(ioc, client_ctx, ep, handshakes), rethrow);
+    });
+    std::printf("%-10s %14.0f %14.0f\n", "handshake", a_hs, t_hs);
+}
@@ -0,0 +1,151 @@
+//
+// Benchmark: permessage-deflate CPU per message against bytes on the wire
+//
+// Client and server run over an in-memory stream, so the numbers contain
+// only framing and zlib cost. Every row of the matrix sends the same
+// corpus of JSON-like messages.
+//
+
+#include "compression.hpp"
+
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/websocket.hpp>
+#include <cstdio>
+#include <ctime>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+namespace net = boost::asio;
+
+static double
+thread_cpu_seconds()
+{
+    timespec ts{};
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return double(ts.tv_sec) + double(ts.tv_nsec) * 1e-9;
+}
+
+// Messages resembling API responses: repeated keys, varying values
+static std::vector<std::string>
+make_corpus(std::size_t count, int max_items)
+{
+    std::mt19937 rng{42};
+    std::uniform_int_distribution<int> items{1, max_items};
+    std::uniform_int_distribution<int> value{0, 1000000};
+    std::vector<std::string> corpus;
+    corpus.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        std::string m = "{\"id\":" + std::to_string(i) + ",\"items\":[";
+        int n = items(rng);
+        for (int j = 0; j < n; ++j)
+        {
+            if (j)
+                m += ',';
+            m += "{\"name\":\"item-" + std::to_string(j) +
+                 "\",\"price\":" + std::to_string(value(rng)) +
+                 ",\"currency\":\"EUR\",\"available\":true}";
+        }
+        m += "]}";
+        corpus.push_back(std::move(m));
+    }
+    return corpus;
+}
+
+struct result
+{
+    double client_us = 0;
+    double server_us = 0;
+    std::size_t wire = 0;
+};
+
+static result
+run(compression::options const &o, std::vector<std::string> const &corpus)
+{
+    net::io_context ioc;
+    beast::test::stream client_io{ioc};
+    beast::test::stream server_io{ioc};
+    client_io.connect(server_io);
+
+    websocket::stream<beast::test::stream &> client{client_io};
+    websocket::stream<beast::test::stream &> server{server_io};
+
+    compression::apply(client, o);
+    auto pmd = compression::to_beast(o);
+    pmd.server_enable = o.enable;
+    server.set_option(pmd);
+
+    server.async_accept([](beast::error_code) {});
+    client.async_handshake("localhost", "/", [](beast::error_code) {});
+    ioc.run();
+
+    result r;
+    // Bytes written by the client are counted on the peer
+    std::size_t const before = server_io.nwrite_bytes();
+    beast::flat_buffer buffer;
+    for (auto const &m : corpus)
+    {
+        double t0 = thread_cpu_seconds();
+        client.write(net::buffer(m));
+        double t1 = thread_cpu_seconds();
+        server.read(buffer);
+        double t2 = thread_cpu_seconds();
+        buffer.consume(buffer.size());
+        r.client_us += (t1 - t0) * 1e6;
+        r.server_us += (t2 - t1) * 1e6;
+    }
+    r.wire = server_io.nwrite_bytes() - before;
+    r.client_us /= double(corpus.size());
+    r.server_us /= double(corpus.size());
+    return r;
+}
+
+static void
+run_matrix(char const *name, std::vector<std::string> const &corpus)
+{
+    std::size_t payload = 0;
+    for (auto const &m : corpus)
+        payload += m.size();
+
+    std::printf("%s: %zu messages, %zu payload bytes\n", name, corpus.size(), payload);
+    std::printf("%-6s %-4s %-4s %-8s %10s %10s %8s %12s %12s\n",
+                "wbits", "mem", "lvl", "takeover", "zlib mem", "wire", "ratio",
+                "client us", "server us");
+
+    auto print = [&](compression::options const &o, result const &r) {
+        std::printf("%-6d %-4d %-4d %-8s %10zu %10zu %8.3f %12.2f %12.2f\n",
+                    o.window_bits, o.mem_level, o.level,
+                    o.enable ? (o.context_takeover ? "yes" : "no") : "off",
+                    o.enable ? o.deflate_memory() : 0, r.wire,
+                    double(r.wire) / double(payload), r.client_us, r.server_us);
+    };
+
+    compression::options off;
+    off.enable = false;
+    print(off, run(off, corpus));
+
+    for (int wbits : {9, 12, 15})
+        for (int mem : {1, 4, 8})
+            for (int level : {1, 6})
+                for (bool takeover : {true, false})
+                {
+                    compression::options o;
+                    o.window_bits = wbits;
+                    o.mem_level = mem;
+                    o.level = level;
+                    o.context_takeover = takeover;
+                    print(o, run(o, corpus));
+                }
+    std::printf("\n");
+}
+
+int
+main()
+{
+    run_matrix("small", make_corpus(5000, 4));
+    run_matrix("large", make_corpus(500, 400));
+}
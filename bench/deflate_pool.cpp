@@ -0,0 +1,151 @@
+//
+// Benchmark: zlib memory and CPU with per-connection against pooled state
+//
+// Simulates many connections that each send a message now and then. With
+// per-connection state every connection keeps its own deflate stream
+// alive; with the pool only one stream per thread ever exists.
+//
+
+#include "buffer_pool.hpp"
+#include "deflate_pool.hpp"
+
+#include <boost/beast/core/flat_buffer.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace net = boost::asio;
+namespace zlib = boost::beast::zlib;
+
+// Resident set size in bytes
+static std::size_t
+rss()
+{
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t pages = 0, resident = 0;
+    statm >> pages >> resident;
+    return resident * 4096;
+}
+
+static std::string
+make_message(std::size_t i)
+{
+    std::string m = "{\"connection\":" + std::to_string(i) + ",\"events\":[";
+    for (int j = 0; j < 20; ++j)
+        m += "{\"type\":\"tick\",\"seq\":" + std::to_string(i * 20 + j) + ",\"ok\":true},";
+    m += "{}]}";
+    return m;
+}
+
+// Every connection owns a deflate stream for its whole lifetime and keeps
+// its window between messages, which is what that memory buys
+static void
+per_connection(std::size_t connections, std::size_t rounds, compression::options const &o)
+{
+    std::size_t const before = rss();
+    std::vector<std::unique_ptr<zlib::deflate_stream>> streams;
+    streams.reserve(connections);
+    for (std::size_t i = 0; i < connections; ++i)
+    {
+        streams.push_back(std::make_unique<zlib::deflate_stream>());
+        streams.back()->reset(o.level, o.window_bits, o.mem_level, zlib::Strategy::normal);
+    }
+
+    std::size_t wire = 0;
+    auto const t0 = std::chrono::steady_clock::now();
+    for (std::size_t r = 0; r < rounds; ++r)
+        for (std::size_t i = 0; i < connections; ++i)
+        {
+            auto const m = make_message(i);
+            boost::beast::flat_buffer out;
+            auto mb = out.prepare(streams[i]->upper_bound(m.size()) + 16);
+            zlib::z_params zs;
+            zs.next_in = m.data();
+            zs.avail_in = m.size();
+            zs.next_out = mb.data();
+            zs.avail_out = mb.size();
+            boost::beast::error_code ec;
+            streams[i]->write(zs, zlib::Flush::sync, ec);
+            wire += zs.total_out;
+        }
+    auto const t1 = std::chrono::steady_clock::now();
+
+    double us = std::chrono::duration<double, std::micro>(t1 - t0).count() / double(connections * rounds);
+    std::printf("%-16s %8zu conns %6zu zlib states %10.1f MiB rss %8.2f us/msg %10zu bytes\n",
+                "per-connection", connections, streams.size(),
+                double(rss() - before) / (1024.0 * 1024.0), us, wire);
+}
+
+// Connections borrow a deflater from their thread's pool per message
+static void
+pooled(std::size_t connections, std::size_t rounds, std::size_t threads, compression::options const &o)
+{
+    std::size_t const before = rss();
+    std::vector<std::size_t> wire(threads);
+    std::vector<std::size_t> states(threads);
+
+    auto const t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (std::size_t t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] {
+            for (std::size_t r = 0; r < rounds; ++r)
+                for (std::size_t i = t; i < connections; i += threads)
+                {
+                    auto const m = make_message(i);
+                    buffers::pooled_buffer out;
+                    compression::deflate_message(net::buffer(m), out, o);
+                    wire[t] += out.size();
+
+                    // Round trip the first message to keep the codec honest
+                    if (r == 0 && i == t)
+                    {
+                        buffers::pooled_buffer back;
+                        boost::beast::error_code ec;
+                        compression::inflate_message(out.data(), back, o.window_bits, 1 << 20, ec);
+                        if (ec || back.size() != m.size())
+                        {
+                            std::fprintf(stderr, "round trip failed: %s\n", ec.message().c_str());
+                            std::exit(EXIT_FAILURE);
+                        }
+                    }
+                }
+            auto const &s = compression::deflate_pool::local().stats();
+            states[t] = s.deflaters + s.inflaters;
+        });
+    for (auto &w : workers)
+        w.join();
+    auto const t1 = std::chrono::steady_clock::now();
+
+    std::size_t total_wire = 0, total_states = 0;
+    for (std::size_t t = 0; t < threads; ++t)
+    {
+        total_wire += wire[t];
+        total_states += states[t];
+    }
+    double us = std::chrono::duration<double, std::micro>(t1 - t0).count() / double(connections * rounds);
+    std::printf("%-16s %8zu conns %6zu zlib states %10.1f MiB rss %8.2f us/msg %10zu bytes\n",
+                "pooled", connections, total_states,
+                double(rss() - before) / (1024.0 * 1024.0), us, total_wire);
+}
+
+int
+main(int argc, char **argv)
+{
+    std::size_t const threads = argc > 1 ? std::strtoul(argv[1], nullptr, 10)
+                                         : (std::max)(1u, std::thread::hardware_concurrency());
+    compression::options o;
+    o.pooled = true;
+
+    std::printf("%s, %zu threads, ~%zu bytes per deflate state\n\n",
+                "window_bits=15 mem_level=4", threads, o.deflate_memory());
+    for (std::size_t connections : {100, 1000, 5000})
+    {
+        pooled(connections, 4, threads, o);
+        per_connection(connections, 4, o);
+    }
+}
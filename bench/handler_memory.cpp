@@ -0,0 +1,166 @@
+//
+// Benchmark: heap allocations and rate of handshakes and duplex echoes
+//
+// The same coroutine flow completing on plain use_awaitable, whose
+// operations share Asio's single cached block per thread, and on
+// memory::use_recycled_awaitable, and with the handshake operations in a
+// memory::connection_arena released after each upgrade. Allocations are
+// counted on the client thread only: calls to operator new, plus blocks
+// the recycler had to take from malloc. Coroutine frames stay with Asio
+// in every run.
+//
+
+#include "connection_arena.hpp"
+#include "handler_memory.hpp"
+#include "loopback.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+namespace net = boost::asio;
+namespace ssl = net::ssl;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+
+static thread_local std::size_t news = 0;
+
+// Kept out of line: once GCC inlines the free() it pairs it with the
+// caller's new and warns about a mismatch
+[[gnu::noinline]] void *
+operator new(std::size_t n)
+{
+    ++news;
+    if (void *p = std::malloc(n ? n : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void
+operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+[[gnu::noinline]] void
+operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+static constexpr std::size_t connection_count = 16;
+
+using tls_stream = websocket::stream<beast::ssl_stream<tcp::socket>>;
+
+static std::size_t
+heap_allocations()
+{
+    auto const &s = memory::recycler::local().stats();
+    return news + (s.allocations - s.hits);
+}
+
+struct result
+{
+    double rate;
+    double allocations;
+};
+
+template<class Task>
+static result
+measure(std::size_t ops, Task task)
+{
+    net::io_context ioc{1};
+    for (std::size_t i = 0; i < connection_count; ++i)
+        net::co_spawn(ioc, task(ioc), [](std::exception_ptr e) {
+            if (e)
+                std::rethrow_exception(e);
+        });
+    std::size_t const before = heap_allocations();
+    auto const t0 = std::chrono::steady_clock::now();
+    ioc.run();
+    auto const t1 = std::chrono::steady_clock::now();
+    return {double(ops) / std::chrono::duration<double>(t1 - t0).count(),
+            double(heap_allocations() - before) / double(ops)};
+}
+
+template<class Token>
+static net::awaitable<void>
+handshake(tls_stream &ws, tcp::endpoint ep, Token token)
+{
+    co_await get_lowest_layer(ws).async_connect(ep, token);
+    co_await ws.next_layer().async_handshake(ssl::stream_base::client, token);
+    co_await ws.async_handshake("127.0.0.1", "/", token);
+}
+
+// Handshake with `token`, or from an arena when `arena` is set
+template<class Token>
+static net::awaitable<void>
+handshake(tls_stream &ws, tcp::endpoint ep, Token token, bool arena)
+{
+    if (!arena)
+        co_return co_await handshake(ws, ep, token);
+    memory::connection_arena a;
+    co_await handshake(ws, ep, a.bind(net::use_awaitable));
+    a.release();
+}
+
+template<class Token>
+static void
+run(char const *name, Token token, bool arena, ssl::context &ctx, tcp::endpoint ep)
+{
+    std::size_t const handshakes = 20;
+    auto const hs = measure(connection_count * handshakes, [&](net::io_context &ioc) -> net::awaitable<void> {
+        for (std::size_t i = 0; i < handshakes; ++i)
+        {
+            tls_stream ws{ioc, ctx};
+            co_await handshake(ws, ep, token, arena);
+        }
+    });
+
+    // Writes run ahead of reads, so each connection has a read and a
+    // write in flight at the same time
+    std::size_t const echoes = 2000;
+    std::string const payload(64, 'x');
+    auto const echo = measure(connection_count * echoes, [&](net::io_context &ioc) -> net::awaitable<void> {
+        tls_stream ws{ioc, ctx};
+        co_await handshake(ws, ep, token, arena);
+        net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+            for (std::size_t i = 0; i < echoes; ++i)
+                co_await ws.async_write(net::buffer(payload), token);
+        }, net::detached);
+        beast::flat_buffer buffer;
+        for (std::size_t i = 0; i < echoes; ++i)
+        {
+            co_await ws.async_read(buffer, token);
+            buffer.clear();
+        }
+    });
+
+    std::printf("%-10s %14.0f %16.1f %14.0f %16.1f\n", name, hs.rate, hs.allocations, echo.rate,
+                echo.allocations);
+}
+
+int
+main()
+{
+    ssl::context server_ctx{ssl::context::tlsv12_server};
+    loopback::use_self_signed(server_ctx);
+    ssl::context client_ctx{ssl::context::tlsv12_client};
+    client_ctx.set_verify_mode(ssl::verify_none);
+    loopback::server tls{loopback::mode::echo, 1, &server_ctx};
+    tcp::endpoint const ep{net::ip::make_address("127.0.0.1"), tls.port()};
+
+    std::printf("%zu concurrent connections\n", connection_count);
+    std::printf("%-10s %14s %16s %14s %16s\n", "token", "handshakes/s", "allocs/handshake", "echoes/s",
+                "allocs/echo");
+    run("default", net::use_awaitable, false, client_ctx, ep);
+    run("recycled", memory::use_recycled_awaitable, false, client_ctx, ep);
+    run("arena", memory::use_recycled_awaitable, true, client_ctx, ep);
+    std::printf("recycler: ");
+    std::fflush(stdout);
+    std::cout << memory::recycler::local().stats() << "\n";
+}
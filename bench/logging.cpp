@@ -0,0 +1,149 @@
+//
+// Benchmark: log calls per second against the number of producer threads
+//
+// The old console::println, which formats under one global mutex, against
+// the per-thread ring logger. Both write to /dev/null. Lines the ring
+// logger had to drop because the flusher fell behind are reported.
+//
+// Then the hot-path cost of logging a handshake response and a 1 KiB
+// payload: formatted by println, against console::log entries rendered
+// by the flusher or written out as a binary log. Rates count pairs of
+// entries.
+//
+// Last, reporting a handshake outcome: the response printed with println
+// as the clients did, against a report::handshake_record pushed to a
+// report::sink whose thread does the printing.
+//
+
+#include "console.hpp"
+#include "report.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/make_printable.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static constexpr std::size_t lines_per_thread = 200000;
+
+namespace locked {
+    std::mutex iomutex;
+    std::ofstream out{"/dev/null"};
+
+    template<class... Args>
+    void
+    println(Args const &...args)
+    {
+        std::lock_guard<std::mutex> g{iomutex};
+        (out << ... << args) << '\n';
+    }
+}// namespace locked
+
+template<class F>
+static double
+measure(unsigned threads, F log)
+{
+    std::vector<std::thread> workers;
+    auto const t0 = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+        workers.emplace_back([&, t] {
+            for (std::size_t i = 0; i < lines_per_thread; ++i)
+                log(t, i);
+        });
+    for (auto &w : workers)
+        w.join();
+    auto const t1 = std::chrono::steady_clock::now();
+    return double(threads * lines_per_thread) / std::chrono::duration<double>(t1 - t0).count();
+}
+
+int
+main()
+{
+    std::FILE *null = std::fopen("/dev/null", "w");
+    console::set_output(null);
+    std::string const text = "read frame opcode=text fin=1";
+
+    unsigned const max_threads = (std::max)(4u, std::thread::hardware_concurrency());
+    std::printf("%-8s %16s %16s %12s\n", "threads", "mutex lines/s", "ring lines/s", "dropped");
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double const locked_rate = measure(threads, [&](unsigned t, std::size_t i) {
+            locked::println("[", t, "] ", text, " seq=", i);
+        });
+        auto const before = console::stats().dropped;
+        double const ring_rate = measure(threads, [&](unsigned t, std::size_t i) {
+            console::println("[", t, "] ", text, " seq=", i);
+        });
+        console::flush();
+        std::printf("%-8u %16.0f %16.0f %12zu\n", threads, locked_rate, ring_rate,
+                    console::stats().dropped - before);
+    }
+
+    namespace http = boost::beast::http;
+    http::response<http::string_body> response{http::status::switching_protocols, 11};
+    response.set(http::field::upgrade, "websocket");
+    response.set(http::field::connection, "upgrade");
+    response.set(http::field::sec_websocket_accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+    std::string const payload(1024, 'x');
+    auto const payload_buffer = boost::asio::buffer(payload);
+
+    std::printf("\n%-8s %16s %16s %16s\n", "threads", "println/s", "log text/s", "log binary/s");
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double const text_rate = measure(threads, [&](unsigned, std::size_t) {
+            console::println("[async] ", response);
+            console::println("[async] ", boost::beast::make_printable(payload_buffer));
+        });
+        console::flush();
+        double const deferred_rate = measure(threads, [&](unsigned, std::size_t) {
+            console::log<"[async] {}">(response);
+            console::log<"[async] {}">(payload_buffer);
+        });
+        console::flush();
+        console::set_binary_output(null);
+        double const binary_rate = measure(threads, [&](unsigned, std::size_t) {
+            console::log<"[async] {}">(response);
+            console::log<"[async] {}">(payload_buffer);
+        });
+        console::flush();
+        console::set_binary_output(nullptr);
+        std::printf("%-8u %16.0f %16.0f %16.0f\n", threads, text_rate, deferred_rate, binary_rate);
+    }
+
+    protocol::compact_response compact;
+    compact.result(101);
+    compact.reason("Switching Protocols");
+    for (auto const &f : response)
+        compact.insert(f.name_string(), f.value());
+
+    std::printf("\n%-8s %16s %16s %12s\n", "threads", "println/s", "sink push/s", "dropped");
+    for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+    {
+        double const text_rate = measure(threads, [&](unsigned, std::size_t) {
+            console::println("[async] ", response);
+        });
+        console::flush();
+        std::size_t dropped = 0;
+        double sink_rate = 0;
+        {
+            report::sink sink;
+            sink_rate = measure(threads, [&](unsigned, std::size_t) {
+                sink.push(report::make_record("[async]", compact, {}, {}));
+            });
+            sink.flush();
+            dropped = sink.stats().dropped;
+        }
+        console::flush();
+        std::printf("%-8u %16.0f %16.0f %12zu\n", threads, text_rate, sink_rate, dropped);
+    }
+
+    console::set_output(stdout);
+    std::fclose(null);
+}
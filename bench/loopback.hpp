@@ -0,0 +1,189 @@
+//
+// Loopback WebSocket server shared by the benchmarks
+//
+// Plain TCP, or TLS with a throwaway self-signed certificate, on
+// 127.0.0.1 with an ephemeral port. The server runs on its own threads so
+// the client side of a benchmark has the CPU to itself as far as the
+// machine allows.
+//
+
+#ifndef WEBSOCKET_HANDSHAKE_BENCH_LOOPBACK_HPP
+#define WEBSOCKET_HANDSHAKE_BENCH_LOOPBACK_HPP
+
+// Older Asio uses std::exchange in awaitable.hpp without including it
+#include <utility>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ssl/context.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/ssl.hpp>
+#include <boost/beast/websocket.hpp>
+#include <boost/beast/websocket/ssl.hpp>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+namespace loopback {
+    namespace beast = boost::beast;
+    namespace websocket = beast::websocket;
+    namespace net = boost::asio;
+    namespace ssl = net::ssl;
+    using tcp = net::ip::tcp;
+
+    enum class mode
+    {
+        // Send every message back
+        echo,
+        // Read and discard
+        sink
+    };
+
+    // Give `ctx` a fresh P-256 key and a self-signed certificate for it
+    inline void
+    use_self_signed(ssl::context &ctx)
+    {
+        EVP_PKEY *key = nullptr;
+        EVP_PKEY_CTX *kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+        bool ok = kctx && EVP_PKEY_keygen_init(kctx) > 0 &&
+                  EVP_PKEY_CTX_set_ec_paramgen_curve_nid(kctx, NID_X9_62_prime256v1) > 0 &&
+                  EVP_PKEY_keygen(kctx, &key) > 0;
+        EVP_PKEY_CTX_free(kctx);
+
+        X509 *cert = ok ? X509_new() : nullptr;
+        if (cert)
+        {
+            X509_set_version(cert, 2);
+            ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+            X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+            X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+            X509_set_pubkey(cert, key);
+            X509_NAME *name = X509_get_subject_name(cert);
+            X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                       reinterpret_cast<unsigned char const *>("127.0.0.1"), -1, -1, 0);
+            X509_set_issuer_name(cert, name);
+            ok = X509_sign(cert, key, EVP_sha256()) > 0 &&
+                 SSL_CTX_use_certificate(ctx.native_handle(), cert) == 1 &&
+                 SSL_CTX_use_PrivateKey(ctx.native_handle(), key) == 1;
+        }
+        X509_free(cert);
+        EVP_PKEY_free(key);
+        if (!ok)
+            throw std::runtime_error("cannot create a self-signed certificate");
+    }
+
+    class server
+    {
+    public:
+        // With `tls` set, connections are TLS using that context, which must
+        // hold a certificate (see use_self_signed). It must outlive the server.
+        explicit server(mode m, unsigned threads = 1, ssl::context *tls = nullptr)
+            : mode_(m)
+            , tls_(tls)
+            , acceptor_(ioc_, {net::ip::make_address("127.0.0.1"), 0})
+        {
+            net::co_spawn(ioc_, accept_loop(), net::detached);
+            for (unsigned i = 0; i < threads; ++i)
+                threads_.emplace_back([this] { ioc_.run(); });
+        }
+
+        server(server const &) = delete;
+        server &operator=(server const &) = delete;
+
+        ~server()
+        {
+            ioc_.stop();
+            for (auto &t : threads_)
+                t.join();
+        }
+
+        unsigned short
+        port() const
+        {
+            return acceptor_.local_endpoint().port();
+        }
+
+        // Messages received over all connections
+        std::size_t
+        received() const noexcept
+        {
+            return received_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        net::awaitable<void>
+        accept_loop()
+        {
+            for (;;)
+            {
+                tcp::socket socket = co_await acceptor_.async_accept(net::use_awaitable);
+                net::co_spawn(acceptor_.get_executor(), session(std::move(socket)), net::detached);
+            }
+        }
+
+        net::awaitable<void>
+        session(tcp::socket socket)
+        try
+        {
+            socket.set_option(tcp::no_delay(true));
+            if (tls_)
+            {
+                websocket::stream<beast::ssl_stream<tcp::socket>> ws{std::move(socket), *tls_};
+                co_await ws.next_layer().async_handshake(ssl::stream_base::server, net::use_awaitable);
+                co_await serve(ws);
+            }
+            else
+            {
+                websocket::stream<tcp::socket> ws{std::move(socket)};
+                co_await serve(ws);
+            }
+        } catch (std::exception const &)
+        {
+            // The client went away
+        }
+
+        template<class Stream>
+        net::awaitable<void>
+        serve(Stream &ws)
+        {
+            co_await ws.async_accept(net::use_awaitable);
+            beast::flat_buffer buffer;
+            for (;;)
+            {
+                co_await ws.async_read(buffer, net::use_awaitable);
+                received_.fetch_add(1, std::memory_order_relaxed);
+                if (mode_ == mode::echo)
+                {
+                    ws.text(ws.got_text());
+                    co_await ws.async_write(buffer.data(), net::use_awaitable);
+                }
+                buffer.consume(buffer.size());
+            }
+        }
+
+        mode mode_;
+        ssl::context *tls_;
+        net::io_context ioc_;
+        tcp::acceptor acceptor_;
+        std::vector<std::thread> threads_;
+        std::atomic<std::size_t> received_{0};
+    };
+
+    // Connect a plain WebSocket client to the loopback server
+    inline void
+    connect(websocket::stream<tcp::socket> &ws, unsigned short port)
+    {
+        ws.next_layer().connect({net::ip::make_address("127.0.0.1"), port});
+        ws.next_layer().set_option(tcp::no_delay(true));
+        ws.handshake("127.0.0.1", "/");
+    }
+
+}// namespace loopback
+
+#endif
@@ -0,0 +1,251 @@
+//
+// Benchmark: CPU cost of the sans-I/O protocol core
+//
+// No sockets are involved. The upgrade is timed as building the request
+// and parsing a canned 101 response; framing as encoding client messages
+// into the output buffer and decoding server frames fed in read-sized
+// pieces. Beast's websocket::stream over an in-memory test stream does
+// the same framing work as a baseline. The last decode column is the core
+// with partial_messages, handing out data as it arrives.
+//
+
+#include "protocol.hpp"
+
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/websocket/stream.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+
+using clock_type = std::chrono::steady_clock;
+
+static double
+seconds_since(clock_type::time_point t0)
+{
+    return std::chrono::duration<double>(clock_type::now() - t0).count();
+}
+
+static std::string
+response_for(std::string_view key)
+{
+    return "HTTP/1.1 101 Switching Protocols\r\n"
+           "Upgrade: websocket\r\n"
+           "Connection: Upgrade\r\n"
+           "Sec-WebSocket-Accept: " +
+           protocol::sec_accept_for(key) +
+           "\r\n"
+           "Server: loopback\r\n"
+           "\r\n";
+}
+
+static void
+bench_upgrade()
+{
+    std::size_t const n = 100000;
+    std::vector<std::unique_ptr<protocol::handshake>> hs(n);
+    std::vector<std::string> responses(n);
+
+    auto t0 = clock_type::now();
+    for (auto &h : hs)
+        h = std::make_unique<protocol::handshake>("example.com:443", "/chat");
+    double const request = seconds_since(t0);
+
+    for (std::size_t i = 0; i < n; ++i)
+        responses[i] = response_for(hs[i]->key());
+
+    t0 = clock_type::now();
+    for (std::size_t i = 0; i < n; ++i)
+        hs[i]->receive(net::buffer(responses[i]));
+    double const response = seconds_since(t0);
+
+    for (auto const &h : hs)
+        if (!h->done() || h->error())
+        {
+            std::fprintf(stderr, "upgrade failed: %s\n", h->error().message().c_str());
+            std::exit(EXIT_FAILURE);
+        }
+
+    std::printf("upgrade: request %.0f ns, response %.0f ns, total %.2f M/s\n\n",
+                request / double(n) * 1e9, response / double(n) * 1e9,
+                double(n) / (request + response) / 1e6);
+}
+
+//------------------------------------------------------------------------------
+
+// Unmasked server frames for `count` messages of `size` bytes, each split
+// into `fragments` frames
+static std::string
+server_frames(std::size_t size, std::size_t count, std::size_t fragments, bool text)
+{
+    std::string payload(size, 'x');
+    std::string out;
+    for (std::size_t m = 0; m < count; ++m)
+    {
+        std::size_t pos = 0;
+        for (std::size_t f = 0; f < fragments; ++f)
+        {
+            std::size_t const len = f + 1 == fragments ? size - pos : size / fragments;
+            unsigned char h[10];
+            std::size_t hn = 0;
+            h[hn++] = static_cast<unsigned char>((f + 1 == fragments ? 0x80 : 0) | (f ? 0x0 : text ? 0x1 : 0x2));
+            if (len < 126)
+                h[hn++] = static_cast<unsigned char>(len);
+            else if (len <= 0xffff)
+            {
+                h[hn++] = 126;
+                h[hn++] = static_cast<unsigned char>(len >> 8);
+                h[hn++] = static_cast<unsigned char>(len);
+            }
+            else
+            {
+                h[hn++] = 127;
+                for (int shift = 56; shift >= 0; shift -= 8)
+                    h[hn++] = static_cast<unsigned char>(len >> shift);
+            }
+            out.append(reinterpret_cast<char const *>(h), hn);
+            out.append(payload, pos, len);
+            pos += len;
+        }
+    }
+    return out;
+}
+
+// Both sides of an upgraded Beast connection over in-memory streams
+struct beast_pair
+{
+    net::io_context ioc;
+    websocket::stream<beast::test::stream> client{ioc};
+    websocket::stream<beast::test::stream> server{ioc};
+
+    beast_pair()
+    {
+        client.next_layer().connect(server.next_layer());
+        client.async_handshake("localhost", "/", [](beast::error_code) {});
+        server.async_accept([](beast::error_code) {});
+        ioc.run();
+    }
+};
+
+static void
+bench_decode(std::size_t size, std::size_t fragments, bool text)
+{
+    std::size_t const count = (std::max<std::size_t>)(16, (64u << 20) / (size + 16));
+    std::string const wire = server_frames(size, count, fragments, text);
+
+    protocol::connection c;
+    std::size_t got = 0;
+    auto t0 = clock_type::now();
+    for (std::size_t pos = 0; pos < wire.size(); pos += 16 * 1024)
+    {
+        c.receive(net::buffer(wire.data() + pos, (std::min<std::size_t>)(16 * 1024, wire.size() - pos)));
+        for (auto e = c.next(); e.kind != protocol::event_kind::need_more; e = c.next())
+            got += e.payload.size();
+    }
+    double const ours = seconds_since(t0);
+
+    // The same input handed out as it arrives, without joining frames
+    protocol::connection partial{{.partial_messages = true}};
+    std::size_t partial_got = 0;
+    t0 = clock_type::now();
+    for (std::size_t pos = 0; pos < wire.size(); pos += 16 * 1024)
+    {
+        partial.receive(net::buffer(wire.data() + pos, (std::min<std::size_t>)(16 * 1024, wire.size() - pos)));
+        for (auto e = partial.next(); e.kind != protocol::event_kind::need_more; e = partial.next())
+            partial_got += e.payload.size();
+    }
+    double const pieces = seconds_since(t0);
+
+    beast_pair p;
+    beast::flat_buffer buffer;
+    p.client.next_layer().append(wire);
+    std::size_t beast_got = 0;
+    t0 = clock_type::now();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        beast_got += p.client.read(buffer);
+        buffer.consume(buffer.size());
+    }
+    double const theirs = seconds_since(t0);
+
+    if (got != size * count || beast_got != got || partial_got != got)
+    {
+        std::fprintf(stderr, "decode mismatch\n");
+        std::exit(EXIT_FAILURE);
+    }
+    std::printf("%10zu %9zu %6s %12.2f %12.2f %10.2f %10.2f %12.2f\n",
+                size, fragments, text ? "text" : "binary",
+                double(count) / ours / 1e6, double(count) / theirs / 1e6,
+                double(wire.size()) / ours / 1e9, double(wire.size()) / theirs / 1e9,
+                double(wire.size()) / pieces / 1e9);
+}
+
+static void
+bench_encode(std::size_t size, bool deflate)
+{
+    std::size_t const count = (std::max<std::size_t>)(16, (deflate ? 8u << 20 : 64u << 20) / (size + 16));
+    std::string payload(size, 'y');
+
+    compression::options o;
+    o.enable = deflate;
+    protocol::connection c{{.deflate = o}};
+    auto t0 = clock_type::now();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        c.send(net::buffer(payload));
+        c.consume_output(c.output().size());
+    }
+    double const ours = seconds_since(t0);
+
+    // Beast only compresses once permessage-deflate was negotiated
+    double theirs = 0;
+    if (!deflate)
+    {
+        beast_pair p;
+        t0 = clock_type::now();
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            p.client.write(net::buffer(payload));
+            p.server.next_layer().clear();
+        }
+        theirs = seconds_since(t0);
+    }
+
+    std::printf("%10zu %9s %12.2f ", size, deflate ? "deflate" : "plain", double(count) / ours / 1e6);
+    if (theirs > 0)
+        std::printf("%12.2f\n", double(count) / theirs / 1e6);
+    else
+        std::printf("%12s\n", "-");
+}
+
+int
+main()
+{
+    bench_upgrade();
+
+    std::printf("decode, fed 16 KiB at a time (M msgs/s and GB/s)\n");
+    std::printf("%10s %9s %6s %12s %12s %10s %10s %12s\n",
+                "bytes", "fragments", "type", "core", "beast", "core GB/s", "beast GB/s", "partial GB/s");
+    for (std::size_t size : {16, 125, 1024, 16384, 65536, 1 << 20})
+        bench_decode(size, 1, false);
+    for (std::size_t size : {1024, 65536})
+    {
+        bench_decode(size, 1, true);
+        bench_decode(size, 4, true);
+    }
+
+    std::printf("\nencode, masked into the output buffer (M msgs/s)\n");
+    std::printf("%10s %9s %12s %12s\n", "bytes", "mode", "core", "beast");
+    for (std::size_t size : {16, 125, 1024, 16384, 65536})
+        bench_encode(size, false);
+    for (std::size_t size : {1024, 16384})
+        bench_encode(size, true);
+}
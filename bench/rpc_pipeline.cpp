@@ -0,0 +1,95 @@
+//
+// Benchmark: request/response calls per second on one connection
+//
+// The same number of calls made one at a time, as async_test does, and
+// through the correlation layer with a growing number in flight. The
+// server echoes every message, id prefix included.
+//
+
+#include "loopback.hpp"
+#include "rpc_client.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace net = boost::asio;
+namespace websocket = boost::beast::websocket;
+using tcp = net::ip::tcp;
+
+static constexpr std::size_t call_count = 50000;
+
+// One-in-flight baseline: write a message, read the reply, repeat
+static double
+sequential(unsigned short port, std::string const &body)
+{
+    net::io_context ioc;
+    websocket::stream<tcp::socket> ws{ioc};
+    loopback::connect(ws, port);
+    boost::beast::flat_buffer buffer;
+
+    auto const t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < call_count; ++i)
+    {
+        ws.write(net::buffer(body));
+        ws.read(buffer);
+        buffer.clear();
+    }
+    auto const t1 = std::chrono::steady_clock::now();
+    ws.close(websocket::close_code::normal);
+    return double(call_count) / std::chrono::duration<double>(t1 - t0).count();
+}
+
+// `window` coroutines, each making calls back to back
+static double
+pipelined(unsigned short port, std::string const &body, std::size_t window, rpc::client_stats &stats)
+{
+    net::io_context ioc;
+    websocket::stream<tcp::socket> ws{ioc};
+    loopback::connect(ws, port);
+    rpc::client client{ws};
+    std::size_t started = 0;
+    std::size_t running = window;
+
+    auto const t0 = std::chrono::steady_clock::now();
+    net::co_spawn(ioc, client.run(), net::detached);
+    for (std::size_t w = 0; w < window; ++w)
+        net::co_spawn(
+        ioc,
+        [&]() -> net::awaitable<void> {
+            while (started < call_count)
+            {
+                ++started;
+                co_await client.async_call(body, std::chrono::seconds(10));
+            }
+            if (--running == 0)
+                client.close();
+        },
+        net::detached);
+    ioc.run();
+    auto const t1 = std::chrono::steady_clock::now();
+    stats = client.stats();
+    return double(stats.completed) / std::chrono::duration<double>(t1 - t0).count();
+}
+
+int
+main()
+{
+    loopback::server srv{loopback::mode::echo};
+    std::string const body(128, 'x');
+
+    std::printf("%-12s %8s %14s %10s\n", "mode", "window", "calls/s", "speedup");
+    double const base = sequential(srv.port(), body);
+    std::printf("%-12s %8d %14.0f %10.2f\n", "sequential", 1, base, 1.0);
+
+    for (std::size_t window : {1, 4, 16, 64, 256})
+    {
+        rpc::client_stats stats;
+        double const rate = pipelined(srv.port(), body, window, stats);
+        std::printf("%-12s %8zu %14.0f %10.2f   peak_in_flight=%zu timeouts=%zu\n", "pipelined",
+                    window, rate, rate / base, stats.peak_in_flight, stats.timeouts);
+    }
+}
@@ -0,0 +1,106 @@
+//
+// Benchmark: socket backend on loopback
+//
+// Connect, TLS plus WebSocket handshake, and TLS echo round trips over
+// many concurrent connections, all through asynchronous operations so
+// every byte passes through the reactor. bench_transport uses the build's
+// backend. Where liburing and Boost 1.78+ are available and the build
+// itself is not on io_uring, bench_transport_io_uring is built alongside
+// it from the same source; run both and compare.
+//
+
+#include "loopback.hpp"
+#include "transport.hpp"
+
+#include <boost/asio/connect.hpp>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+
+namespace net = boost::asio;
+namespace ssl = net::ssl;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using tcp = net::ip::tcp;
+
+static constexpr std::size_t connection_count = 64;
+
+using tls_stream = websocket::stream<beast::ssl_stream<tcp::socket>>;
+
+// Run `task` on `connection_count` coroutines and return operations/s
+static double
+measure(std::size_t ops, std::function<net::awaitable<void>(net::io_context &)> task)
+{
+    net::io_context ioc;
+    for (std::size_t i = 0; i < connection_count; ++i)
+        net::co_spawn(ioc, task(ioc), [](std::exception_ptr e) {
+            if (e)
+                std::rethrow_exception(e);
+        });
+    auto const t0 = std::chrono::steady_clock::now();
+    ioc.run();
+    auto const t1 = std::chrono::steady_clock::now();
+    return double(ops) / std::chrono::duration<double>(t1 - t0).count();
+}
+
+static net::awaitable<void>
+connect_tls(tls_stream &ws, tcp::endpoint ep)
+{
+    co_await get_lowest_layer(ws).async_connect(ep, net::use_awaitable);
+    get_lowest_layer(ws).set_option(tcp::no_delay(true));
+    co_await ws.next_layer().async_handshake(ssl::stream_base::client, net::use_awaitable);
+    co_await ws.async_handshake("127.0.0.1", "/", net::use_awaitable);
+}
+
+int
+main()
+{
+    ssl::context server_ctx{ssl::context::tlsv12_server};
+    loopback::use_self_signed(server_ctx);
+    ssl::context client_ctx{ssl::context::tlsv12_client};
+    client_ctx.set_verify_mode(ssl::verify_none);
+
+    loopback::server plain{loopback::mode::echo};
+    loopback::server tls{loopback::mode::echo, 1, &server_ctx};
+    tcp::endpoint const plain_ep{net::ip::make_address("127.0.0.1"), plain.port()};
+    tcp::endpoint const tls_ep{net::ip::make_address("127.0.0.1"), tls.port()};
+
+    std::printf("backend: %s, %zu concurrent connections\n", transport::backend(), connection_count);
+    std::printf("%-12s %14s\n", "workload", "ops/s");
+
+    std::size_t const connects = 100;
+    double rate = measure(connection_count * connects, [&](net::io_context &ioc) -> net::awaitable<void> {
+        for (std::size_t i = 0; i < connects; ++i)
+        {
+            tcp::socket s{ioc};
+            co_await s.async_connect(plain_ep, net::use_awaitable);
+        }
+    });
+    std::printf("%-12s %14.0f\n", "connect", rate);
+
+    std::size_t const handshakes = 10;
+    rate = measure(connection_count * handshakes, [&](net::io_context &ioc) -> net::awaitable<void> {
+        for (std::size_t i = 0; i < handshakes; ++i)
+        {
+            tls_stream ws{ioc, client_ctx};
+            co_await connect_tls(ws, tls_ep);
+        }
+    });
+    std::printf("%-12s %14.0f\n", "handshake", rate);
+
+    std::size_t const echoes = 2000;
+    std::string const payload(64, 'x');
+    rate = measure(connection_count * echoes, [&](net::io_context &ioc) -> net::awaitable<void> {
+        tls_stream ws{ioc, client_ctx};
+        co_await connect_tls(ws, tls_ep);
+        beast::flat_buffer buffer;
+        for (std::size_t i = 0; i < echoes; ++i)
+        {
+            co_await ws.async_write(net::buffer(payload), net::use_awaitable);
+            co_await ws.async_read(buffer, net::use_awaitable);
+            buffer.clear();
+        }
+    });
+    std::printf("%-12s %14.0f\n", "echo", rate);
+}
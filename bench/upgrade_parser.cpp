@@ -0,0 +1,280 @@
+//
+// Benchmark: parsing the server's 101 reply to the upgrade request
+//
+// Beast's response_parser filling a websocket::response_type, against
+// parse_upgrade_response with each scanner the CPU has. Before timing,
+// every scanner is run on random mutations and truncations of the
+// corpus: they must agree with each other, report every proper prefix of
+// a valid reply as incomplete, and whenever they accept an input Beast
+// must parse it to the same fields.
+//
+// The last column is the handshake's path: the selected scanner filling
+// a protocol::compact_response with every field, which must also match
+// Beast's message field for field.
+//
+
+#include "compact_response.hpp"
+#include "upgrade_parser.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/http/parser.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace net = boost::asio;
+namespace http = boost::beast::http;
+
+struct corpus_entry
+{
+    char const *name;
+    std::string text;
+};
+
+static std::vector<corpus_entry>
+corpus()
+{
+    return {
+    {"beast",
+     "HTTP/1.1 101 Switching Protocols\r\n"
+     "Upgrade: websocket\r\n"
+     "Connection: upgrade\r\n"
+     "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+     "Server: Boost.Beast/300\r\n"
+     "\r\n"},
+    {"deflate",
+     "HTTP/1.1 101 Switching Protocols\r\n"
+     "Upgrade: websocket\r\n"
+     "Connection: Upgrade\r\n"
+     "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+     "Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover; client_max_window_bits=15\r\n"
+     "\r\n"},
+    {"proxied",
+     "HTTP/1.1 101 Switching Protocols\r\n"
+     "Date: Fri, 16 Oct 2026 09:12:44 GMT\r\n"
+     "Connection: upgrade\r\n"
+     "Upgrade: websocket\r\n"
+     "Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n"
+     "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=15\r\n"
+     "Sec-WebSocket-Protocol: chat.v2\r\n"
+     "Strict-Transport-Security: max-age=31536000; includeSubDomains\r\n"
+     "Via: 1.1 edge-proxy-17.example.net (squid/5.7)\r\n"
+     "X-Request-Id: 4f1c2b7e-9d3a-4e61-a8c5-0b2f6d9e1a73\r\n"
+     "X-Served-By: cache-fra-etou8220123-FRA\r\n"
+     "CF-Cache-Status: DYNAMIC\r\n"
+     "Server: cloudflare\r\n"
+     "\r\n"}};
+}
+
+struct candidate
+{
+    char const *name;
+    protocol::detail::scanner scanner;
+};
+
+static std::vector<candidate>
+candidates()
+{
+    using namespace protocol::detail;
+    std::vector<candidate> v{{"scalar", {"scalar", &value_end_scalar, &name_end_scalar}}};
+#if defined(WEBSOCKET_HANDSHAKE_UPGRADE_X86)
+    if (__builtin_cpu_supports("sse4.2"))
+        v.push_back({"sse4.2", {"sse4.2", &value_end_sse42, &name_end_sse42}});
+    if (__builtin_cpu_supports("avx2"))
+        v.push_back({"avx2", {"avx2", &value_end_avx2, &name_end_avx2}});
+#endif
+    return v;
+}
+
+static bool
+beast_parse(std::string_view in, http::response_parser<http::string_body> &p)
+{
+    boost::beast::error_code ec;
+    p.eager(true);
+    p.put(net::buffer(in.data(), in.size()), ec);
+    return !ec && p.is_done();
+}
+
+static bool
+fill(std::string_view in, protocol::compact_response &res, protocol::detail::scanner const &s)
+{
+    protocol::upgrade_response r;
+    res.clear();
+    auto const result = parse_upgrade_response(in, r, s, [&](std::string_view name, std::string_view value) {
+        res.insert(name, value);
+        return true;
+    });
+    if (result != protocol::parse_result::complete)
+        return false;
+    res.reason(r.reason);
+    res.result(101);
+    return true;
+}
+
+static bool
+same(std::string_view ours, http::response<http::string_body> const &res, http::field f)
+{
+    auto const it = res.find(f);
+    if (it == res.end())
+        return ours.data() == nullptr;
+    return ours.data() && ours == std::string_view{it->value().data(), it->value().size()};
+}
+
+[[noreturn]] static void
+fail(char const *what, std::string const &input)
+{
+    std::fprintf(stderr, "%s on input:\n%s\n", what, input.c_str());
+    std::exit(EXIT_FAILURE);
+}
+
+static void
+verify(std::vector<candidate> const &cs)
+{
+    auto const texts = corpus();
+
+    // Every proper prefix of a valid reply needs more bytes
+    for (auto const &e : texts)
+        for (std::size_t n = 0; n < e.text.size(); ++n)
+            for (auto const &c : cs)
+            {
+                protocol::upgrade_response r;
+                if (parse_upgrade_response(std::string_view{e.text}.substr(0, n), r, c.scanner) !=
+                    protocol::parse_result::incomplete)
+                    fail("prefix not incomplete", e.text.substr(0, n));
+            }
+
+    std::mt19937 rng{11};
+    static constexpr char interesting[] = {'\r', '\n', ':', ' ', '\t', '\0', '\x7f', '\x80', '\xff', ',', 'a', '1'};
+    std::size_t accepted = 0;
+    std::size_t const rounds = 200000;
+    for (std::size_t i = 0; i < rounds; ++i)
+    {
+        std::string s = texts[rng() % texts.size()].text;
+        for (int edits = 1 + rng() % 4; edits > 0; --edits)
+        {
+            std::size_t const at = rng() % s.size();
+            char const c = interesting[rng() % sizeof(interesting)];
+            switch (rng() % 4)
+            {
+            case 0:
+                s[at] = c;
+                break;
+            case 1:
+                s.insert(s.begin() + at, c);
+                break;
+            case 2:
+                s.erase(at, 1 + rng() % 3);
+                break;
+            case 3:
+                s.resize(at);
+                break;
+            }
+            if (s.empty())
+                s = "H";
+        }
+
+        // Exact-size copy so that reading past the end is caught by
+        // sanitizers
+        std::vector<char> exact(s.begin(), s.end());
+        std::string_view const in{exact.data(), exact.size()};
+
+        protocol::upgrade_response first;
+        auto const result = parse_upgrade_response(in, first, cs.front().scanner);
+        for (auto const &c : cs)
+        {
+            protocol::upgrade_response r;
+            if (parse_upgrade_response(in, r, c.scanner) != result ||
+                r.size != first.size || r.fields != first.fields ||
+                r.connection != first.connection || r.sec_accept != first.sec_accept ||
+                r.extensions != first.extensions)
+                fail("scanners disagree", s);
+        }
+        if (result != protocol::parse_result::complete)
+            continue;
+
+        ++accepted;
+        http::response_parser<http::string_body> p;
+        if (!beast_parse(in.substr(0, first.size), p))
+            fail("accepted but Beast rejects", s);
+        auto const &res = p.get();
+        if (res.result_int() != 101 || res.version() != 11 ||
+            !same(first.connection, res, http::field::connection) ||
+            !same(first.upgrade, res, http::field::upgrade) ||
+            !same(first.sec_accept, res, http::field::sec_websocket_accept) ||
+            !same(first.extensions, res, http::field::sec_websocket_extensions) ||
+            !same(first.subprotocol, res, http::field::sec_websocket_protocol))
+            fail("fields differ from Beast", s);
+
+        protocol::compact_response compact;
+        if (!fill(in, compact, cs.front().scanner) || compact.reason() != res.reason() ||
+            compact.size() != first.fields)
+            fail("compact response incomplete", s);
+        // Beast keeps repeated fields next to each other, and its find()
+        // may give any of them; compare each name's values in order, and
+        // lookups against the first
+        for (auto const &f : compact)
+        {
+            std::vector<std::string_view> ours, theirs;
+            for (auto const &g : compact)
+                if (boost::beast::iequals(g.name_string(), f.name_string()))
+                    ours.push_back(g.value());
+            for (auto const &g : res)
+                if (boost::beast::iequals(g.name_string(), f.name_string()))
+                    theirs.push_back(g.value());
+            if (ours != theirs || compact[f.name_string()] != ours.front())
+                fail("compact response differs from Beast", s);
+        }
+    }
+    std::printf("cross-check: %zu mutations, %zu accepted, all agree with Beast\n\n", rounds, accepted);
+}
+
+template<class F>
+static double
+ns_per(std::size_t n, F &&f)
+{
+    auto const t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < n; ++i)
+        f();
+    auto const t1 = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(t1 - t0).count() / double(n);
+}
+
+int
+main()
+{
+    auto const cs = candidates();
+    verify(cs);
+    std::printf("dispatch selects: %s\n\n", protocol::upgrade_parser_kernel_name());
+
+    std::printf("%10s %6s %10s", "response", "bytes", "beast");
+    for (auto const &c : cs)
+        std::printf(" %10s", c.name);
+    std::printf(" %10s   (ns per response)\n", "compact");
+
+    std::size_t const n = 500000;
+    for (auto const &e : corpus())
+    {
+        std::printf("%10s %6zu", e.name, e.text.size());
+        std::size_t sink = 0;
+        std::printf(" %10.1f", ns_per(n, [&] {
+                        http::response_parser<http::string_body> p;
+                        sink += beast_parse(e.text, p);
+                    }));
+        for (auto const &c : cs)
+            std::printf(" %10.1f", ns_per(n, [&] {
+                            protocol::upgrade_response r;
+                            sink += parse_upgrade_response(e.text, r, c.scanner) == protocol::parse_result::complete;
+                        }));
+        std::printf(" %10.1f", ns_per(n, [&] {
+                        protocol::compact_response r;
+                        sink += fill(e.text, r, protocol::detail::active_scanner());
+                    }));
+        if (sink != n * (cs.size() + 2))
+            std::exit(EXIT_FAILURE);
+        std::printf("\n");
+    }
+}
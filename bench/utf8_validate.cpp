@@ -0,0 +1,171 @@
+//
+// Benchmark: UTF-8 validation throughput for inbound text messages
+//
+// Compares Beast's byte-at-a-time checker with our scalar and vector
+// validators on an ASCII-heavy and a multibyte-heavy corpus. A randomized
+// cross-check against Beast's checker, with random fragmentation, runs
+// first.
+//
+
+#include "utf8.hpp"
+
+#include <boost/beast/websocket/detail/utf8_checker.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace detail = boost::beast::websocket::detail;
+
+static void
+append_code_point(std::string &s, std::uint32_t cp)
+{
+    if (cp < 0x80)
+        s += char(cp);
+    else if (cp < 0x800)
+    {
+        s += char(0xc0 | (cp >> 6));
+        s += char(0x80 | (cp & 0x3f));
+    }
+    else if (cp < 0x10000)
+    {
+        s += char(0xe0 | (cp >> 12));
+        s += char(0x80 | ((cp >> 6) & 0x3f));
+        s += char(0x80 | (cp & 0x3f));
+    }
+    else
+    {
+        s += char(0xf0 | (cp >> 18));
+        s += char(0x80 | ((cp >> 12) & 0x3f));
+        s += char(0x80 | ((cp >> 6) & 0x3f));
+        s += char(0x80 | (cp & 0x3f));
+    }
+}
+
+// `ascii` is the share of code points below 0x80
+static std::string
+make_corpus(std::size_t size, double ascii, std::mt19937 &rng)
+{
+    std::uniform_real_distribution<double> pick{0.0, 1.0};
+    std::uniform_int_distribution<std::uint32_t> low{0x20, 0x7e};
+    std::uniform_int_distribution<std::uint32_t> two{0x80, 0x7ff};
+    std::uniform_int_distribution<std::uint32_t> three{0x800, 0xffff};
+    std::uniform_int_distribution<std::uint32_t> four{0x10000, 0x10ffff};
+    std::string s;
+    while (s.size() < size)
+    {
+        double const r = pick(rng);
+        std::uint32_t cp;
+        if (r < ascii)
+            cp = low(rng);
+        else if (r < ascii + (1 - ascii) / 3)
+            cp = two(rng);
+        else if (r < ascii + 2 * (1 - ascii) / 3)
+        {
+            do
+                cp = three(rng);
+            while (cp >= 0xd800 && cp <= 0xdfff);
+        }
+        else
+            cp = four(rng);
+        append_code_point(s, cp);
+    }
+    return s;
+}
+
+static bool
+beast_check(std::string const &s)
+{
+    detail::utf8_checker c;
+    return c.write(reinterpret_cast<std::uint8_t const *>(s.data()), s.size()) && c.finish();
+}
+
+template<class Validator>
+static bool
+fragmented(Validator &&v, std::string const &s, std::mt19937 &rng)
+{
+    std::uniform_int_distribution<std::size_t> cut{0, 70};
+    std::size_t pos = 0;
+    bool ok = true;
+    while (pos < s.size())
+    {
+        std::size_t const n = (std::min)(cut(rng), s.size() - pos);
+        ok = v.write(s.data() + pos, n) && ok;
+        pos += n;
+    }
+    return v.finish() && ok;
+}
+
+static void
+cross_check()
+{
+    std::mt19937 rng{1234};
+    std::uniform_int_distribution<int> byte{0, 255};
+    std::vector<utf8::detail::blocks_fn> kernels{nullptr};
+#if defined(WEBSOCKET_HANDSHAKE_UTF8_X86)
+    if (__builtin_cpu_supports("ssse3"))
+        kernels.push_back(&utf8::detail::blocks_ssse3);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(&utf8::detail::blocks_avx2);
+#endif
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string s = make_corpus(std::size_t(rng() % 300), (i % 3) * 0.4, rng);
+        // Corrupt most inputs in a few places
+        for (int k = int(rng() % 3); k > 0 && !s.empty(); --k)
+            s[rng() % s.size()] = char(byte(rng));
+        bool const expect = beast_check(s);
+        for (auto fn : kernels)
+            if (fragmented(utf8::validator{fn}, s, rng) != expect)
+            {
+                std::fprintf(stderr, "mismatch on case %d\n", i);
+                std::exit(EXIT_FAILURE);
+            }
+    }
+}
+
+template<class F>
+static double
+throughput(std::string const &s, F const &f)
+{
+    std::size_t const rounds = (std::size_t{1} << 30) / s.size();
+    auto const t0 = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < rounds; ++i)
+        if (!f(s))
+            std::abort();
+    auto const t1 = std::chrono::steady_clock::now();
+    return double(s.size()) * double(rounds) / std::chrono::duration<double>(t1 - t0).count() / 1e9;
+}
+
+int
+main()
+{
+    cross_check();
+    std::printf("dispatch selects: %s\n\n", utf8::kernel_name());
+
+    std::mt19937 rng{99};
+    struct corpus
+    {
+        char const *name;
+        std::string text;
+    };
+    corpus const corpora[] = {{"ascii", make_corpus(1 << 20, 1.0, rng)},
+                              {"ascii-heavy", make_corpus(1 << 20, 0.97, rng)},
+                              {"multibyte-heavy", make_corpus(1 << 20, 0.1, rng)}};
+
+    std::printf("%-16s %10s %10s %10s\n", "corpus", "beast", "scalar", utf8::kernel_name());
+    for (auto const &c : corpora)
+    {
+        double const b = throughput(c.text, beast_check);
+        double const sc = throughput(c.text, [](std::string const &s) {
+            utf8::scalar_validator v;
+            return v.write(s.data(), s.size()) && v.finish();
+        });
+        double const v = throughput(c.text, [](std::string const &s) {
+            return utf8::validate(s.data(), s.size());
+        });
+        std::printf("%-16s %10.2f %10.2f %10.2f   GB/s\n", c.name, b, sc, v);
+    }
+}
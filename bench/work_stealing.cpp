@@ -0,0 +1,91 @@
+//
+// Benchmark: skewed per-connection load, inline versus work stealing
+//
+// Connections are coroutines pinned to the contexts of an io_context_pool.
+// Each message costs a fixed amount of CPU, standing in for parsing and
+// decompression. The connections on context 0 are hot and receive most
+// of the messages. Inline, that work runs on the owning context; with
+// offload() it goes to the work-stealing pool and idle workers pick it up.
+// A post() between messages stands in for the socket read.
+//
+
+#include "io_pool.hpp"
+#include "work_stealing.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace net = boost::asio;
+
+static constexpr std::size_t connections_per_context = 8;
+static constexpr std::size_t cold_messages = 200;
+static constexpr std::size_t hot_messages = 4000;
+
+// About ten microseconds of hashing
+static std::uint64_t
+process(std::uint64_t seed)
+{
+    std::uint64_t h = 1469598103934665603ull ^ seed;
+    for (int i = 0; i < 16 * 1024; ++i)
+        h = (h ^ static_cast<std::uint64_t>(i)) * 1099511628211ull;
+    return h;
+}
+
+static std::atomic<std::uint64_t> sink{0};
+
+static net::awaitable<void>
+connection(std::size_t messages, runtime::work_stealing_pool *pool, std::size_t id)
+{
+    std::uint64_t h = id;
+    for (std::size_t i = 0; i < messages; ++i)
+    {
+        co_await net::post(co_await net::this_coro::executor, net::use_awaitable);
+        if (pool)
+            h = co_await runtime::offload(*pool, [h] { return process(h); }, net::use_awaitable, id);
+        else
+            h = process(h);
+    }
+    sink.fetch_add(h, std::memory_order_relaxed);
+}
+
+static double
+run(std::size_t contexts, runtime::work_stealing_pool *pool)
+{
+    runtime::io_context_pool io{contexts};
+    std::size_t total = 0;
+    for (std::size_t c = 0; c < contexts; ++c)
+        for (std::size_t k = 0; k < connections_per_context; ++k)
+        {
+            std::size_t const messages = c == 0 ? hot_messages : cold_messages;
+            total += messages;
+            net::co_spawn(io.get(c), connection(messages, pool, c * connections_per_context + k), net::detached);
+        }
+    auto const t0 = std::chrono::steady_clock::now();
+    io.run();
+    auto const t1 = std::chrono::steady_clock::now();
+    return double(total) / std::chrono::duration<double>(t1 - t0).count();
+}
+
+int
+main()
+{
+    std::size_t const cores = (std::max)(1u, std::thread::hardware_concurrency());
+
+    std::printf("%zu contexts, %zu connections each, context 0 hot\n", cores, connections_per_context);
+    std::printf("%-16s %14s %10s %10s\n", "mode", "messages/s", "speedup", "stolen");
+    double const inline_rate = run(cores, nullptr);
+    std::printf("%-16s %14.0f %10.2f %10s\n", "inline", inline_rate, 1.0, "-");
+
+    runtime::work_stealing_pool pool{cores};
+    double const stealing_rate = run(cores, &pool);
+    std::printf("%-16s %14.0f %10.2f %10zu\n", "work stealing", stealing_rate,
+                stealing_rate / inline_rate, pool.stats().stolen);
+}
@@ -0,0 +1,86 @@
+//
+// Benchmark: messages per second for bursts of 64-byte messages
+//
+// One write per message through Beast against the coalescing writer,
+// which packs each burst into a single write on the socket. The writer
+// runs on a socket upgraded by the sans-I/O core, which leaves the
+// socket to its caller, rather than under a websocket::stream.
+//
+
+#include "loopback.hpp"
+#include "protocol_io.hpp"
+#include "write_coalescer.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace net = boost::asio;
+namespace websocket = boost::beast::websocket;
+using tcp = net::ip::tcp;
+
+static constexpr std::size_t message_count = 200000;
+
+// Upgrade a plain socket to the loopback server with the core
+static void
+connect(tcp::socket &socket, unsigned short port)
+{
+    socket.connect({net::ip::make_address("127.0.0.1"), port});
+    socket.set_option(tcp::no_delay(true));
+    protocol::handshake hs{"127.0.0.1", "/"};
+    protocol::upgrade(socket, hs);
+    if (hs.error())
+        throw std::runtime_error("upgrade failed: " + hs.error().message());
+}
+
+// Wait until the server has seen every message of this run
+static void
+drain(loopback::server const &srv, std::size_t expect)
+{
+    while (srv.received() < expect)
+        std::this_thread::yield();
+}
+
+int
+main()
+{
+    loopback::server srv{loopback::mode::sink};
+    std::string const payload(64, 'x');
+    std::size_t expect = 0;
+
+    std::printf("%-24s %8s %14s %10s\n", "mode", "burst", "messages/s", "batching");
+    {
+        net::io_context ioc;
+        websocket::stream<tcp::socket> ws{ioc};
+        loopback::connect(ws, srv.port());
+
+        auto const t0 = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < message_count; ++i)
+            ws.write(net::buffer(payload));
+        drain(srv, expect += message_count);
+        auto const t1 = std::chrono::steady_clock::now();
+        std::printf("%-24s %8d %14.0f %10.2f\n", "beast write", 1,
+                    double(message_count) / std::chrono::duration<double>(t1 - t0).count(), 1.0);
+    }
+
+    for (std::size_t burst : {1, 4, 16, 64, 256})
+    {
+        net::io_context ioc;
+        tcp::socket socket{ioc};
+        connect(socket, srv.port());
+        frame::coalescing_writer<tcp::socket> writer{socket};
+
+        auto const t0 = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < message_count; ++i)
+            if (writer.push(net::buffer(payload)) || (i + 1) % burst == 0)
+                writer.flush();
+        writer.flush();
+        drain(srv, expect += message_count);
+        auto const t1 = std::chrono::steady_clock::now();
+        std::printf("%-24s %8zu %14.0f %10.2f\n", "coalescing writer", burst,
+                    double(message_count) / std::chrono::duration<double>(t1 - t0).count(),
+                    writer.stats().batching_factor());
+    }
+}
@@ -0,0 +1,468 @@
+#ifndef WEBSOCKET_HANDSHAKE_BINLOG_HPP
+#define WEBSOCKET_HANDSHAKE_BINLOG_HPP
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace binlog {
+    namespace net = boost::asio;
+    namespace http = boost::beast::http;
+
+    // Compact binary log records, formatted to text later.
+    //
+    // The hot thread writes a format id, a timestamp and the raw bytes of
+    // each argument; turning them into text happens on the flusher thread
+    // or offline with binlog_decode. Format strings use {} for each
+    // argument and are registered once per call site.
+    //
+    // A binary log file is the magic below and a u32 byte order mark,
+    // followed by records:
+    //
+    //     definition: 'D' u32 id  u32 length  format bytes
+    //     entry:      'E' u32 id  u64 unix ns  u32 length  argument bytes
+    //
+    // A definition precedes the first entry that uses its id. Integers are
+    // copied in host byte order, so the mark only reads as byte_order_mark
+    // on a host with the byte order of the writer. Each argument starts
+    // with a one-byte tag.
+
+    static constexpr std::string_view file_magic = "WSBINLOG2\n";
+    static constexpr std::uint32_t byte_order_mark = 0x01020304;
+
+    enum class record : char
+    {
+        definition = 'D',
+        entry = 'E'
+    };
+
+    enum class tag : std::uint8_t
+    {
+        i64,
+        u64,
+        f64,
+        boolean,
+        // u32 length, text
+        string,
+        // u32 length, raw payload bytes, printed as they are
+        bytes,
+        // u32 version, u32 status, string reason, u32 count, count times
+        // (string name, string value), string body
+        response
+    };
+
+    // A string literal usable as a template argument
+    template<std::size_t N>
+    struct fixed_string
+    {
+        char value[N];
+
+        constexpr fixed_string(char const (&s)[N])
+        {
+            std::copy_n(s, N, value);
+        }
+
+        constexpr std::string_view
+        view() const
+        {
+            return {value, N - 1};
+        }
+    };
+
+    // Format strings by id. Only touched when a call site first runs and
+    // when records are rendered.
+    class registry
+    {
+    public:
+        static registry &
+        get()
+        {
+            static registry r;
+            return r;
+        }
+
+        std::uint32_t
+        add(std::string_view format)
+        {
+            std::lock_guard lock{mutex_};
+            formats_.emplace_back(format);
+            return static_cast<std::uint32_t>(formats_.size() - 1);
+        }
+
+        std::string
+        format(std::uint32_t id) const
+        {
+            std::lock_guard lock{mutex_};
+            return id < formats_.size() ? formats_[id] : std::string{};
+        }
+
+    private:
+        mutable std::mutex mutex_;
+        std::vector<std::string> formats_;
+    };
+
+    template<fixed_string Format>
+    std::uint32_t
+    format_id()
+    {
+        static std::uint32_t const id = registry::get().add(Format.view());
+        return id;
+    }
+
+    //------------------------------------------------------------------------------
+
+    template<class T>
+    void
+    put(std::string &out, T v)
+    {
+        static_assert(std::is_trivially_copyable_v<T>);
+        char b[sizeof(T)];
+        std::memcpy(b, &v, sizeof(T));
+        out.append(b, sizeof(T));
+    }
+
+    inline void
+    put_string(std::string &out, std::string_view s)
+    {
+        put(out, static_cast<std::uint32_t>(s.size()));
+        out.append(s);
+    }
+
+    // What a binary log file starts with
+    inline std::string
+    file_header()
+    {
+        std::string out{file_magic};
+        put(out, byte_order_mark);
+        return out;
+    }
+
+    inline void
+    encode(std::string &out, bool v)
+    {
+        out += char(tag::boolean);
+        out += char(v);
+    }
+
+    template<class T>
+    std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool> && !std::is_same_v<T, char>>
+    encode(std::string &out, T v)
+    {
+        if constexpr (std::is_signed_v<T>)
+        {
+            out += char(tag::i64);
+            put(out, static_cast<std::int64_t>(v));
+        }
+        else
+        {
+            out += char(tag::u64);
+            put(out, static_cast<std::uint64_t>(v));
+        }
+    }
+
+    template<class T>
+    std::enable_if_t<std::is_floating_point_v<T>>
+    encode(std::string &out, T v)
+    {
+        out += char(tag::f64);
+        put(out, static_cast<double>(v));
+    }
+
+    inline void
+    encode(std::string &out, std::string_view s)
+    {
+        out += char(tag::string);
+        put_string(out, s);
+    }
+
+    // Without this a string literal would take the bool overload
+    inline void
+    encode(std::string &out, char const *s)
+    {
+        encode(out, std::string_view{s});
+    }
+
+    inline void
+    encode(std::string &out, char c)
+    {
+        encode(out, std::string_view{&c, 1});
+    }
+
+    // Buffer sequences: the payload is copied as it is and only rendered
+    // later. Pass buffer.data() rather than make_printable(), which hides
+    // its buffers and would be formatted on the spot.
+    template<class Buffers>
+    std::enable_if_t<net::is_const_buffer_sequence<Buffers>::value>
+    encode(std::string &out, Buffers const &buffers)
+    {
+        out += char(tag::bytes);
+        put(out, static_cast<std::uint32_t>(net::buffer_size(buffers)));
+        for (auto it = net::buffer_sequence_begin(buffers); it != net::buffer_sequence_end(buffers); ++it)
+        {
+            net::const_buffer b = *it;
+            out.append(static_cast<char const *>(b.data()), b.size());
+        }
+    }
+
+    namespace detail {
+        // Beast's accessors for a response with a string body, as
+        // http::response<http::string_body> and protocol::compact_response
+        // have
+        template<class T>
+        concept response_like = requires(T const &r) {
+            r.version();
+            r.result_int();
+            r.reason();
+            r.body();
+            r.begin() != r.end();
+            (*r.begin()).name_string();
+            (*r.begin()).value();
+        };
+    }// namespace detail
+
+    template<detail::response_like Response>
+    void
+    encode(std::string &out, Response const &res)
+    {
+        out += char(tag::response);
+        put(out, static_cast<std::uint32_t>(res.version()));
+        put(out, static_cast<std::uint32_t>(res.result_int()));
+        put_string(out, res.reason());
+        std::uint32_t n = 0;
+        for (auto it = res.begin(); it != res.end(); ++it)
+            ++n;
+        put(out, n);
+        for (auto const &f : res)
+        {
+            put_string(out, f.name_string());
+            put_string(out, f.value());
+        }
+        put_string(out, res.body());
+    }
+
+    namespace detail {
+        template<class T>
+        concept encodable = requires(std::string &out, T const &v) { binlog::encode(out, v); };
+    }
+
+    // Anything else is formatted now with its operator<<
+    template<class T>
+    requires(!detail::encodable<T>) void
+    encode(std::string &out, T const &v)
+    {
+        thread_local std::ostringstream os;
+        os.str({});
+        os << v;
+        encode(out, std::string_view{os.view()});
+    }
+
+    // Append one entry for `Format` with `args` to `out`
+    template<fixed_string Format, class... Args>
+    void
+    write_entry(std::string &out, Args const &...args)
+    {
+        std::uint64_t const ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                 std::chrono::system_clock::now().time_since_epoch())
+                                 .count();
+        out += char(record::entry);
+        put(out, format_id<Format>());
+        put(out, ns);
+        std::size_t const at = out.size();
+        put(out, std::uint32_t{0});
+        (encode(out, args), ...);
+        std::uint32_t const n = static_cast<std::uint32_t>(out.size() - at - sizeof(std::uint32_t));
+        std::memcpy(out.data() + at, &n, sizeof(n));
+    }
+
+    inline void
+    write_definition(std::string &out, std::uint32_t id, std::string_view format)
+    {
+        out += char(record::definition);
+        put(out, id);
+        put_string(out, format);
+    }
+
+    //------------------------------------------------------------------------------
+
+    // Reads the encoding above, failing softly on truncated input
+    class cursor
+    {
+    public:
+        explicit cursor(std::string_view in)
+            : in_(in)
+        {
+        }
+
+        bool
+        empty() const noexcept
+        {
+            return in_.empty();
+        }
+
+        template<class T>
+        std::optional<T>
+        get()
+        {
+            if (in_.size() < sizeof(T))
+                return std::nullopt;
+            T v;
+            std::memcpy(&v, in_.data(), sizeof(T));
+            in_.remove_prefix(sizeof(T));
+            return v;
+        }
+
+        std::optional<std::string_view>
+        get_bytes(std::size_t n)
+        {
+            if (in_.size() < n)
+                return std::nullopt;
+            auto s = in_.substr(0, n);
+            in_.remove_prefix(n);
+            return s;
+        }
+
+        std::optional<std::string_view>
+        get_string()
+        {
+            auto n = get<std::uint32_t>();
+            return n ? get_bytes(*n) : std::nullopt;
+        }
+
+        std::string_view
+        rest() const noexcept
+        {
+            return in_;
+        }
+
+    private:
+        std::string_view in_;
+    };
+
+    // Render one tagged argument as text, or return false if malformed
+    inline bool
+    render_arg(cursor &c, std::string &out)
+    {
+        auto t = c.get<std::uint8_t>();
+        if (!t)
+            return false;
+        switch (tag(*t))
+        {
+        case tag::i64:
+        {
+            auto v = c.get<std::int64_t>();
+            if (!v)
+                return false;
+            out += std::to_string(*v);
+            return true;
+        }
+        case tag::u64:
+        {
+            auto v = c.get<std::uint64_t>();
+            if (!v)
+                return false;
+            out += std::to_string(*v);
+            return true;
+        }
+        case tag::f64:
+        {
+            auto v = c.get<double>();
+            if (!v)
+                return false;
+            std::ostringstream os;
+            os << *v;
+            out += os.view();
+            return true;
+        }
+        case tag::boolean:
+        {
+            auto v = c.get<char>();
+            if (!v)
+                return false;
+            out += *v ? "1" : "0";
+            return true;
+        }
+        case tag::string:
+        case tag::bytes:
+        {
+            auto s = c.get_string();
+            if (!s)
+                return false;
+            out += *s;
+            return true;
+        }
+        case tag::response:
+        {
+            auto version = c.get<std::uint32_t>();
+            auto status = c.get<std::uint32_t>();
+            auto reason = c.get_string();
+            auto count = c.get<std::uint32_t>();
+            if (!version || !status || !reason || !count)
+                return false;
+            // Same layout as Beast's operator<< for a response
+            out += "HTTP/";
+            out += std::to_string(*version / 10);
+            out += '.';
+            out += std::to_string(*version % 10);
+            out += ' ';
+            out += std::to_string(*status);
+            out += ' ';
+            out += *reason;
+            out += "\r\n";
+            for (std::uint32_t i = 0; i < *count; ++i)
+            {
+                auto name = c.get_string();
+                auto value = c.get_string();
+                if (!name || !value)
+                    return false;
+                out += *name;
+                out += ": ";
+                out += *value;
+                out += "\r\n";
+            }
+            out += "\r\n";
+            auto body = c.get_string();
+            if (!body)
+                return false;
+            out += *body;
+            return true;
+        }
+        }
+        return false;
+    }
+
+    // Substitute the encoded arguments for the {} in `format`. Extra
+    // arguments are appended; missing ones leave the {} in place.
+    inline void
+    render(std::string_view format, std::string_view args, std::string &out)
+    {
+        cursor c{args};
+        for (;;)
+        {
+            auto const pos = format.find("{}");
+            if (pos == format.npos)
+                break;
+            out += format.substr(0, pos);
+            if (c.empty() || !render_arg(c, out))
+                out += "{}";
+            format.remove_prefix(pos + 2);
+        }
+        out += format;
+        while (!c.empty() && render_arg(c, out))
+            ;
+    }
+
+}// namespace binlog
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef WEBSOCKET_HANDSHAKE_BLOCKING_POOL_HPP
+#define WEBSOCKET_HANDSHAKE_BLOCKING_POOL_HPP
+
+#include <boost/asio/io_context.hpp>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace runtime {
+    namespace net = boost::asio;
+
+    struct blocking_metrics
+    {
+        std::size_t submitted = 0;
+        std::size_t started = 0;
+        std::size_t queued = 0;
+        std::size_t peak_queued = 0;
+
+        // Time jobs spent in the queue before a worker took them
+        std::chrono::nanoseconds total_wait{0};
+        std::chrono::nanoseconds max_wait{0};
+
+        std::chrono::nanoseconds
+        average_wait() const
+        {
+            return started ? total_wait / static_cast<std::chrono::nanoseconds::rep>(started) : std::chrono::nanoseconds{0};
+        }
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, blocking_metrics const &m)
+    {
+        using us = std::chrono::microseconds;
+        return os << "submitted=" << m.submitted
+                  << " started=" << m.started
+                  << " queued=" << m.queued
+                  << " peak_queued=" << m.peak_queued
+                  << " avg_wait_us=" << std::chrono::duration_cast<us>(m.average_wait()).count()
+                  << " max_wait_us=" << std::chrono::duration_cast<us>(m.max_wait).count();
+    }
+
+    // A fixed set of threads for blocking, synchronous work.
+    //
+    // Each worker owns an io_context that is never run; it only backs the
+    // I/O objects of blocking calls such as resolver::resolve() or
+    // websocket::stream::read(), so they stay off the contexts that drive
+    // coroutines. Jobs wait in a bounded FIFO: submit() blocks the caller
+    // while the queue is full rather than growing it or starting threads.
+    class blocking_pool
+    {
+    public:
+        explicit blocking_pool(std::size_t workers = 4, std::size_t queue_limit = 1024)
+            : limit_((std::max)(std::size_t{1}, queue_limit))
+        {
+            for (std::size_t i = 0; i < (std::max)(std::size_t{1}, workers); ++i)
+                workers_.push_back(std::make_unique<worker>());
+            for (auto &w : workers_)
+                w->thread = std::thread([this, &ioc = w->ioc] { work(ioc); });
+        }
+
+        blocking_pool(blocking_pool const &) = delete;
+        blocking_pool &operator=(blocking_pool const &) = delete;
+
+        // Finishes the queued jobs, then joins the workers
+        ~blocking_pool()
+        {
+            {
+                std::lock_guard lock{mutex_};
+                stopping_ = true;
+            }
+            ready_.notify_all();
+            for (auto &w : workers_)
+                w->thread.join();
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return workers_.size();
+        }
+
+        blocking_metrics
+        metrics() const
+        {
+            std::lock_guard lock{mutex_};
+            return metrics_;
+        }
+
+        // Run `f(io_context&)` on a worker, with that worker's context
+        template<class F>
+        auto
+        submit(F f) -> std::future<std::invoke_result_t<F &, net::io_context &>>
+        {
+            using result = std::invoke_result_t<F &, net::io_context &>;
+            auto task = std::make_shared<std::packaged_task<result(net::io_context &)>>(std::move(f));
+            auto future = task->get_future();
+            {
+                std::unique_lock lock{mutex_};
+                space_.wait(lock, [this] { return jobs_.size() < limit_; });
+                jobs_.push_back({[task](net::io_context &ioc) { (*task)(ioc); },
+                                 std::chrono::steady_clock::now()});
+                ++metrics_.submitted;
+                metrics_.queued = jobs_.size();
+                metrics_.peak_queued = (std::max)(metrics_.peak_queued, metrics_.queued);
+            }
+            ready_.notify_one();
+            return future;
+        }
+
+    private:
+        struct job
+        {
+            std::function<void(net::io_context &)> fn;
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        struct worker
+        {
+            net::io_context ioc{1};
+            std::thread thread;
+        };
+
+        void
+        work(net::io_context &ioc)
+        {
+            for (;;)
+            {
+                job j;
+                {
+                    std::unique_lock lock{mutex_};
+                    ready_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                    if (jobs_.empty())
+                        return;
+                    j = std::move(jobs_.front());
+                    jobs_.pop_front();
+                    metrics_.queued = jobs_.size();
+                    ++metrics_.started;
+                    auto const waited = std::chrono::steady_clock::now() - j.queued;
+                    metrics_.total_wait += waited;
+                    metrics_.max_wait = (std::max)(metrics_.max_wait, std::chrono::nanoseconds{waited});
+                }
+                space_.notify_one();
+
+                // Exceptions land in the job's future
+                j.fn(ioc);
+            }
+        }
+
+        std::size_t limit_;
+        std::vector<std::unique_ptr<worker>> workers_;
+        mutable std::mutex mutex_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+        std::deque<job> jobs_;
+        blocking_metrics metrics_;
+        bool stopping_ = false;
+    };
+
+}// namespace runtime
+
+#endif
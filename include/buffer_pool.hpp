@@ -0,0 +1,457 @@
+#ifndef WEBSOCKET_HANDSHAKE_BUFFER_POOL_HPP
+#define WEBSOCKET_HANDSHAKE_BUFFER_POOL_HPP
+
+#include <boost/asio/buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+namespace buffers {
+    namespace net = boost::asio;
+
+    // A block of memory handed out by the pool. The size class is
+    // remembered so the block can be put back on the right free list.
+    struct block
+    {
+        char *data = nullptr;
+        std::size_t size = 0;
+        int cls = -1;
+    };
+
+    // Counters kept per thread. A hit is an acquire that was served from a
+    // free list instead of the system allocator. A grow that mremap() could
+    // not do at the same address is counted as moved: no bytes were
+    // copied, but the block was reallocated.
+    struct pool_stats
+    {
+        std::size_t acquires = 0;
+        std::size_t hits = 0;
+        std::size_t releases = 0;
+        std::size_t trimmed = 0;
+        std::size_t grows_in_place = 0;
+        std::size_t grows_moved = 0;
+        std::size_t grows_copied = 0;
+        std::size_t bytes_copied = 0;
+
+        double
+        hit_rate() const
+        {
+            return acquires ? double(hits) / double(acquires) : 0.0;
+        }
+
+        // Fraction of released blocks that were kept for reuse
+        double
+        reuse_rate() const
+        {
+            return releases ? double(releases - trimmed) / double(releases) : 0.0;
+        }
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, pool_stats const &s)
+    {
+        return os << "acquires=" << s.acquires
+                  << " hits=" << s.hits
+                  << " hit_rate=" << s.hit_rate()
+                  << " releases=" << s.releases
+                  << " reuse_rate=" << s.reuse_rate()
+                  << " grows_in_place=" << s.grows_in_place
+                  << " grows_moved=" << s.grows_moved
+                  << " grows_copied=" << s.grows_copied
+                  << " bytes_copied=" << s.bytes_copied;
+    }
+
+    // Per-thread pool of power-of-two blocks from 512 bytes to 16 MiB.
+    //
+    // Small classes come from malloc. On Linux the large classes are
+    // anonymous mappings, so growing them is an mremap() which moves page
+    // table entries instead of copying the payload.
+    //
+    // Released blocks are kept for reuse up to a count per class, fewer
+    // for the mapped classes, and up to max_cached_bytes in all, so a
+    // thread that once read large messages does not hold on to them.
+    class pool
+    {
+    public:
+        static constexpr int min_shift = 9;
+        static constexpr int max_shift = 24;
+        static constexpr int class_count = max_shift - min_shift + 1;
+        static constexpr int mmap_shift = 17;
+        static constexpr std::size_t max_cached_per_class = 8;
+        static constexpr std::size_t max_cached_mapped = 2;
+        static constexpr std::size_t max_cached_bytes = 16 * 1024 * 1024;
+
+        pool() = default;
+        pool(pool const &) = delete;
+        pool &operator=(pool const &) = delete;
+
+        ~pool()
+        {
+            for (auto &list : free_)
+                for (auto &b : list)
+                    deallocate(b);
+        }
+
+        // The pool belonging to the calling thread
+        static pool &
+        local()
+        {
+            thread_local pool p;
+            return p;
+        }
+
+        static int
+        class_for(std::size_t n)
+        {
+            int cls = 0;
+            while (cls < class_count && class_size(cls) < n)
+                ++cls;
+            return cls < class_count ? cls : -1;
+        }
+
+        static std::size_t
+        class_size(int cls)
+        {
+            return std::size_t{1} << (cls + min_shift);
+        }
+
+        block
+        acquire(std::size_t n)
+        {
+            ++stats_.acquires;
+            int cls = class_for(n);
+            if (cls >= 0 && !free_[cls].empty())
+            {
+                ++stats_.hits;
+                block b = free_[cls].back();
+                free_[cls].pop_back();
+                cached_bytes_ -= b.size;
+                return b;
+            }
+            return allocate(cls, cls >= 0 ? class_size(cls) : round_to_page(n));
+        }
+
+        void
+        release(block b)
+        {
+            if (!b.data)
+                return;
+            ++stats_.releases;
+            if (b.cls >= 0 && free_[b.cls].size() < class_limit(b.cls) &&
+                b.size <= max_cached_bytes - cached_bytes_)
+            {
+                free_[b.cls].push_back(b);
+                cached_bytes_ += b.size;
+                return;
+            }
+            ++stats_.trimmed;
+            deallocate(b);
+        }
+
+        // Replace `b` with a block of at least `n` bytes, preserving the
+        // bytes in [offset, offset + used). Returns the new block; the live
+        // bytes keep their offset when the block was remapped and start at
+        // zero when they had to be copied.
+        block
+        grow(block b, std::size_t n, std::size_t offset, std::size_t used, bool &moved_to_front)
+        {
+            moved_to_front = false;
+            int cls = class_for(n);
+            std::size_t size = cls >= 0 ? class_size(cls) : round_to_page(n);
+#if defined(__linux__)
+            if (is_mapped(b) && is_mapped_size(size))
+            {
+                void *p = ::mremap(b.data, b.size, size, MREMAP_MAYMOVE);
+                if (p != MAP_FAILED)
+                {
+                    ++(p == b.data ? stats_.grows_in_place : stats_.grows_moved);
+                    return block{static_cast<char *>(p), size, cls};
+                }
+            }
+#endif
+            block nb = acquire(n);
+            if (used)
+                std::memcpy(nb.data, b.data + offset, used);
+            ++stats_.grows_copied;
+            stats_.bytes_copied += used;
+            release(b);
+            moved_to_front = true;
+            return nb;
+        }
+
+        pool_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+    private:
+        static std::size_t
+        class_limit(int cls)
+        {
+            return cls + min_shift >= mmap_shift ? max_cached_mapped : max_cached_per_class;
+        }
+
+        static std::size_t
+        round_to_page(std::size_t n)
+        {
+            constexpr std::size_t page = 4096;
+            return (n + page - 1) & ~(page - 1);
+        }
+
+        static bool
+        is_mapped_size(std::size_t size)
+        {
+#if defined(__linux__)
+            return size >= (std::size_t{1} << mmap_shift);
+#else
+            (void) size;
+            return false;
+#endif
+        }
+
+        static bool
+        is_mapped(block const &b)
+        {
+            return is_mapped_size(b.size);
+        }
+
+        static block
+        allocate(int cls, std::size_t size)
+        {
+            void *p = nullptr;
+#if defined(__linux__)
+            if (is_mapped_size(size))
+            {
+                p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED)
+                    throw std::bad_alloc();
+                return block{static_cast<char *>(p), size, cls};
+            }
+#endif
+            p = std::malloc(size);
+            if (!p)
+                throw std::bad_alloc();
+            return block{static_cast<char *>(p), size, cls};
+        }
+
+        static void
+        deallocate(block const &b)
+        {
+#if defined(__linux__)
+            if (is_mapped(b))
+            {
+                ::munmap(b.data, b.size);
+                return;
+            }
+#endif
+            std::free(b.data);
+        }
+
+        std::array<std::vector<block>, class_count> free_;
+        std::size_t cached_bytes_ = 0;
+        pool_stats stats_;
+    };
+
+    // A DynamicBuffer drawing its storage from the calling thread's pool.
+    //
+    // Behaves like beast::flat_buffer: the readable bytes are always one
+    // contiguous range. Memory goes back to the pool on destruction.
+    class pooled_buffer
+    {
+    public:
+        using const_buffers_type = net::const_buffer;
+        using mutable_buffers_type = net::mutable_buffer;
+
+        pooled_buffer() = default;
+
+        explicit pooled_buffer(std::size_t limit)
+            : max_(limit)
+        {
+        }
+
+        pooled_buffer(pooled_buffer &&other) noexcept
+            : b_(std::exchange(other.b_, block{}))
+            , in_(std::exchange(other.in_, 0))
+            , out_(std::exchange(other.out_, 0))
+            , last_(std::exchange(other.last_, 0))
+            , max_(other.max_)
+        {
+        }
+
+        pooled_buffer &
+        operator=(pooled_buffer &&other) noexcept
+        {
+            if (this != &other)
+            {
+                pool::local().release(b_);
+                b_ = std::exchange(other.b_, block{});
+                in_ = std::exchange(other.in_, 0);
+                out_ = std::exchange(other.out_, 0);
+                last_ = std::exchange(other.last_, 0);
+                max_ = other.max_;
+            }
+            return *this;
+        }
+
+        pooled_buffer(pooled_buffer const &) = delete;
+        pooled_buffer &operator=(pooled_buffer const &) = delete;
+
+        ~pooled_buffer()
+        {
+            pool::local().release(b_);
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return out_ - in_;
+        }
+
+        std::size_t
+        max_size() const noexcept
+        {
+            return max_;
+        }
+
+        std::size_t
+        capacity() const noexcept
+        {
+            return b_.size;
+        }
+
+        const_buffers_type
+        data() const noexcept
+        {
+            return {b_.data + in_, out_ - in_};
+        }
+
+        const_buffers_type
+        cdata() const noexcept
+        {
+            return data();
+        }
+
+        mutable_buffers_type
+        data() noexcept
+        {
+            return {b_.data + in_, out_ - in_};
+        }
+
+        // Make sure at least `n` bytes can be prepared without growing
+        void
+        reserve(std::size_t n)
+        {
+            if (n > capacity())
+                prepare(n - size());
+        }
+
+        mutable_buffers_type
+        prepare(std::size_t n)
+        {
+            if (n <= b_.size - out_)
+            {
+                last_ = out_ + n;
+                return {b_.data + out_, n};
+            }
+
+            std::size_t const len = size();
+            if (n > max_ || len > max_ - n)
+                throw std::length_error{"pooled_buffer overflow"};
+
+            if (len + n <= b_.size)
+            {
+                // Enough room once the consumed prefix is reclaimed
+                if (len)
+                    std::memmove(b_.data, b_.data + in_, len);
+                in_ = 0;
+                out_ = len;
+            }
+            else if (!b_.data)
+            {
+                b_ = pool::local().acquire(n);
+                in_ = out_ = 0;
+            }
+            else
+            {
+                // Grow to the next class, at least doubling
+                std::size_t want = (std::max)(len + n, b_.size * 2);
+                bool moved = false;
+                b_ = pool::local().grow(b_, (std::min)(want, max_), in_, len, moved);
+                if (moved)
+                {
+                    in_ = 0;
+                    out_ = len;
+                }
+                else if (n > b_.size - out_)
+                {
+                    // Remapped with the data at its old offset, which the
+                    // new size did not account for
+                    std::memmove(b_.data, b_.data + in_, len);
+                    in_ = 0;
+                    out_ = len;
+                }
+            }
+            assert(out_ + n <= b_.size);
+            last_ = out_ + n;
+            return {b_.data + out_, n};
+        }
+
+        void
+        commit(std::size_t n) noexcept
+        {
+            out_ += (std::min)(n, last_ - out_);
+        }
+
+        void
+        consume(std::size_t n) noexcept
+        {
+            if (n >= size())
+            {
+                in_ = out_ = last_ = 0;
+                return;
+            }
+            in_ += n;
+        }
+
+        void
+        clear() noexcept
+        {
+            in_ = out_ = last_ = 0;
+        }
+
+        // Hand the storage back to the pool
+        void
+        shrink_to_fit() noexcept
+        {
+            if (size())
+                return;
+            pool::local().release(std::exchange(b_, block{}));
+            in_ = out_ = last_ = 0;
+        }
+
+    private:
+        block b_;
+        std::size_t in_ = 0;
+        std::size_t out_ = 0;
+        std::size_t last_ = 0;
+        std::size_t max_ = (std::numeric_limits<std::size_t>::max)();
+    };
+
+}// namespace buffers
+
+#endif
@@ -0,0 +1,178 @@
+#ifndef WEBSOCKET_HANDSHAKE_CHUNK_READER_HPP
+#define WEBSOCKET_HANDSHAKE_CHUNK_READER_HPP
+
+#include "buffer_pool.hpp"
+#include "handler_memory.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#include <utility>
+
+namespace inbound {
+    namespace net = boost::asio;
+
+    struct chunk_options
+    {
+        // Chunks handed to the consumer hold at most this many bytes. Along
+        // with Beast's own read buffer this is the memory a connection
+        // needs to receive a message of any size.
+        std::size_t chunk_size = 64 * 1024;
+
+        // Largest message accepted, in bytes, applied to the stream while
+        // the reader exists. Zero keeps the stream's own read_message_max,
+        // 16 MiB unless changed. Nothing is buffered beyond one chunk, so
+        // a larger limit costs no memory here.
+        std::size_t message_limit = 0;
+    };
+
+    // Pulls one message off a websocket stream in bounded chunks.
+    //
+    // Each call to next() or async_next() returns the following chunk of
+    // payload, already decrypted, unmasked and inflated. The chunk stays
+    // valid until the next call. Once done() is true the message is
+    // complete, and the next call starts on the one after it.
+    //
+    //     inbound::chunk_reader reader{ws};
+    //     do
+    //         consume(reader.next());
+    //     while (!reader.done());
+    template<class Stream>
+    class chunk_reader
+    {
+    public:
+        explicit chunk_reader(Stream &ws, chunk_options opts = {})
+            : ws_(ws)
+            , opts_(opts)
+            , saved_limit_(ws.read_message_max())
+        {
+            if (opts_.message_limit)
+                ws_.read_message_max(opts_.message_limit);
+        }
+
+        chunk_reader(chunk_reader const &) = delete;
+        chunk_reader &operator=(chunk_reader const &) = delete;
+
+        // Give the stream back its own limit
+        ~chunk_reader()
+        {
+            if (opts_.message_limit)
+                ws_.read_message_max(saved_limit_);
+        }
+
+        // True once the last chunk of the message has been returned
+        bool
+        done() const noexcept
+        {
+            return done_;
+        }
+
+        // True if the message being read is text
+        bool
+        text() const
+        {
+            return ws_.got_text();
+        }
+
+        // Payload bytes returned so far for the current message
+        std::uint64_t
+        message_size() const noexcept
+        {
+            return size_;
+        }
+
+        net::const_buffer
+        next()
+        {
+            auto mb = start();
+            std::size_t n = 0;
+            do
+                n += ws_.read_some(mb + n);
+            while (n < mb.size() && !ws_.is_message_done());
+            return finish(n);
+        }
+
+        net::awaitable<net::const_buffer>
+        async_next()
+        {
+            auto mb = start();
+            std::size_t n = 0;
+            do
+                n += co_await ws_.async_read_some(mb + n, memory::use_recycled_awaitable);
+            while (n < mb.size() && !ws_.is_message_done());
+            co_return finish(n);
+        }
+
+    private:
+        net::mutable_buffer
+        start()
+        {
+            if (done_)
+            {
+                done_ = false;
+                size_ = 0;
+            }
+            buffer_.clear();
+            return buffer_.prepare(opts_.chunk_size);
+        }
+
+        net::const_buffer
+        finish(std::size_t n)
+        {
+            buffer_.commit(n);
+            size_ += n;
+            done_ = ws_.is_message_done();
+            return buffer_.data();
+        }
+
+        Stream &ws_;
+        chunk_options opts_;
+        std::size_t saved_limit_;
+        buffers::pooled_buffer buffer_;
+        std::uint64_t size_ = 0;
+        bool done_ = true;
+    };
+
+    // Read one message, calling `consumer(chunk, last)` for each chunk.
+    // Returns the message size.
+    template<class Stream, class Consumer>
+    std::uint64_t
+    read_chunks(Stream &ws, Consumer &&consumer, chunk_options opts = {})
+    {
+        chunk_reader<Stream> reader{ws, opts};
+        do
+        {
+            auto const chunk = reader.next();
+            consumer(chunk, reader.done());
+        } while (!reader.done());
+        return reader.message_size();
+    }
+
+    // As above. The consumer may itself be a coroutine returning
+    // net::awaitable<void>, in which case each chunk is awaited before
+    // the next is read, so a slow consumer slows the peer down through
+    // TCP flow control rather than piling up memory.
+    template<class Stream, class Consumer>
+    net::awaitable<std::uint64_t>
+    async_read_chunks(Stream &ws, Consumer consumer, chunk_options opts = {})
+    {
+        chunk_reader<Stream> reader{ws, opts};
+        do
+        {
+            auto const chunk = co_await reader.async_next();
+            if constexpr (std::is_same_v<std::invoke_result_t<Consumer &, net::const_buffer, bool>,
+                                         net::awaitable<void>>)
+                co_await consumer(chunk, reader.done());
+            else
+                consumer(chunk, reader.done());
+        } while (!reader.done());
+        co_return reader.message_size();
+    }
+
+}// namespace inbound
+
+#endif
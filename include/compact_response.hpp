@@ -0,0 +1,473 @@
+#ifndef WEBSOCKET_HANDSHAKE_COMPACT_RESPONSE_HPP
+#define WEBSOCKET_HANDSHAKE_COMPACT_RESPONSE_HPP
+
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/status.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace protocol {
+    namespace http = boost::beast::http;
+
+    namespace detail {
+        // Fields the handshake looks up, or that most servers send. Each
+        // gets a slot in a perfect hash table, so finding one is a hash
+        // and a compare. Names are lower case.
+        inline constexpr std::string_view known_names[] = {
+        "upgrade",
+        "connection",
+        "sec-websocket-accept",
+        "sec-websocket-extensions",
+        "sec-websocket-protocol",
+        "sec-websocket-version",
+        "server",
+        "date",
+        "content-length",
+        "content-type",
+        "transfer-encoding",
+        "set-cookie",
+        "www-authenticate",
+        "location",
+        "cache-control",
+        "via"};
+
+        inline constexpr std::size_t known_count = std::size(known_names);
+        inline constexpr std::size_t table_size = 32;
+
+        constexpr unsigned char
+        lower(char c)
+        {
+            return static_cast<unsigned char>(c >= 'A' && c <= 'Z' ? c | 0x20 : c);
+        }
+
+        // Weights of the length and the first byte
+        struct hash_seed
+        {
+            unsigned size = 0;
+            unsigned first = 0;
+        };
+
+        constexpr std::size_t
+        known_hash(std::string_view name, hash_seed seed)
+        {
+            if (name.empty())
+                return 0;
+            std::size_t const n = name.size();
+            return (n * seed.size + lower(name[0]) * seed.first + lower(name[n - 1]) + lower(name[n / 2]) * 3) %
+                   table_size;
+        }
+
+        constexpr bool
+        is_perfect(hash_seed seed)
+        {
+            bool used[table_size] = {};
+            for (auto name : known_names)
+            {
+                auto const h = known_hash(name, seed);
+                if (used[h])
+                    return false;
+                used[h] = true;
+            }
+            return true;
+        }
+
+        constexpr hash_seed
+        find_seed()
+        {
+            for (unsigned size = 1; size < 64; ++size)
+                for (unsigned first = 1; first < 64; ++first)
+                    if (is_perfect({size, first}))
+                        return {size, first};
+            return {};
+        }
+
+        // Chosen at compile time so that no two known names share a slot
+        inline constexpr hash_seed known_seed = find_seed();
+        static_assert(known_seed.size != 0, "no perfect hash for the known field names");
+
+        constexpr std::array<std::int8_t, table_size>
+        make_slots()
+        {
+            std::array<std::int8_t, table_size> slots{};
+            for (auto &s : slots)
+                s = -1;
+            for (std::size_t i = 0; i < known_count; ++i)
+                slots[known_hash(known_names[i], known_seed)] = static_cast<std::int8_t>(i);
+            return slots;
+        }
+
+        // Table slot to index in known_names, or -1
+        inline constexpr auto known_slots = make_slots();
+
+        constexpr bool
+        equal_names(std::string_view a, std::string_view b)
+        {
+            if (a.size() != b.size())
+                return false;
+            for (std::size_t i = 0; i < a.size(); ++i)
+                if (lower(a[i]) != lower(b[i]))
+                    return false;
+            return true;
+        }
+
+        // Index in known_names, or -1
+        constexpr int
+        known_index(std::string_view name)
+        {
+            int const i = known_slots[known_hash(name, known_seed)];
+            return i >= 0 && equal_names(name, known_names[i]) ? i : -1;
+        }
+    }// namespace detail
+
+    // A handshake response in small-buffer storage.
+    //
+    // Names and values are copied into an inline byte array and indexed
+    // by a flat table of `MaxFields` entries kept in arrival order, so a
+    // typical reply allocates nothing. A reply that needs more bytes or
+    // more fields spills the rest to the heap rather than being refused;
+    // its size is bounded by the parser's header limit. The fields in
+    // detail::known_names are found through a perfect hash, any other by
+    // a scan of the entries. The body, which only a declined upgrade
+    // carries, is an ordinary string.
+    //
+    // Reads like Beast's response for what the client needs: version(),
+    // result_int(), reason(), operator[], iteration over fields with
+    // name_string() and value(), and body(). It can be logged with
+    // console::log and printed with operator<<.
+    template<std::size_t Bytes, std::size_t MaxFields>
+    class basic_compact_response
+    {
+        // Offsets below Bytes are in bytes_, the rest in spill_
+        struct entry
+        {
+            std::uint32_t name;
+            std::uint32_t name_size;
+            std::uint32_t value;
+            std::uint32_t value_size;
+        };
+
+    public:
+        static constexpr std::size_t byte_capacity = Bytes;
+        static constexpr std::size_t field_capacity = MaxFields;
+
+        class field_view
+        {
+        public:
+            std::string_view
+            name_string() const noexcept
+            {
+                return name_;
+            }
+
+            std::string_view
+            value() const noexcept
+            {
+                return value_;
+            }
+
+        private:
+            friend class basic_compact_response;
+
+            field_view(std::string_view name, std::string_view value) noexcept
+                : name_(name)
+                , value_(value)
+            {
+            }
+
+            std::string_view name_;
+            std::string_view value_;
+        };
+
+        class const_iterator
+        {
+        public:
+            field_view
+            operator*() const noexcept
+            {
+                return r_->view(i_);
+            }
+
+            const_iterator &
+            operator++() noexcept
+            {
+                ++i_;
+                return *this;
+            }
+
+            bool
+            operator==(const_iterator const &) const = default;
+
+        private:
+            friend class basic_compact_response;
+
+            const_iterator(basic_compact_response const *r, std::size_t i) noexcept
+                : r_(r)
+                , i_(i)
+            {
+            }
+
+            basic_compact_response const *r_;
+            std::size_t i_;
+        };
+
+        basic_compact_response() noexcept
+        {
+            known_.fill(0);
+        }
+
+        // Forget everything, keeping the storage
+        void
+        clear() noexcept
+        {
+            used_ = 0;
+            count_ = 0;
+            spill_.clear();
+            more_.clear();
+            known_.fill(0);
+            version_ = 11;
+            status_ = 0;
+            reason_ = {};
+            body_.clear();
+        }
+
+        // Copy a response read by Beast's parser or handshake, such as a
+        // websocket::response_type
+        template<class Response>
+        void
+        assign(Response const &res)
+        {
+            clear();
+            version(res.version());
+            result(res.result_int());
+            reason(res.reason());
+            for (auto const &f : res)
+                insert(f.name_string(), f.value());
+            body_ = res.body();
+        }
+
+        unsigned
+        version() const noexcept
+        {
+            return version_;
+        }
+
+        void
+        version(unsigned v) noexcept
+        {
+            version_ = v;
+        }
+
+        unsigned
+        result_int() const noexcept
+        {
+            return status_;
+        }
+
+        http::status
+        result() const noexcept
+        {
+            return http::int_to_status(status_);
+        }
+
+        void
+        result(unsigned status) noexcept
+        {
+            status_ = status;
+        }
+
+        std::string_view
+        reason() const noexcept
+        {
+            return slice(reason_.value, reason_.value_size);
+        }
+
+        void
+        reason(std::string_view s)
+        {
+            reason_.value = store(s);
+            reason_.value_size = static_cast<std::uint32_t>(s.size());
+        }
+
+        // Append a field, spilling to the heap once the inline storage
+        // is full
+        void
+        insert(std::string_view name, std::string_view value)
+        {
+            entry e;
+            e.name = store(name);
+            e.name_size = static_cast<std::uint32_t>(name.size());
+            e.value = store(value);
+            e.value_size = static_cast<std::uint32_t>(value.size());
+            if (count_ < MaxFields)
+                entries_[count_] = e;
+            else
+                more_.push_back(e);
+            int const k = detail::known_index(name);
+            if (k >= 0 && known_[k] == 0)
+                known_[k] = static_cast<std::uint32_t>(count_ + 1);
+            ++count_;
+        }
+
+        // The first value of a field; empty when absent, see has()
+        std::string_view
+        operator[](std::string_view name) const noexcept
+        {
+            auto const i = find_index(name);
+            return i < count_ ? value_at(i) : std::string_view{};
+        }
+
+        std::string_view
+        operator[](http::field f) const noexcept
+        {
+            return (*this)[http::to_string(f)];
+        }
+
+        bool
+        has(std::string_view name) const noexcept
+        {
+            return find_index(name) < count_;
+        }
+
+        bool
+        has(http::field f) const noexcept
+        {
+            return has(http::to_string(f));
+        }
+
+        std::string &
+        body() noexcept
+        {
+            return body_;
+        }
+
+        std::string const &
+        body() const noexcept
+        {
+            return body_;
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return count_;
+        }
+
+        // Bytes of names and values stored
+        std::size_t
+        bytes_used() const noexcept
+        {
+            return used_ + spill_.size();
+        }
+
+        // True when the inline storage was not enough
+        bool
+        spilled() const noexcept
+        {
+            return !spill_.empty() || !more_.empty();
+        }
+
+        const_iterator
+        begin() const noexcept
+        {
+            return {this, 0};
+        }
+
+        const_iterator
+        end() const noexcept
+        {
+            return {this, count_};
+        }
+
+    private:
+        std::size_t
+        find_index(std::string_view name) const noexcept
+        {
+            int const k = detail::known_index(name);
+            if (k >= 0)
+                return known_[k] ? known_[k] - 1u : count_;
+            for (std::size_t i = 0; i < count_; ++i)
+                if (detail::equal_names(name, slice(at(i).name, at(i).name_size)))
+                    return i;
+            return count_;
+        }
+
+        entry const &
+        at(std::size_t i) const noexcept
+        {
+            return i < MaxFields ? entries_[i] : more_[i - MaxFields];
+        }
+
+        // Copy `s` in and return its offset
+        std::uint32_t
+        store(std::string_view s)
+        {
+            if (s.size() <= Bytes - used_)
+            {
+                std::memcpy(bytes_.data() + used_, s.data(), s.size());
+                used_ += s.size();
+                return static_cast<std::uint32_t>(used_ - s.size());
+            }
+            auto const offset = static_cast<std::uint32_t>(Bytes + spill_.size());
+            spill_.append(s);
+            return offset;
+        }
+
+        std::string_view
+        slice(std::uint32_t offset, std::uint32_t n) const noexcept
+        {
+            if (offset < Bytes)
+                return {bytes_.data() + offset, n};
+            return {spill_.data() + (offset - Bytes), n};
+        }
+
+        std::string_view
+        value_at(std::size_t i) const noexcept
+        {
+            return slice(at(i).value, at(i).value_size);
+        }
+
+        field_view
+        view(std::size_t i) const noexcept
+        {
+            return {slice(at(i).name, at(i).name_size), value_at(i)};
+        }
+
+        std::array<char, Bytes> bytes_;
+        std::array<entry, MaxFields> entries_;
+        std::array<std::uint32_t, detail::known_count> known_;
+        entry reason_{};
+        std::size_t used_ = 0;
+        std::size_t count_ = 0;
+        std::string spill_;
+        std::vector<entry> more_;
+        unsigned version_ = 11;
+        unsigned status_ = 0;
+        std::string body_;
+    };
+
+    // Holds the replies of proxies and CDNs with a dozen or more fields
+    // without allocating; larger ones spill
+    using compact_response = basic_compact_response<2048, 32>;
+
+    // Same layout as Beast's operator<< for a response
+    template<std::size_t Bytes, std::size_t MaxFields>
+    std::ostream &
+    operator<<(std::ostream &os, basic_compact_response<Bytes, MaxFields> const &res)
+    {
+        os << "HTTP/" << res.version() / 10 << '.' << res.version() % 10 << ' '
+           << res.result_int() << ' ' << res.reason() << "\r\n";
+        for (auto const &f : res)
+            os << f.name_string() << ": " << f.value() << "\r\n";
+        return os << "\r\n"
+                  << res.body();
+    }
+
+}// namespace protocol
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef WEBSOCKET_HANDSHAKE_COMPRESSION_HPP
+#define WEBSOCKET_HANDSHAKE_COMPRESSION_HPP
+
+#include <boost/beast/core/string.hpp>
+#include <boost/beast/http/field.hpp>
+#include <boost/beast/http/rfc7230.hpp>
+#include <boost/beast/websocket/option.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <cstddef>
+#include <cstdio>
+#include <ostream>
+
+namespace compression {
+    namespace websocket = boost::beast::websocket;
+
+    // Knobs for permessage-deflate (RFC 7692).
+    //
+    // Window bits and memory level trade memory per connection for ratio:
+    // zlib needs roughly (1 << (window_bits + 2)) + (1 << (mem_level + 9))
+    // bytes for each deflate stream. Without context takeover that state is
+    // reset after every message, costing ratio on small similar messages.
+    struct options
+    {
+        bool enable = true;
+
+        // LZ77 window, 9..15. Applied to both directions.
+        int window_bits = 15;
+
+        // Deflate memory level, 1..9
+        int mem_level = 4;
+
+        // Deflate compression level, 0..9
+        int level = 6;
+
+        // Keep the sliding window between messages
+        bool context_takeover = true;
+
+        // Messages smaller than this are sent uncompressed. websocket::stream
+        // only honours it from Boost 1.81, see apply()
+        std::size_t threshold = 64;
+
+        // Compress with zlib state borrowed from a per-thread pool instead
+        // of state owned by each connection. Implies no context takeover.
+        bool pooled = false;
+
+        // Set by accepted() when the server agreed to the extension. Its
+        // messages may then arrive compressed even when `enable` is off
+        // because we cannot deflate with the window it asked for.
+        bool inflate = false;
+
+        // Set by accepted() when the server did not agree to
+        // server_no_context_takeover: its messages share one sliding
+        // window, so they must be inflated by one stream in order
+        bool peer_context_takeover = false;
+
+        // Approximate zlib memory of one deflate stream with these settings
+        std::size_t
+        deflate_memory() const
+        {
+            return (std::size_t{1} << (window_bits + 2)) + (std::size_t{1} << (mem_level + 9));
+        }
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, options const &o)
+    {
+        return os << "deflate=" << (o.enable ? "on" : "off")
+                  << " window_bits=" << o.window_bits
+                  << " mem_level=" << o.mem_level
+                  << " level=" << o.level
+                  << " context_takeover=" << (o.context_takeover && !o.pooled ? "yes" : "no")
+                  << " pooled=" << (o.pooled ? "yes" : "no")
+                  << " threshold=" << o.threshold;
+    }
+
+    namespace detail {
+        // Beast only grew a size threshold in Boost 1.81
+        template<class PMD>
+        constexpr bool has_threshold = requires(PMD &pmd) { pmd.msg_size_threshold = std::size_t{}; };
+
+        template<class PMD>
+        void
+        set_threshold(PMD &pmd, std::size_t threshold)
+        {
+            if constexpr (has_threshold<PMD>)
+                pmd.msg_size_threshold = threshold;
+        }
+    }// namespace detail
+
+    inline websocket::permessage_deflate
+    to_beast(options const &o)
+    {
+        websocket::permessage_deflate pmd;
+        pmd.client_enable = o.enable;
+        pmd.server_max_window_bits = o.window_bits;
+        pmd.client_max_window_bits = o.window_bits;
+        pmd.server_no_context_takeover = o.pooled || !o.context_takeover;
+        pmd.client_no_context_takeover = o.pooled || !o.context_takeover;
+        pmd.compLevel = o.level;
+        pmd.memLevel = o.mem_level;
+        detail::set_threshold(pmd, o.threshold);
+        return pmd;
+    }
+
+    // Offer permessage-deflate on a stream before its handshake. A Beast
+    // older than 1.81 has no size threshold and compresses every message;
+    // the first stream asked for one then says so on stderr.
+    template<class Stream>
+    void
+    apply(Stream &ws, options const &o)
+    {
+        if constexpr (!detail::has_threshold<websocket::permessage_deflate>)
+        {
+            if (o.enable && o.threshold > 0)
+            {
+                [[maybe_unused]] static bool const warned =
+                std::fputs("compression: this Beast has no message size threshold, "
+                           "websocket::stream compresses every message\n",
+                           stderr) >= 0;
+            }
+        }
+        ws.set_option(to_beast(o));
+    }
+
+    // True when the server accepted permessage-deflate. `res` is a
+    // websocket::response_type or protocol::compact_response.
+    template<class Response>
+    bool
+    negotiated(Response const &res)
+    {
+        boost::beast::string_view const extensions = res[boost::beast::http::field::sec_websocket_extensions];
+        return extensions.find("permessage-deflate") != boost::beast::string_view::npos;
+    }
+
+    // The settings to use after the handshake, given the server's
+    // Sec-WebSocket-Extensions. `inflate` is true when the extension was
+    // negotiated, so compressed messages must be accepted. `enable`, for
+    // our own messages, is false as well when the server asked for a
+    // window zlib cannot produce: the extension still holds, we just send
+    // uncompressed.
+    inline options
+    accepted(boost::beast::string_view extensions, options o)
+    {
+        namespace http = boost::beast::http;
+
+        bool const offered = o.enable;
+        bool found = false;
+        bool server_resets = false;
+        for (auto const &ext : http::ext_list{extensions})
+        {
+            if (!boost::beast::iequals(ext.first, "permessage-deflate"))
+                continue;
+            found = true;
+            for (auto const &param : ext.second)
+            {
+                if (boost::beast::iequals(param.first, "client_max_window_bits"))
+                {
+                    int bits = 0;
+                    for (char c : param.second)
+                        bits = c >= '0' && c <= '9' ? bits * 10 + (c - '0') : -1;
+                    if (bits < 9)
+                        o.enable = false;
+                    else if (bits < o.window_bits)
+                        o.window_bits = bits;
+                }
+                else if (boost::beast::iequals(param.first, "client_no_context_takeover"))
+                    o.context_takeover = false;
+                else if (boost::beast::iequals(param.first, "server_no_context_takeover"))
+                    server_resets = true;
+            }
+            break;
+        }
+        o.inflate = offered && found;
+        o.enable = o.enable && o.inflate;
+        o.peer_context_takeover = o.inflate && !server_resets;
+        return o;
+    }
+
+    inline options
+    accepted(websocket::response_type const &res, options const &o)
+    {
+        return accepted(res[boost::beast::http::field::sec_websocket_extensions], o);
+    }
+
+}// namespace compression
+
+#endif
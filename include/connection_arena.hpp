@@ -0,0 +1,218 @@
+#ifndef WEBSOCKET_HANDSHAKE_CONNECTION_ARENA_HPP
+#define WEBSOCKET_HANDSHAKE_CONNECTION_ARENA_HPP
+
+#include "handler_memory.hpp"
+
+#include <array>
+#include <cstddef>
+#include <memory_resource>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace memory {
+
+    struct arena_stats
+    {
+        std::size_t allocations = 0;
+        std::size_t bytes = 0;
+
+        // Blocks taken from the recycler once the inline buffer ran out
+        std::size_t upstream_blocks = 0;
+        std::size_t upstream_bytes = 0;
+
+        // Times release() handed everything back
+        std::size_t releases = 0;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, arena_stats const &s)
+    {
+        return os << "allocations=" << s.allocations
+                  << " bytes=" << s.bytes
+                  << " upstream_blocks=" << s.upstream_blocks
+                  << " upstream_bytes=" << s.upstream_bytes
+                  << " releases=" << s.releases;
+    }
+
+    // memory_resource over the calling thread's recycler
+    class recycler_resource final : public std::pmr::memory_resource
+    {
+    public:
+        static recycler_resource *
+        get() noexcept
+        {
+            static recycler_resource r;
+            return &r;
+        }
+
+    private:
+        void *
+        do_allocate(std::size_t n, std::size_t align) override
+        {
+            if (align > alignof(std::max_align_t))
+                return std::pmr::new_delete_resource()->allocate(n, align);
+            return recycler::local().allocate(n);
+        }
+
+        void
+        do_deallocate(void *p, std::size_t n, std::size_t align) override
+        {
+            if (align > alignof(std::max_align_t))
+                return std::pmr::new_delete_resource()->deallocate(p, n, align);
+            recycler::local().deallocate(p, n);
+        }
+
+        bool
+        do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+    // Monotonic memory for everything that lives exactly as long as one
+    // connection's handshake.
+    //
+    // Allocations are bumps in an inline buffer, then in blocks from the
+    // recycler; deallocation does nothing. release() returns it all at
+    // once after the upgrade, instead of each operation state, string and
+    // temporary being freed on its own. The arena must outlive everything
+    // allocated from it and belongs to one connection, so it is never used
+    // from two threads at a time.
+    //
+    //     memory::connection_arena arena;
+    //     co_await ws.async_handshake(res, host, path, arena.bind(net::use_awaitable));
+    //     arena.release();
+    class connection_arena
+    {
+    public:
+        static constexpr std::size_t inline_size = 4096;
+
+        using allocator_type = std::pmr::polymorphic_allocator<std::byte>;
+
+        connection_arena() = default;
+        connection_arena(connection_arena const &) = delete;
+        connection_arena &operator=(connection_arena const &) = delete;
+
+        std::pmr::memory_resource *
+        resource() noexcept
+        {
+            return &counter_;
+        }
+
+        allocator_type
+        get_allocator() noexcept
+        {
+            return allocator_type{&counter_};
+        }
+
+        // A completion token whose operation, and all the intermediate
+        // operations it is made of, allocate from the arena
+        template<class Token>
+        auto
+        bind(Token &&token) noexcept
+        {
+            return bind_allocator(get_allocator(), std::forward<Token>(token));
+        }
+
+        std::pmr::string
+        string(std::string_view s = {})
+        {
+            return std::pmr::string{s, get_allocator()};
+        }
+
+        // Free everything at once. Nothing allocated before may be used
+        // afterwards.
+        void
+        release() noexcept
+        {
+            monotonic_.release();
+            ++stats_.releases;
+        }
+
+        arena_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+    private:
+        // Counts what reaches the recycler
+        class upstream final : public std::pmr::memory_resource
+        {
+        public:
+            explicit upstream(arena_stats &stats)
+                : stats_(stats)
+            {
+            }
+
+        private:
+            void *
+            do_allocate(std::size_t n, std::size_t align) override
+            {
+                ++stats_.upstream_blocks;
+                stats_.upstream_bytes += n;
+                return recycler_resource::get()->allocate(n, align);
+            }
+
+            void
+            do_deallocate(void *p, std::size_t n, std::size_t align) override
+            {
+                recycler_resource::get()->deallocate(p, n, align);
+            }
+
+            bool
+            do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+            {
+                return this == &other;
+            }
+
+            arena_stats &stats_;
+        };
+
+        // Counts what the arena hands out
+        class counter final : public std::pmr::memory_resource
+        {
+        public:
+            counter(std::pmr::memory_resource &next, arena_stats &stats)
+                : next_(next)
+                , stats_(stats)
+            {
+            }
+
+        private:
+            void *
+            do_allocate(std::size_t n, std::size_t align) override
+            {
+                ++stats_.allocations;
+                stats_.bytes += n;
+                return next_.allocate(n, align);
+            }
+
+            void
+            do_deallocate(void *p, std::size_t n, std::size_t align) override
+            {
+                next_.deallocate(p, n, align);
+            }
+
+            bool
+            do_is_equal(std::pmr::memory_resource const &other) const noexcept override
+            {
+                return this == &other;
+            }
+
+            std::pmr::memory_resource &next_;
+            arena_stats &stats_;
+        };
+
+        arena_stats stats_;
+        alignas(std::max_align_t) std::array<std::byte, inline_size> inline_;
+        upstream upstream_{stats_};
+        std::pmr::monotonic_buffer_resource monotonic_{inline_.data(), inline_.size(), &upstream_};
+        counter counter_{monotonic_, stats_};
+    };
+
+}// namespace memory
+
+#endif
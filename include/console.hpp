@@ -0,0 +1,483 @@
+#ifndef WEBSOCKET_HANDSHAKE_CONSOLE_HPP
+#define WEBSOCKET_HANDSHAKE_CONSOLE_HPP
+
+#include "binlog.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace console {
+
+    struct log_stats
+    {
+        std::size_t lines = 0;
+        std::size_t bytes = 0;
+
+        // Lines lost because their thread's ring was full, or because a
+        // structured entry was too large for any ring
+        std::size_t dropped = 0;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, log_stats const &s)
+    {
+        return os << "lines=" << s.lines
+                  << " bytes=" << s.bytes
+                  << " dropped=" << s.dropped;
+    }
+
+    namespace detail {
+        // First byte of a ring record. Structured entries start with
+        // binlog::record::entry.
+        static constexpr char text_record = 'T';
+
+        // Put in place of the end of a text record too large for a ring
+        static constexpr std::string_view truncated = "...\n";
+
+        // A thread's formatting buffer is freed after a record larger than
+        // this, rather than kept at that size for the thread's lifetime
+        static constexpr std::size_t buffer_keep = 4 * 1024;
+
+        // Single-producer, single-consumer ring of length-prefixed records.
+        //
+        // The producer only writes head_ and the consumer only writes
+        // tail_, each on its own cache line, so neither side ever waits.
+        // Positions grow without bound and are reduced modulo the capacity
+        // when used.
+        class ring
+        {
+        public:
+            static constexpr std::size_t capacity = 64 * 1024;
+
+            // Largest record accepted, a quarter of the ring, so that one
+            // record cannot crowd out the lines queued behind it
+            static constexpr std::size_t max_record = capacity / 4;
+
+            // Copy one record, made of `record` followed by `tail`, in, or
+            // return false if it does not fit
+            bool
+            try_push(std::string_view record, std::string_view tail = {}) noexcept
+            {
+                std::uint32_t const n = static_cast<std::uint32_t>(record.size() + tail.size());
+                std::size_t const need = sizeof(n) + n;
+                std::size_t const head = head_.load(std::memory_order_relaxed);
+                if (need > capacity - (head - tail_.load(std::memory_order_acquire)))
+                {
+                    drop();
+                    return false;
+                }
+                copy_in(head, &n, sizeof(n));
+                copy_in(head + sizeof(n), record.data(), record.size());
+                copy_in(head + sizeof(n) + record.size(), tail.data(), tail.size());
+                head_.store(head + need, std::memory_order_release);
+                return true;
+            }
+
+            // Count a record that was not queued
+            void
+            drop() noexcept
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            // Hand every complete record to `f(std::string_view)`
+            template<class F>
+            std::size_t
+            drain(F &&f, std::string &scratch)
+            {
+                std::size_t tail = tail_.load(std::memory_order_relaxed);
+                std::size_t const head = head_.load(std::memory_order_acquire);
+                std::size_t count = 0;
+                while (tail != head)
+                {
+                    std::uint32_t n;
+                    copy_out(tail, &n, sizeof(n));
+                    scratch.resize(n);
+                    copy_out(tail + sizeof(n), scratch.data(), n);
+                    tail += sizeof(n) + n;
+                    f(std::string_view{scratch});
+                    ++count;
+                }
+                tail_.store(tail, std::memory_order_release);
+                return count;
+            }
+
+            std::size_t
+            dropped() const noexcept
+            {
+                return dropped_.load(std::memory_order_relaxed);
+            }
+
+            bool
+            empty() const noexcept
+            {
+                return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_relaxed);
+            }
+
+            // Set when the owning thread exits; the flusher then frees it
+            std::atomic<bool> retired{false};
+
+        private:
+            void
+            copy_in(std::size_t pos, void const *src, std::size_t n) noexcept
+            {
+                std::size_t const at = pos % capacity;
+                std::size_t const first = (std::min)(n, capacity - at);
+                std::memcpy(buf_.get() + at, src, first);
+                std::memcpy(buf_.get(), static_cast<char const *>(src) + first, n - first);
+            }
+
+            void
+            copy_out(std::size_t pos, void *dst, std::size_t n) const noexcept
+            {
+                std::size_t const at = pos % capacity;
+                std::size_t const first = (std::min)(n, capacity - at);
+                std::memcpy(dst, buf_.get() + at, first);
+                std::memcpy(static_cast<char *>(dst) + first, buf_.get(), n - first);
+            }
+
+            std::unique_ptr<char[]> buf_{new char[capacity]};
+            alignas(64) std::atomic<std::size_t> head_{0};
+            alignas(64) std::atomic<std::size_t> tail_{0};
+            std::atomic<std::size_t> dropped_{0};
+        };
+
+        // Owns the rings of all threads and the thread that empties them
+        class logger
+        {
+        public:
+            static logger &
+            get()
+            {
+                static logger l;
+                return l;
+            }
+
+            ~logger()
+            {
+                stop_.store(true, std::memory_order_relaxed);
+                wake();
+                flusher_.join();
+            }
+
+            // The calling thread's ring, registered on first use
+            ring &
+            local()
+            {
+                struct holder
+                {
+                    std::shared_ptr<ring> r = std::make_shared<ring>();
+                    holder()
+                    {
+                        logger::get().add(r);
+                    }
+                    ~holder()
+                    {
+                        r->retired.store(true, std::memory_order_release);
+                    }
+                };
+                thread_local holder h;
+                return *h.r;
+            }
+
+            void
+            wake() noexcept
+            {
+                pending_.store(true, std::memory_order_release);
+                pending_.notify_one();
+            }
+
+            // Called by a producer after a push. The flusher is only woken
+            // when it is about to sleep, so the common path is one fence and
+            // a read of a line that stays shared. The fences here and in
+            // run() ensure that either this sees sleeping_ or the flusher
+            // sees the new record.
+            void
+            notify() noexcept
+            {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (sleeping_.load(std::memory_order_relaxed))
+                    wake();
+            }
+
+            void
+            set_output(std::FILE *out)
+            {
+                std::lock_guard lock{mutex_};
+                out_ = out;
+            }
+
+            void
+            set_binary_output(std::FILE *out)
+            {
+                std::lock_guard lock{mutex_};
+                binary_out_ = out;
+                defined_.clear();
+                if (out)
+                {
+                    auto const header = binlog::file_header();
+                    std::fwrite(header.data(), 1, header.size(), out);
+                }
+            }
+
+            // Wait until everything logged so far has been written
+            void
+            flush()
+            {
+                std::size_t const target = flushes_.load(std::memory_order_acquire) + 2;
+                while (flushes_.load(std::memory_order_acquire) < target)
+                {
+                    wake();
+                    std::this_thread::yield();
+                }
+            }
+
+            log_stats
+            stats()
+            {
+                std::lock_guard lock{mutex_};
+                log_stats s = totals_;
+                for (auto const &r : rings_)
+                    s.dropped += r->dropped();
+                return s;
+            }
+
+        private:
+            logger()
+                : flusher_([this] { run(); })
+            {
+                // The flusher renders through the registry until it stops in
+                // ~logger, so the registry must be constructed first and so
+                // destroyed last
+                binlog::registry::get();
+            }
+
+            void
+            add(std::shared_ptr<ring> r)
+            {
+                std::lock_guard lock{mutex_};
+                rings_.push_back(std::move(r));
+            }
+
+            void
+            run()
+            {
+                std::string scratch;
+                std::string batch;
+                std::string binary;
+                auto const take = [&](std::string_view s) { consume(s, batch, binary); };
+                for (;;)
+                {
+                    // Clear the wakeup before reading stop_, so that one
+                    // sent with the stop request is not lost
+                    pending_.exchange(false, std::memory_order_acquire);
+                    bool const stopping = stop_.load(std::memory_order_relaxed);
+                    {
+                        std::lock_guard lock{mutex_};
+                        std::erase_if(rings_, [&](auto const &r) {
+                            // A ring seen retired has had its last push
+                            bool const retired = r->retired.load(std::memory_order_acquire);
+                            totals_.lines += r->drain(take, scratch);
+                            if (retired)
+                                totals_.dropped += r->dropped();
+                            return retired;
+                        });
+                        write(batch, out_);
+                        write(binary, binary_out_);
+                    }
+                    flushes_.fetch_add(1, std::memory_order_release);
+                    if (stopping)
+                        return;
+
+                    // Announce the nap, then look once more; see notify()
+                    sleeping_.store(true, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!any_pending())
+                        pending_.wait(false, std::memory_order_acquire);
+                    sleeping_.store(false, std::memory_order_relaxed);
+                }
+            }
+
+            // Add one record to the text or the binary output
+            void
+            consume(std::string_view s, std::string &batch, std::string &binary)
+            {
+                if (!s.empty() && s.front() == text_record)
+                    batch.append(s.substr(1));
+                else if (binary_out_)
+                    append_binary(s, binary);
+                else
+                    render(s, batch);
+            }
+
+            void
+            write(std::string &batch, std::FILE *out)
+            {
+                if (batch.empty())
+                    return;
+                totals_.bytes += batch.size();
+                std::fwrite(batch.data(), 1, batch.size(), out);
+                std::fflush(out);
+                batch.clear();
+            }
+
+            // Format a structured entry here, off the thread that logged it
+            static void
+            render(std::string_view s, std::string &out)
+            {
+                binlog::cursor c{s};
+                c.get<char>();
+                auto id = c.get<std::uint32_t>();
+                c.get<std::uint64_t>();
+                auto args = c.get_string();
+                if (!id || !args)
+                    return;
+                binlog::render(binlog::registry::get().format(*id), *args, out);
+                out += '\n';
+            }
+
+            // Copy an entry to the binary log, defining its format first if
+            // this file has not seen it yet
+            void
+            append_binary(std::string_view s, std::string &out)
+            {
+                std::uint32_t id;
+                std::memcpy(&id, s.data() + 1, sizeof(id));
+                if (id >= defined_.size())
+                    defined_.resize(id + 1);
+                if (!defined_[id])
+                {
+                    binlog::write_definition(out, id, binlog::registry::get().format(id));
+                    defined_[id] = true;
+                }
+                out.append(s);
+            }
+
+            bool
+            any_pending()
+            {
+                std::lock_guard lock{mutex_};
+                for (auto const &r : rings_)
+                    if (!r->empty())
+                        return true;
+                return false;
+            }
+
+            std::mutex mutex_;
+            std::vector<std::shared_ptr<ring>> rings_;
+            std::FILE *out_ = stdout;
+            std::FILE *binary_out_ = nullptr;
+            std::vector<bool> defined_;
+            log_stats totals_;
+            std::atomic<bool> pending_{false};
+            std::atomic<bool> sleeping_{false};
+            std::atomic<bool> stop_{false};
+            std::atomic<std::size_t> flushes_{0};
+            std::thread flusher_;
+        };
+
+        // Queue a record. One too large for any ring is cut short when it
+        // is text; a structured entry cannot be cut, so it is dropped and
+        // counted. Either way the caller never writes output itself.
+        inline void
+        push(std::string_view record)
+        {
+            auto &l = logger::get();
+            auto &r = l.local();
+            bool queued;
+            if (record.size() <= ring::max_record)
+                queued = r.try_push(record);
+            else if (record.front() == text_record)
+                queued = r.try_push(record.substr(0, ring::max_record - truncated.size()), truncated);
+            else
+            {
+                r.drop();
+                queued = false;
+            }
+            if (queued)
+                l.notify();
+        }
+    }// namespace detail
+
+    // Format the arguments into a line and queue it for the flusher.
+    //
+    // Nothing is shared between threads on this path: each thread formats
+    // into its own stream and copies the line into its own ring. When the
+    // ring is full the line is dropped and counted rather than blocking
+    // the caller, so memory stays bounded at one ring per thread. A line
+    // larger than ring::max_record is cut short.
+    template<class... Args>
+    void
+    println(Args const &...args)
+    {
+        thread_local std::ostringstream os;
+        os.str({});
+        os << detail::text_record;
+        (os << ... << args) << '\n';
+        detail::push(os.view());
+        if (os.view().size() > detail::buffer_keep)
+            os = std::ostringstream{};
+    }
+
+    // Record a structured entry. Only the format id, a timestamp and the
+    // raw argument bytes are captured here, see binlog.hpp; the text is
+    // produced by the flusher, or by binlog_decode when a binary output
+    // is set. An entry larger than ring::max_record is dropped and counted,
+    // so log sizes or bounded prefixes of large payloads.
+    //
+    //     console::log<"[async] read {} bytes: {}">(n, buffer.data());
+    template<binlog::fixed_string Format, class... Args>
+    void
+    log(Args const &...args)
+    {
+        thread_local std::string record;
+        record.clear();
+        binlog::write_entry<Format>(record, args...);
+        detail::push(record);
+        if (record.size() > detail::buffer_keep)
+            std::string{}.swap(record);
+    }
+
+    // Write structured entries to `out` in binary instead of rendering
+    // them. Null switches back to text.
+    inline void
+    set_binary_output(std::FILE *out)
+    {
+        detail::logger::get().set_binary_output(out);
+    }
+
+    // Send output to `out` instead of stdout
+    inline void
+    set_output(std::FILE *out)
+    {
+        detail::logger::get().set_output(out);
+    }
+
+    // Block until every line queued so far is written
+    inline void
+    flush()
+    {
+        detail::logger::get().flush();
+    }
+
+    inline log_stats
+    stats()
+    {
+        return detail::logger::get().stats();
+    }
+
+}// namespace console
+
+#endif
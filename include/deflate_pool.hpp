@@ -0,0 +1,363 @@
+#ifndef WEBSOCKET_HANDSHAKE_DEFLATE_POOL_HPP
+#define WEBSOCKET_HANDSHAKE_DEFLATE_POOL_HPP
+
+#include "compression.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/websocket/error.hpp>
+#include <boost/beast/zlib/deflate_stream.hpp>
+#include <boost/beast/zlib/error.hpp>
+#include <boost/beast/zlib/inflate_stream.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace compression {
+    namespace net = boost::asio;
+    namespace zlib = boost::beast::zlib;
+
+    struct pool_stats
+    {
+        std::size_t leases = 0;
+        std::size_t deflaters = 0;
+        std::size_t inflaters = 0;
+        std::size_t in_use = 0;
+        std::size_t peak_in_use = 0;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, pool_stats const &s)
+    {
+        return os << "leases=" << s.leases
+                  << " deflaters=" << s.deflaters
+                  << " inflaters=" << s.inflaters
+                  << " peak_in_use=" << s.peak_in_use;
+    }
+
+    // Per-thread pool of zlib streams for permessage-deflate without
+    // context takeover.
+    //
+    // A connection borrows a stream only for the duration of one message,
+    // so the number of live zlib states is bounded by the number of
+    // threads compressing at once instead of the number of connections.
+    class deflate_pool
+    {
+    public:
+        template<class Stream>
+        class lease
+        {
+        public:
+            lease(deflate_pool &p, std::unique_ptr<Stream> s)
+                : pool_(&p)
+                , s_(std::move(s))
+            {
+            }
+
+            lease(lease &&other) noexcept
+                : pool_(other.pool_)
+                , s_(std::move(other.s_))
+            {
+            }
+
+            lease(lease const &) = delete;
+            lease &operator=(lease const &) = delete;
+            lease &operator=(lease &&) = delete;
+
+            ~lease()
+            {
+                if (s_)
+                    pool_->give_back(std::move(s_));
+            }
+
+            Stream &
+            operator*() const noexcept
+            {
+                return *s_;
+            }
+
+            Stream *
+            operator->() const noexcept
+            {
+                return s_.get();
+            }
+
+        private:
+            deflate_pool *pool_;
+            std::unique_ptr<Stream> s_;
+        };
+
+        deflate_pool() = default;
+        deflate_pool(deflate_pool const &) = delete;
+        deflate_pool &operator=(deflate_pool const &) = delete;
+
+        // The pool belonging to the calling thread
+        static deflate_pool &
+        local()
+        {
+            thread_local deflate_pool p;
+            return p;
+        }
+
+        lease<zlib::deflate_stream>
+        deflater(options const &o)
+        {
+            std::unique_ptr<zlib::deflate_stream> s;
+            if (deflaters_.empty())
+            {
+                s = std::make_unique<zlib::deflate_stream>();
+                ++stats_.deflaters;
+            }
+            else
+            {
+                s = std::move(deflaters_.back());
+                deflaters_.pop_back();
+            }
+            s->reset(o.level, o.window_bits, o.mem_level, zlib::Strategy::normal);
+            on_lease();
+            return {*this, std::move(s)};
+        }
+
+        lease<zlib::inflate_stream>
+        inflater(int window_bits)
+        {
+            std::unique_ptr<zlib::inflate_stream> s;
+            if (inflaters_.empty())
+            {
+                s = std::make_unique<zlib::inflate_stream>();
+                ++stats_.inflaters;
+            }
+            else
+            {
+                s = std::move(inflaters_.back());
+                inflaters_.pop_back();
+            }
+            s->reset(window_bits);
+            on_lease();
+            return {*this, std::move(s)};
+        }
+
+        pool_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+    private:
+        void
+        on_lease()
+        {
+            ++stats_.leases;
+            ++stats_.in_use;
+            stats_.peak_in_use = (std::max)(stats_.peak_in_use, stats_.in_use);
+        }
+
+        void
+        give_back(std::unique_ptr<zlib::deflate_stream> s)
+        {
+            --stats_.in_use;
+            deflaters_.push_back(std::move(s));
+        }
+
+        void
+        give_back(std::unique_ptr<zlib::inflate_stream> s)
+        {
+            --stats_.in_use;
+            inflaters_.push_back(std::move(s));
+        }
+
+        std::vector<std::unique_ptr<zlib::deflate_stream>> deflaters_;
+        std::vector<std::unique_ptr<zlib::inflate_stream>> inflaters_;
+        pool_stats stats_;
+    };
+
+    // Compress one message payload as RFC 7692 describes: raw deflate,
+    // flushed, with the trailing 00 00 ff ff removed. The deflater is
+    // borrowed from the calling thread's pool and no state survives the
+    // call, which is what no_context_takeover requires. `out` must be a
+    // flat DynamicBuffer.
+    template<class DynamicBuffer>
+    void
+    deflate_message(net::const_buffer in, DynamicBuffer &out, options const &o)
+    {
+        auto zo = deflate_pool::local().deflater(o);
+        zlib::z_params zs;
+        zs.next_in = in.data();
+        zs.avail_in = in.size();
+
+        auto const bound = zo->upper_bound(in.size()) + 16;
+        auto mb = out.prepare(bound);
+        zs.next_out = mb.data();
+        zs.avail_out = mb.size();
+
+        boost::beast::error_code ec;
+        zo->write(zs, zlib::Flush::block, ec);
+        if (!ec || ec == zlib::error::need_buffers)
+            zo->write(zs, zlib::Flush::full, ec);
+        if (ec && ec != zlib::error::need_buffers)
+            throw boost::beast::system_error{ec};
+
+        // upper_bound guarantees the whole message fit
+        out.commit(zs.total_out - 4);
+    }
+
+    // Decompress one message payload produced by deflate_message or by any
+    // RFC 7692 peer. Fails with websocket::error::message_too_big when the
+    // result would exceed `limit`. A payload ending in a final block ends
+    // the stream there; the empty-block tail is then not fed.
+    //
+    // `zi` carries the window from earlier messages when the peer uses
+    // context takeover. A final block ends the peer's stream, and `zi` is
+    // then reset with `window_bits` for the next message.
+    template<class DynamicBuffer>
+    void
+    inflate_message(net::const_buffer in, DynamicBuffer &out, zlib::inflate_stream &zi,
+                    int window_bits, std::size_t limit, boost::beast::error_code &ec)
+    {
+        static unsigned char constexpr empty_block[4] = {0x00, 0x00, 0xff, 0xff};
+        zlib::z_params zs;
+        std::size_t produced = 0;
+        bool finished = false;
+        ec = {};
+
+        auto pump = [&](void const *data, std::size_t size) {
+            zs.next_in = data;
+            zs.avail_in = size;
+            for (;;)
+            {
+                auto mb = out.prepare((std::max<std::size_t>)(4096, size * 2));
+                zs.next_out = mb.data();
+                zs.avail_out = mb.size();
+                zs.total_out = 0;
+                std::size_t const avail_in = zs.avail_in;
+                zi.write(zs, zlib::Flush::sync, ec);
+                out.commit(zs.total_out);
+                produced += zs.total_out;
+                if (ec == zlib::error::end_of_stream)
+                {
+                    // The inflater is done and takes no more input
+                    ec = {};
+                    finished = true;
+                }
+                else if (ec == zlib::error::need_buffers)
+                    ec = {};
+                if (ec)
+                    return;
+                if (produced > limit)
+                {
+                    ec = websocket::error::message_too_big;
+                    return;
+                }
+                if (finished || (zs.avail_in == 0 && zs.avail_out > 0))
+                    return;
+                if (zs.total_out == 0 && zs.avail_in == avail_in)
+                {
+                    // Neither input taken nor output made
+                    ec = websocket::error::bad_frame_payload;
+                    return;
+                }
+            }
+        };
+
+        pump(in.data(), in.size());
+        if (!ec && !finished)
+            pump(empty_block, sizeof(empty_block));
+        if (finished)
+            zi.reset(window_bits);
+    }
+
+    // As above with a pooled inflater, for peers that agreed to
+    // server_no_context_takeover
+    template<class DynamicBuffer>
+    void
+    inflate_message(net::const_buffer in, DynamicBuffer &out, int window_bits,
+                    std::size_t limit, boost::beast::error_code &ec)
+    {
+        auto zi = deflate_pool::local().inflater(window_bits);
+        inflate_message(in, out, *zi, window_bits, limit, ec);
+    }
+
+    // Where inflate_some() is in a message
+    struct inflate_progress
+    {
+        // Bytes of the empty-block tail fed so far
+        std::size_t tail = 0;
+
+        // The peer's stream ended in a final block
+        bool finished = false;
+
+        // The output filled up, so the inflater may hold more
+        bool pending = false;
+
+        // Everything of the message has been produced
+        bool done = false;
+    };
+
+    // inflate_message for a message that arrives in pieces, with bounded
+    // output. Inflates `in` into `out` until either runs out and returns
+    // the input bytes taken; `produced` is set to the bytes written. Pass
+    // `last` while `in` holds the end of the message, and call again,
+    // with whatever input was not taken, until progress.done is set.
+    inline std::size_t
+    inflate_some(net::const_buffer in, bool last, net::mutable_buffer out, std::size_t &produced,
+                 zlib::inflate_stream &zi, inflate_progress &progress, boost::beast::error_code &ec)
+    {
+        static unsigned char constexpr empty_block[4] = {0x00, 0x00, 0xff, 0xff};
+        zlib::z_params zs;
+        zs.next_out = out.data();
+        zs.avail_out = out.size();
+        ec = {};
+
+        // Returns the bytes of `data` taken
+        auto pump = [&](void const *data, std::size_t size) -> std::size_t {
+            if (progress.finished)
+                return size;
+            zs.next_in = data;
+            zs.avail_in = size;
+            while (zs.avail_out > 0)
+            {
+                std::size_t const avail_in = zs.avail_in;
+                std::size_t const avail_out = zs.avail_out;
+                zi.write(zs, zlib::Flush::sync, ec);
+                if (ec == zlib::error::end_of_stream)
+                {
+                    // The inflater is done and takes no more input
+                    ec = {};
+                    progress.finished = true;
+                    return size;
+                }
+                if (ec == zlib::error::need_buffers)
+                    ec = {};
+                if (ec)
+                    return 0;
+                if (zs.avail_in == 0 && zs.avail_out > 0)
+                    break;
+                if (zs.avail_in == avail_in && zs.avail_out == avail_out)
+                {
+                    // Neither input taken nor output made
+                    ec = websocket::error::bad_frame_payload;
+                    return 0;
+                }
+            }
+            return size - zs.avail_in;
+        };
+
+        std::size_t const taken = pump(in.data(), in.size());
+        progress.pending = zs.avail_out == 0;
+        bool const drained = !ec && taken == in.size() && !progress.pending;
+        if (drained && last && progress.tail < sizeof(empty_block))
+        {
+            progress.tail += pump(empty_block + progress.tail, sizeof(empty_block) - progress.tail);
+            progress.pending = zs.avail_out == 0;
+        }
+        produced = out.size() - zs.avail_out;
+        progress.done = drained && last && !ec && !progress.pending &&
+                        (progress.finished || progress.tail == sizeof(empty_block));
+        return taken;
+    }
+
+}// namespace compression
+
+#endif
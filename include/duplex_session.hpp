@@ -0,0 +1,168 @@
+#ifndef WEBSOCKET_HANDSHAKE_DUPLEX_SESSION_HPP
+#define WEBSOCKET_HANDSHAKE_DUPLEX_SESSION_HPP
+
+#include "handler_memory.hpp"
+#include "send_queue.hpp"
+#include "spill_buffer.hpp"
+#include "work_stealing.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/websocket/error.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <utility>
+
+namespace duplex {
+    namespace net = boost::asio;
+    namespace beast = boost::beast;
+    namespace websocket = boost::beast::websocket;
+
+    struct session_options
+    {
+        outbound::queue_options send;
+        inbound::spill_options receive;
+
+        // When set, each message is handled on this pool, see run()
+        runtime::work_stealing_pool *workers = nullptr;
+    };
+
+    struct session_stats
+    {
+        std::size_t messages_in = 0;
+        std::uint64_t bytes_in = 0;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, session_stats const &s)
+    {
+        return os << "messages_in=" << s.messages_in
+                  << " bytes_in=" << s.bytes_in;
+    }
+
+    // A connection that reads and writes at the same time.
+    //
+    // run() is the read loop: it hands every incoming message to a
+    // callback until the peer closes. The write side is the send queue,
+    // which keeps one write in flight and starts the next from its
+    // completion, so outgoing messages never wait for a reply and incoming
+    // ones never wait for our writes to finish.
+    //
+    // Beast allows one read and one write to be pending at once, but their
+    // handlers must not run concurrently. The stream must therefore be
+    // constructed on a strand, and run() and every call into the session
+    // must happen on that strand, e.g. from coroutines spawned on
+    // ws.get_executor(). Queue completions are dispatched through the
+    // stream's executor and so land on the same strand.
+    template<class Stream>
+    class session
+    {
+    public:
+        explicit session(Stream &ws, session_options opts = {})
+            : ws_(ws)
+            , queue_(ws, opts.send)
+            , receive_(std::move(opts.receive))
+            , workers_(opts.workers)
+        {
+        }
+
+        session(session const &) = delete;
+        session &operator=(session const &) = delete;
+
+        auto
+        get_executor()
+        {
+            return ws_.get_executor();
+        }
+
+        outbound::send_queue<Stream> &
+        queue() noexcept
+        {
+            return queue_;
+        }
+
+        session_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+        // Queue a message without waiting
+        outbound::push_result
+        send(std::string payload, bool text = true)
+        {
+            return queue_.try_push(std::move(payload), text);
+        }
+
+        // Queue a message, waiting while the send queue is full
+        net::awaitable<outbound::push_result>
+        async_send(std::string payload, bool text = true)
+        {
+            return queue_.async_push(std::move(payload), text);
+        }
+
+        // Send a close frame once the control lane is free. run() returns
+        // when the peer answers it.
+        void
+        close(websocket::close_reason reason = websocket::close_code::normal)
+        {
+            closing_ = true;
+            queue_.close(std::move(reason));
+        }
+
+        // Read messages until the connection closes, calling
+        // `on_message(inbound::message)` for each one. Returns normally on
+        // a clean close and throws on any other error.
+        //
+        // With session_options::workers, on_message runs on that pool and
+        // may be stolen by any of its threads, so parsing a large message
+        // does not hold up the other connections on this core. The loop
+        // waits for it before reading on, so messages are still handled
+        // one at a time and in order. on_message must then reach the
+        // session by posting to get_executor().
+        template<class OnMessage>
+        net::awaitable<void>
+        run(OnMessage on_message)
+        {
+            for (;;)
+            {
+                inbound::message m;
+                try
+                {
+                    m = co_await inbound::async_read_message(ws_, receive_);
+                } catch (beast::system_error const &e)
+                {
+                    // When we start the close, Beast's close operation
+                    // reads the peer's reply and aborts our pending read
+                    if (e.code() == websocket::error::closed ||
+                        (closing_ && e.code() == net::error::operation_aborted))
+                        break;
+                    throw;
+                }
+                ++stats_.messages_in;
+                stats_.bytes_in += m.size();
+                if (workers_)
+                    co_await runtime::offload(
+                    *workers_, [&] { on_message(std::move(m)); }, memory::use_recycled_awaitable);
+                else
+                    on_message(std::move(m));
+            }
+            // Let the close frame and anything queued before it finish
+            co_await queue_.async_drain();
+        }
+
+    private:
+        Stream &ws_;
+        outbound::send_queue<Stream> queue_;
+        inbound::spill_options receive_;
+        runtime::work_stealing_pool *workers_;
+        session_stats stats_;
+        bool closing_ = false;
+    };
+
+}// namespace duplex
+
+#endif
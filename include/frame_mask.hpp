@@ -0,0 +1,195 @@
+#ifndef WEBSOCKET_HANDSHAKE_FRAME_MASK_HPP
+#define WEBSOCKET_HANDSHAKE_FRAME_MASK_HPP
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSOCKET_HANDSHAKE_X86 1
+#endif
+
+namespace frame {
+
+    using mask_key = std::array<unsigned char, 4>;
+
+    // XOR `n` bytes of `src` into `dst` with the masking key from RFC 6455
+    // section 5.3. `phase` is the offset of src[0] within the message, mod
+    // 4, so a payload can be masked in pieces. Returns the phase of the byte
+    // after the last one. `dst` may equal `src`.
+    using mask_fn = std::size_t (*)(unsigned char *dst, unsigned char const *src,
+                                    std::size_t n, mask_key const &key, std::size_t phase);
+
+    namespace detail {
+        inline std::size_t
+        mask_bytes(unsigned char *dst, unsigned char const *src,
+                   std::size_t n, mask_key const &key, std::size_t phase)
+        {
+            for (std::size_t i = 0; i < n; ++i)
+                dst[i] = src[i] ^ key[(phase + i) & 3];
+            return (phase + n) & 3;
+        }
+
+        // The key as a 32-bit word starting at `phase`
+        inline std::uint32_t
+        key_word(mask_key const &key, std::size_t phase)
+        {
+            unsigned char b[4] = {key[phase & 3], key[(phase + 1) & 3],
+                                  key[(phase + 2) & 3], key[(phase + 3) & 3]};
+            std::uint32_t w;
+            std::memcpy(&w, b, 4);
+            return w;
+        }
+
+        // Bytes needed to bring `p` to an `align` boundary
+        inline std::size_t
+        head_bytes(unsigned char const *p, std::size_t align, std::size_t n)
+        {
+            std::size_t const head = (align - (reinterpret_cast<std::uintptr_t>(p) & (align - 1))) & (align - 1);
+            return head < n ? head : n;
+        }
+
+        inline std::size_t
+        mask_scalar(unsigned char *dst, unsigned char const *src,
+                    std::size_t n, mask_key const &key, std::size_t phase)
+        {
+            std::size_t const head = head_bytes(dst, 8, n);
+            phase = mask_bytes(dst, src, head, key, phase);
+            dst += head;
+            src += head;
+            n -= head;
+
+            std::uint64_t const k32 = key_word(key, phase);
+            std::uint64_t const k = k32 | (k32 << 32);
+            for (; n >= 8; n -= 8, dst += 8, src += 8)
+            {
+                std::uint64_t v;
+                std::memcpy(&v, src, 8);
+                v ^= k;
+                std::memcpy(dst, &v, 8);
+            }
+            return mask_bytes(dst, src, n, key, phase);
+        }
+
+#if defined(WEBSOCKET_HANDSHAKE_X86)
+        __attribute__((target("sse2"))) inline std::size_t
+        mask_sse2(unsigned char *dst, unsigned char const *src,
+                  std::size_t n, mask_key const &key, std::size_t phase)
+        {
+            if (n < 32)
+                return mask_scalar(dst, src, n, key, phase);
+
+            // Unaligned head so the stores below are aligned
+            std::size_t const head = head_bytes(dst, 16, n);
+            phase = mask_bytes(dst, src, head, key, phase);
+            dst += head;
+            src += head;
+            n -= head;
+
+            __m128i const k = _mm_set1_epi32(static_cast<int>(key_word(key, phase)));
+            for (; n >= 64; n -= 64, dst += 64, src += 64)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
+                __m128i b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 16));
+                __m128i c = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 32));
+                __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + 48));
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst), _mm_xor_si128(a, k));
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst + 16), _mm_xor_si128(b, k));
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst + 32), _mm_xor_si128(c, k));
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst + 48), _mm_xor_si128(d, k));
+            }
+            for (; n >= 16; n -= 16, dst += 16, src += 16)
+            {
+                __m128i a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src));
+                _mm_store_si128(reinterpret_cast<__m128i *>(dst), _mm_xor_si128(a, k));
+            }
+            return mask_bytes(dst, src, n, key, phase);
+        }
+
+        __attribute__((target("avx2"))) inline std::size_t
+        mask_avx2(unsigned char *dst, unsigned char const *src,
+                  std::size_t n, mask_key const &key, std::size_t phase)
+        {
+            if (n < 64)
+                return mask_scalar(dst, src, n, key, phase);
+
+            std::size_t const head = head_bytes(dst, 32, n);
+            phase = mask_bytes(dst, src, head, key, phase);
+            dst += head;
+            src += head;
+            n -= head;
+
+            __m256i const k = _mm256_set1_epi32(static_cast<int>(key_word(key, phase)));
+            for (; n >= 128; n -= 128, dst += 128, src += 128)
+            {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src));
+                __m256i b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + 32));
+                __m256i c = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + 64));
+                __m256i d = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + 96));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst), _mm256_xor_si256(a, k));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + 32), _mm256_xor_si256(b, k));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + 64), _mm256_xor_si256(c, k));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst + 96), _mm256_xor_si256(d, k));
+            }
+            for (; n >= 32; n -= 32, dst += 32, src += 32)
+            {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src));
+                _mm256_store_si256(reinterpret_cast<__m256i *>(dst), _mm256_xor_si256(a, k));
+            }
+            return mask_sse2(dst, src, n, key, phase);
+        }
+#endif
+
+        inline mask_fn
+        select_kernel(char const *&name)
+        {
+#if defined(WEBSOCKET_HANDSHAKE_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                name = "avx2";
+                return &mask_avx2;
+            }
+            if (__builtin_cpu_supports("sse2"))
+            {
+                name = "sse2";
+                return &mask_sse2;
+            }
+#endif
+            name = "scalar";
+            return &mask_scalar;
+        }
+
+        struct kernel
+        {
+            char const *name = nullptr;
+            mask_fn fn = select_kernel(name);
+        };
+
+        inline kernel const &
+        active_kernel()
+        {
+            static kernel const k;
+            return k;
+        }
+    }// namespace detail
+
+    // Masks with the widest kernel the CPU supports, chosen on first use
+    inline std::size_t
+    mask(unsigned char *dst, unsigned char const *src, std::size_t n,
+         mask_key const &key, std::size_t phase = 0)
+    {
+        return detail::active_kernel().fn(dst, src, n, key, phase);
+    }
+
+    inline char const *
+    mask_kernel_name()
+    {
+        return detail::active_kernel().name;
+    }
+
+}// namespace frame
+
+#endif
@@ -0,0 +1,142 @@
+#ifndef WEBSOCKET_HANDSHAKE_FRAME_WRITER_HPP
+#define WEBSOCKET_HANDSHAKE_FRAME_WRITER_HPP
+
+#include "buffer_pool.hpp"
+#include "compression.hpp"
+#include "deflate_pool.hpp"
+#include "frame_mask.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+namespace frame {
+    namespace net = boost::asio;
+    namespace websocket = boost::beast::websocket;
+
+    enum class opcode : unsigned char
+    {
+        cont = 0x0,
+        text = 0x1,
+        binary = 0x2,
+        close = 0x8,
+        ping = 0x9,
+        pong = 0xa
+    };
+
+    // Largest client frame header: 2 + 8 byte length + 4 byte key
+    static constexpr std::size_t max_header_size = 14;
+
+    // Serialize a masked client frame header into `out`, returning its size
+    inline std::size_t
+    encode_header(unsigned char *out, opcode op, bool fin, bool rsv1,
+                  std::uint64_t len, mask_key const &key)
+    {
+        std::size_t n = 0;
+        out[n++] = static_cast<unsigned char>((fin ? 0x80 : 0) | (rsv1 ? 0x40 : 0) | static_cast<unsigned char>(op));
+        if (len < 126)
+            out[n++] = static_cast<unsigned char>(0x80 | len);
+        else if (len <= 0xffff)
+        {
+            out[n++] = 0x80 | 126;
+            out[n++] = static_cast<unsigned char>(len >> 8);
+            out[n++] = static_cast<unsigned char>(len);
+        }
+        else
+        {
+            out[n++] = 0x80 | 127;
+            for (int shift = 56; shift >= 0; shift -= 8)
+                out[n++] = static_cast<unsigned char>(len >> shift);
+        }
+        for (auto b : key)
+            out[n++] = b;
+        return n;
+    }
+
+    // A fresh masking key. RFC 6455 asks for keys the server cannot
+    // predict, so they come from OpenSSL's generator, drawn in batches.
+    inline mask_key
+    make_key()
+    {
+        thread_local unsigned char pool[256];
+        thread_local std::size_t used = sizeof(pool);
+        if (used == sizeof(pool))
+        {
+            if (RAND_bytes(pool, sizeof(pool)) != 1)
+                throw std::runtime_error("RAND_bytes failed");
+            used = 0;
+        }
+        mask_key key;
+        std::copy_n(pool + used, 4, key.begin());
+        used += 4;
+        return key;
+    }
+
+    struct message_options
+    {
+        bool text = true;
+
+        // Settings accepted by the server, see compression::accepted()
+        compression::options compression{.enable = false};
+    };
+
+    // Turns one message into wire bytes.
+    //
+    // The payload is compressed first when permessage-deflate was accepted
+    // and the message reaches the threshold. Masking happens while copying
+    // into the output, so the caller's payload is untouched.
+    class message_encoder
+    {
+    public:
+        message_encoder(net::const_buffer payload, message_options const &mo)
+            : body_(payload)
+            , key_(make_key())
+        {
+            bool rsv1 = false;
+            if (mo.compression.enable && payload.size() >= mo.compression.threshold)
+            {
+                compression::deflate_message(payload, deflated_, mo.compression);
+                body_ = deflated_.data();
+                rsv1 = true;
+            }
+            header_size_ = encode_header(header_, mo.text ? opcode::text : opcode::binary,
+                                         true, rsv1, body_.size(), key_);
+        }
+
+        // Bytes on the wire for this message
+        std::size_t
+        wire_size() const noexcept
+        {
+            return header_size_ + body_.size();
+        }
+
+        // Append the whole frame to a flat DynamicBuffer, masking straight
+        // into its storage
+        template<class DynamicBuffer>
+        void
+        encode(DynamicBuffer &out)
+        {
+            std::size_t const n = wire_size();
+            auto mb = out.prepare(n);
+            auto p = static_cast<unsigned char *>(mb.data());
+            std::memcpy(p, header_, header_size_);
+            mask(p + header_size_, static_cast<unsigned char const *>(body_.data()), body_.size(), key_);
+            out.commit(n);
+        }
+
+    private:
+        buffers::pooled_buffer deflated_;
+        net::const_buffer body_;
+        mask_key key_;
+        unsigned char header_[max_header_size];
+        std::size_t header_size_ = 0;
+    };
+
+}// namespace frame
+
+#endif
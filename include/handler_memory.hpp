@@ -0,0 +1,361 @@
+#ifndef WEBSOCKET_HANDSHAKE_HANDLER_MEMORY_HPP
+#define WEBSOCKET_HANDSHAKE_HANDLER_MEMORY_HPP
+
+// Older Asio uses std::exchange in awaitable.hpp without including it
+#include <utility>
+
+#include <boost/asio/associated_allocator.hpp>
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/version.hpp>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <type_traits>
+
+#if BOOST_ASIO_VERSION >= 101900
+#include <boost/asio/associated_cancellation_slot.hpp>
+#endif
+#if BOOST_ASIO_VERSION >= 102800
+#include <boost/asio/associated_immediate_executor.hpp>
+#endif
+
+namespace memory {
+    namespace net = boost::asio;
+
+    // Counters kept per thread. A hit is an allocation served from a free
+    // list instead of malloc.
+    struct recycler_stats
+    {
+        std::size_t allocations = 0;
+        std::size_t hits = 0;
+        std::size_t releases = 0;
+        std::size_t trimmed = 0;
+
+        // Requests above the largest class, passed straight to malloc
+        std::size_t oversized = 0;
+
+        double
+        hit_rate() const
+        {
+            return allocations ? double(hits) / double(allocations) : 0.0;
+        }
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, recycler_stats const &s)
+    {
+        return os << "allocations=" << s.allocations
+                  << " hits=" << s.hits
+                  << " hit_rate=" << s.hit_rate()
+                  << " releases=" << s.releases
+                  << " trimmed=" << s.trimmed
+                  << " oversized=" << s.oversized;
+    }
+
+    // Per-thread free lists for the short-lived blocks of asynchronous
+    // operations: handler-carrying ops, composed operation state and
+    // coroutine frames.
+    //
+    // Asio keeps one cached block per thread for all of these, which a
+    // connection with a read, a write, a timer and nested coroutines in
+    // flight overflows at once. Here every power-of-two class from 64
+    // bytes to 16 KiB keeps up to 64 blocks. A block freed on another
+    // thread joins that thread's lists, so nothing is shared or locked.
+    class recycler
+    {
+    public:
+        static constexpr int min_shift = 6;
+        static constexpr int max_shift = 14;
+        static constexpr int class_count = max_shift - min_shift + 1;
+        static constexpr std::size_t max_cached_per_class = 64;
+
+        recycler() = default;
+        recycler(recycler const &) = delete;
+        recycler &operator=(recycler const &) = delete;
+
+        ~recycler()
+        {
+            for (auto &list : free_)
+                while (list.head)
+                    std::free(std::exchange(list.head, list.head->next));
+        }
+
+        // The recycler belonging to the calling thread
+        static recycler &
+        local()
+        {
+            thread_local recycler r;
+            return r;
+        }
+
+        static int
+        class_for(std::size_t n) noexcept
+        {
+            if (n <= (std::size_t{1} << min_shift))
+                return 0;
+            int const cls = std::bit_width(n - 1) - min_shift;
+            return cls < class_count ? cls : -1;
+        }
+
+        static std::size_t
+        class_size(int cls) noexcept
+        {
+            return std::size_t{1} << (cls + min_shift);
+        }
+
+        void *
+        allocate(std::size_t n)
+        {
+            ++stats_.allocations;
+            int const cls = class_for(n);
+            if (cls < 0)
+            {
+                ++stats_.oversized;
+                return checked(std::malloc(n));
+            }
+            auto &list = free_[cls];
+            if (list.head)
+            {
+                ++stats_.hits;
+                --list.count;
+                return std::exchange(list.head, list.head->next);
+            }
+            return checked(std::malloc(class_size(cls)));
+        }
+
+        // `n` must be the size passed to allocate()
+        void
+        deallocate(void *p, std::size_t n) noexcept
+        {
+            if (!p)
+                return;
+            ++stats_.releases;
+            int const cls = class_for(n);
+            if (cls >= 0 && free_[cls].count < max_cached_per_class)
+            {
+                auto &list = free_[cls];
+                list.head = ::new (p) node{list.head};
+                ++list.count;
+                return;
+            }
+            ++stats_.trimmed;
+            std::free(p);
+        }
+
+        recycler_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+    private:
+        struct node
+        {
+            node *next;
+        };
+
+        struct free_list
+        {
+            node *head = nullptr;
+            std::size_t count = 0;
+        };
+
+        static void *
+        checked(void *p)
+        {
+            if (!p)
+                throw std::bad_alloc();
+            return p;
+        }
+
+        std::array<free_list, class_count> free_;
+        recycler_stats stats_;
+    };
+
+    // Standard allocator over the calling thread's recycler. Stateless, so
+    // all instances compare equal and memory may be freed on any thread.
+    template<class T>
+    class recycling_allocator
+    {
+    public:
+        using value_type = T;
+
+        recycling_allocator() noexcept = default;
+
+        template<class U>
+        recycling_allocator(recycling_allocator<U> const &) noexcept
+        {
+        }
+
+        T *
+        allocate(std::size_t n)
+        {
+            if (n > std::size_t(-1) / sizeof(T))
+                throw std::bad_array_new_length();
+            return static_cast<T *>(recycler::local().allocate(n * sizeof(T)));
+        }
+
+        void
+        deallocate(T *p, std::size_t n) noexcept
+        {
+            recycler::local().deallocate(p, n * sizeof(T));
+        }
+
+        template<class U>
+        friend bool
+        operator==(recycling_allocator const &, recycling_allocator<U> const &) noexcept
+        {
+            return true;
+        }
+    };
+
+    //------------------------------------------------------------------------------
+
+    // A completion handler with `Allocator` as its associated allocator.
+    // Everything else, the executor in particular, comes from the wrapped
+    // handler.
+    template<class Handler, class Allocator>
+    class allocator_handler
+    {
+    public:
+        using allocator_type = Allocator;
+
+        allocator_handler(Handler h, Allocator const &a)
+            : h_(std::move(h))
+            , a_(a)
+        {
+        }
+
+        allocator_type
+        get_allocator() const noexcept
+        {
+            return a_;
+        }
+
+        Handler &
+        inner() noexcept
+        {
+            return h_;
+        }
+
+        Handler const &
+        inner() const noexcept
+        {
+            return h_;
+        }
+
+        template<class... Args>
+        void
+        operator()(Args &&...args)
+        {
+            std::move(h_)(std::forward<Args>(args)...);
+        }
+
+    private:
+        Handler h_;
+        Allocator a_;
+    };
+
+    // Completion token adapter: the operation started with it, and every
+    // intermediate operation it is composed of, allocates with `allocator`
+    template<class Token, class Allocator>
+    struct allocator_token
+    {
+        Token token;
+        Allocator allocator;
+    };
+
+    template<class Allocator, class Token>
+    constexpr allocator_token<std::decay_t<Token>, Allocator>
+    bind_allocator(Allocator const &a, Token &&token)
+    {
+        return {std::forward<Token>(token), a};
+    }
+
+    // Allocate the operation from the calling thread's recycler
+    //
+    //     co_await resolver.async_resolve(host, port, memory::recycled(net::use_awaitable));
+    template<class Token>
+    constexpr auto
+    recycled(Token &&token)
+    {
+        return bind_allocator(recycling_allocator<void>{}, std::forward<Token>(token));
+    }
+
+    // use_awaitable, with the operation's memory from the recycler
+    inline constexpr allocator_token<net::use_awaitable_t<>, recycling_allocator<void>> use_recycled_awaitable{};
+
+}// namespace memory
+
+namespace boost::asio {
+    template<class Token, class Allocator, class Signature>
+    class async_result<memory::allocator_token<Token, Allocator>, Signature>
+    {
+    public:
+        using return_type = typename async_result<Token, Signature>::return_type;
+
+        template<class Initiation, class RawToken, class... Args>
+        static return_type
+        initiate(Initiation &&initiation, RawToken &&token, Args &&...args)
+        {
+            Token inner = token.token;
+            return async_initiate<Token, Signature>(
+            [initiation = std::forward<Initiation>(initiation), a = token.allocator](auto &&handler, auto &&...init_args) mutable {
+                using handler_type = std::decay_t<decltype(handler)>;
+                std::move(initiation)(memory::allocator_handler<handler_type, Allocator>{std::forward<decltype(handler)>(handler), a},
+                                      std::forward<decltype(init_args)>(init_args)...);
+            },
+            inner, std::forward<Args>(args)...);
+        }
+    };
+
+    template<class Handler, class Allocator, class Executor>
+    struct associated_executor<memory::allocator_handler<Handler, Allocator>, Executor>
+    {
+        using type = associated_executor_t<Handler, Executor>;
+
+        static type
+        get(memory::allocator_handler<Handler, Allocator> const &h, Executor const &ex = Executor()) noexcept
+        {
+            return get_associated_executor(h.inner(), ex);
+        }
+    };
+
+    // Cancellation (Asio 1.19, Boost 1.77) and immediate completion (Asio
+    // 1.28, Boost 1.82) reach the wrapped handler the same way, so that
+    // e.g. a cancelled coroutine still cancels the operation it awaits.
+#if BOOST_ASIO_VERSION >= 101900
+    template<class Handler, class Allocator, class CancellationSlot>
+    struct associated_cancellation_slot<memory::allocator_handler<Handler, Allocator>, CancellationSlot>
+    {
+        using type = associated_cancellation_slot_t<Handler, CancellationSlot>;
+
+        static type
+        get(memory::allocator_handler<Handler, Allocator> const &h, CancellationSlot const &s = CancellationSlot()) noexcept
+        {
+            return get_associated_cancellation_slot(h.inner(), s);
+        }
+    };
+#endif
+
+#if BOOST_ASIO_VERSION >= 102800
+    template<class Handler, class Allocator, class Executor>
+    struct associated_immediate_executor<memory::allocator_handler<Handler, Allocator>, Executor>
+    {
+        using type = associated_immediate_executor_t<Handler, Executor>;
+
+        static type
+        get(memory::allocator_handler<Handler, Allocator> const &h, Executor const &ex) noexcept
+        {
+            return get_associated_immediate_executor(h.inner(), ex);
+        }
+    };
+#endif
+}// namespace boost::asio
+
+#endif
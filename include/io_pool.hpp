@@ -0,0 +1,236 @@
+#ifndef WEBSOCKET_HANDSHAKE_IO_POOL_HPP
+#define WEBSOCKET_HANDSHAKE_IO_POOL_HPP
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace runtime {
+    namespace net = boost::asio;
+
+    // How connections are spread over the contexts
+    enum class assignment
+    {
+        round_robin,
+        // The context with the fewest open connection_guards
+        least_loaded
+    };
+
+    namespace detail {
+        // CPUs this process may run on, in order
+        inline std::vector<int>
+        allowed_cpus()
+        {
+            std::vector<int> cpus;
+#if defined(__linux__)
+            cpu_set_t set;
+            if (sched_getaffinity(0, sizeof(set), &set) == 0)
+                for (int i = 0; i < CPU_SETSIZE; ++i)
+                    if (CPU_ISSET(i, &set))
+                        cpus.push_back(i);
+#endif
+            return cpus;
+        }
+
+        // Best effort: an error leaves the thread unpinned
+        inline void
+        pin_current_thread(int cpu)
+        {
+#if defined(__linux__)
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+            (void) cpu;
+#endif
+        }
+    }// namespace detail
+
+    // One io_context per core, each run by a single thread pinned to it.
+    //
+    // A connection is placed on one context for its whole life, so its
+    // handlers never migrate between cores and need no strand. Contexts
+    // are created with a concurrency hint of 1, Asio's single-threaded
+    // mode. Connections on different contexts share nothing.
+    class io_context_pool
+    {
+    public:
+        // `size` contexts, by default one per CPU the process may use
+        explicit io_context_pool(std::size_t size = 0, bool pin = true)
+            : cpus_(detail::allowed_cpus())
+            , pin_(pin && !cpus_.empty())
+        {
+            if (size == 0)
+                size = cpus_.empty() ? (std::max)(1u, std::thread::hardware_concurrency()) : cpus_.size();
+            for (std::size_t i = 0; i < size; ++i)
+                slots_.push_back(std::make_unique<slot>());
+        }
+
+        io_context_pool(io_context_pool const &) = delete;
+        io_context_pool &operator=(io_context_pool const &) = delete;
+
+        ~io_context_pool()
+        {
+            stop();
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return slots_.size();
+        }
+
+        net::io_context &
+        get(std::size_t i) noexcept
+        {
+            return slots_[i]->ioc;
+        }
+
+        // Choose the context for a new connection
+        net::io_context &
+        pick(assignment how = assignment::round_robin) noexcept
+        {
+            return slots_[index(how)]->ioc;
+        }
+
+        // Counts a connection against its context for least_loaded
+        // placement while it is alive
+        class connection_guard
+        {
+        public:
+            connection_guard(connection_guard &&other) noexcept
+                : load_(std::exchange(other.load_, nullptr))
+                , ioc_(other.ioc_)
+            {
+            }
+
+            connection_guard &operator=(connection_guard &&) = delete;
+
+            ~connection_guard()
+            {
+                if (load_)
+                    load_->fetch_sub(1, std::memory_order_relaxed);
+            }
+
+            net::io_context &
+            context() const noexcept
+            {
+                return *ioc_;
+            }
+
+        private:
+            friend class io_context_pool;
+
+            connection_guard(std::atomic<std::size_t> &load, net::io_context &ioc)
+                : load_(&load)
+                , ioc_(&ioc)
+            {
+                load_->fetch_add(1, std::memory_order_relaxed);
+            }
+
+            std::atomic<std::size_t> *load_;
+            net::io_context *ioc_;
+        };
+
+        connection_guard
+        place(assignment how = assignment::least_loaded)
+        {
+            auto &s = *slots_[index(how)];
+            return {s.load, s.ioc};
+        }
+
+        // Run every context on its own thread until all run out of work
+        void
+        run()
+        {
+            launch();
+            join();
+        }
+
+        // Start the threads and keep them running, idle if need be, until
+        // stop() is called
+        void
+        start()
+        {
+            for (auto &s : slots_)
+                s->guard.emplace(s->ioc.get_executor());
+            launch();
+        }
+
+        void
+        stop()
+        {
+            for (auto &s : slots_)
+            {
+                s->guard.reset();
+                s->ioc.stop();
+            }
+            join();
+        }
+
+    private:
+        struct slot
+        {
+            net::io_context ioc{1};
+            std::optional<net::executor_work_guard<net::io_context::executor_type>> guard;
+            std::atomic<std::size_t> load{0};
+        };
+
+        std::size_t
+        index(assignment how) noexcept
+        {
+            if (how == assignment::round_robin)
+                return next_.fetch_add(1, std::memory_order_relaxed) % slots_.size();
+            std::size_t best = 0;
+            for (std::size_t i = 1; i < slots_.size(); ++i)
+                if (slots_[i]->load.load(std::memory_order_relaxed) <
+                    slots_[best]->load.load(std::memory_order_relaxed))
+                    best = i;
+            return best;
+        }
+
+        void
+        launch()
+        {
+            for (std::size_t i = 0; i < slots_.size(); ++i)
+            {
+                slots_[i]->ioc.restart();
+                threads_.emplace_back([this, i] {
+                    if (pin_)
+                        detail::pin_current_thread(cpus_[i % cpus_.size()]);
+                    slots_[i]->ioc.run();
+                });
+            }
+        }
+
+        void
+        join()
+        {
+            for (auto &t : threads_)
+                t.join();
+            threads_.clear();
+        }
+
+        std::vector<int> cpus_;
+        bool pin_;
+        std::vector<std::unique_ptr<slot>> slots_;
+        std::vector<std::thread> threads_;
+        std::atomic<std::size_t> next_{0};
+    };
+
+}// namespace runtime
+
+#endif
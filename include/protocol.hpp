@@ -0,0 +1,915 @@
+#ifndef WEBSOCKET_HANDSHAKE_PROTOCOL_HPP
+#define WEBSOCKET_HANDSHAKE_PROTOCOL_HPP
+
+#include "buffer_pool.hpp"
+#include "compact_response.hpp"
+#include "compression.hpp"
+#include "deflate_pool.hpp"
+#include "frame_mask.hpp"
+#include "frame_writer.hpp"
+#include "upgrade_parser.hpp"
+#include "utf8.hpp"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/parser.hpp>
+#include <boost/beast/http/rfc7230.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/version.hpp>
+#include <boost/beast/websocket/error.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+namespace protocol {
+    namespace net = boost::asio;
+    namespace beast = boost::beast;
+    namespace http = beast::http;
+    namespace websocket = beast::websocket;
+    using error_code = beast::error_code;
+
+    // The client's side of RFC 6455 as byte-in, byte-out state machines.
+    //
+    // Nothing here touches a socket. A driver writes output() to the
+    // transport and calls consume_output() with what was written, and reads
+    // from the transport into prepare() followed by commit(). The same core
+    // therefore runs over TLS, plain TCP, a test buffer or a batch of
+    // connections in one loop; see protocol_io.hpp for the Asio drivers.
+
+    namespace detail {
+        inline std::string
+        base64(unsigned char const *data, std::size_t n)
+        {
+            std::string out(4 * ((n + 2) / 3), '\0');
+            EVP_EncodeBlock(reinterpret_cast<unsigned char *>(out.data()), data, static_cast<int>(n));
+            return out;
+        }
+
+        // Whether a peer may send `code`, RFC 6455 section 7.4
+        inline bool
+        is_valid_close_code(std::uint16_t code)
+        {
+            if (code >= 1000 && code <= 1011)
+                return code != 1004 && code != 1005 && code != 1006;
+            return code >= 3000 && code <= 4999;
+        }
+    }// namespace detail
+
+    // A fresh Sec-WebSocket-Key
+    inline std::string
+    make_sec_key()
+    {
+        unsigned char raw[16];
+        if (RAND_bytes(raw, sizeof(raw)) != 1)
+            throw std::runtime_error("RAND_bytes failed");
+        return detail::base64(raw, sizeof(raw));
+    }
+
+    // The Sec-WebSocket-Accept a server must answer `key` with
+    inline std::string
+    sec_accept_for(std::string_view key)
+    {
+        static constexpr std::string_view guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+        char input[64];
+        std::size_t const n = (std::min)(key.size(), sizeof(input) - guid.size());
+        std::memcpy(input, key.data(), n);
+        std::memcpy(input + n, guid.data(), guid.size());
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digest_size = 0;
+        EVP_Digest(input, n + guid.size(), digest, &digest_size, EVP_sha1(), nullptr);
+        return detail::base64(digest, digest_size);
+    }
+
+    struct handshake_options
+    {
+        std::string user_agent = BOOST_BEAST_VERSION_STRING " websocket-client-coro";
+
+        // permessage-deflate settings to offer
+        compression::options deflate{.enable = false};
+
+        // Largest response header and body accepted
+        std::uint32_t header_limit = 8 * 1024;
+        std::uint64_t body_limit = 64 * 1024;
+    };
+
+    //------------------------------------------------------------------------------
+
+    // The HTTP/1.1 upgrade, RFC 6455 section 4.1.
+    //
+    // The request is ready as soon as the object exists. Response bytes
+    // are fed in until done(); error() then tells whether the server
+    // switched protocols with a valid Sec-WebSocket-Accept. Bytes that
+    // arrived after the response are the first frames and are handed to
+    // the connection through leftover().
+    //
+    // The usual 101 reply is read by parse_upgrade_response straight into
+    // a compact_response. Any other reply goes to Beast's parser and is
+    // copied into one, so response() looks the same either way.
+    //
+    // permessage-deflate is always offered with server_no_context_takeover
+    // so that each inbound message inflates on its own with a pooled
+    // inflater, see compression::inflate_message. A server that accepts
+    // without it is marked in accepted().peer_context_takeover, and the
+    // connection then keeps one inflater.
+    class handshake
+    {
+    public:
+        handshake(std::string_view host, std::string_view target,
+                  handshake_options const &opts = {})
+            : key_(make_sec_key())
+            , offer_(opts.deflate)
+            , header_limit_(opts.header_limit)
+        {
+            request_.reserve(256);
+            request_.append("GET ").append(target).append(" HTTP/1.1\r\n");
+            request_.append("Host: ").append(host).append("\r\n");
+            request_.append("Upgrade: websocket\r\n");
+            request_.append("Connection: Upgrade\r\n");
+            request_.append("Sec-WebSocket-Key: ").append(key_).append("\r\n");
+            request_.append("Sec-WebSocket-Version: 13\r\n");
+            if (offer_.enable)
+            {
+                request_.append("Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover");
+                if (offer_.pooled || !offer_.context_takeover)
+                    request_.append("; client_no_context_takeover");
+                if (offer_.window_bits < 15)
+                {
+                    auto const bits = std::to_string(offer_.window_bits);
+                    request_.append("; server_max_window_bits=").append(bits);
+                    request_.append("; client_max_window_bits=").append(bits);
+                }
+                else
+                    request_.append("; client_max_window_bits");
+                request_.append("\r\n");
+            }
+            if (!opts.user_agent.empty())
+                request_.append("User-Agent: ").append(opts.user_agent).append("\r\n");
+            request_.append("\r\n");
+
+            parser_.header_limit(opts.header_limit);
+            parser_.body_limit(opts.body_limit);
+            parser_.eager(true);
+        }
+
+        handshake(handshake const &) = delete;
+        handshake &operator=(handshake const &) = delete;
+
+        // Request bytes not yet written
+        net::const_buffer
+        output() const noexcept
+        {
+            return net::buffer(request_) + sent_;
+        }
+
+        void
+        consume_output(std::size_t n) noexcept
+        {
+            sent_ += n;
+        }
+
+        // Space for at least `n` response bytes
+        net::mutable_buffer
+        prepare(std::size_t n)
+        {
+            return in_.prepare(n);
+        }
+
+        // Parse `n` bytes written into prepare()
+        void
+        commit(std::size_t n)
+        {
+            in_.commit(n);
+            parse();
+        }
+
+        void
+        receive(net::const_buffer b)
+        {
+            net::buffer_copy(prepare(b.size()), b);
+            commit(b.size());
+        }
+
+        // The transport reached end of file. A response without a length
+        // ends here; anything else is a truncated response.
+        void
+        receive_eof()
+        {
+            if (done_)
+                return;
+            if (fast_)
+            {
+                fast_ = false;
+                parse();
+                if (done_)
+                    return;
+            }
+            error_code ec;
+            parser_.put_eof(ec);
+            finish(ec ? ec : check_parsed());
+        }
+
+        bool
+        done() const noexcept
+        {
+            return done_;
+        }
+
+        // Set once done(): empty when the connection was upgraded
+        error_code const &
+        error() const noexcept
+        {
+            return ec_;
+        }
+
+        // The whole response, once done()
+        compact_response const &
+        response() const noexcept
+        {
+            return response_;
+        }
+
+        // True when the response took the vectorized path
+        bool
+        parsed_fast() const noexcept
+        {
+            return done_ && fast_;
+        }
+
+        // Settings the connection must compress with, see
+        // compression::accepted()
+        compression::options const &
+        accepted() const noexcept
+        {
+            return accepted_;
+        }
+
+        // Bytes received after the end of the response
+        net::const_buffer
+        leftover() const noexcept
+        {
+            return in_.data();
+        }
+
+        std::string_view
+        key() const noexcept
+        {
+            return key_;
+        }
+
+    private:
+        void
+        parse()
+        {
+            if (done_)
+                return;
+            if (fast_)
+            {
+                auto const in = in_.data();
+                std::string_view const bytes{static_cast<char const *>(in.data()), in.size()};
+                upgrade_response r;
+                response_.clear();
+                auto const result = parse_upgrade_response(
+                bytes, r, detail::active_scanner(),
+                [this](std::string_view name, std::string_view value) {
+                    response_.insert(name, value);
+                    return true;
+                });
+                switch (result)
+                {
+                case parse_result::incomplete:
+                    if (bytes.size() <= header_limit_)
+                        return;
+                    break;
+
+                case parse_result::complete:
+                    response_.reason(r.reason);
+                    response_.result(101);
+                    in_.consume(r.size);
+                    return finish(check());
+
+                case parse_result::fallback:
+                    break;
+                }
+                fast_ = false;
+            }
+
+            while (!done_ && in_.size())
+            {
+                error_code ec;
+                auto const n = parser_.put(in_.data(), ec);
+                in_.consume(n);
+                if (ec == http::error::need_more)
+                    return;
+                if (ec)
+                    return finish(ec);
+                if (parser_.is_done())
+                    return finish(check_parsed());
+                if (n == 0)
+                    return;
+            }
+        }
+
+        error_code
+        check()
+        {
+            if (response_.version() != 11)
+                return websocket::error::bad_http_version;
+            if (response_.result_int() != 101)
+                return websocket::error::upgrade_declined;
+
+            if (!response_.has(http::field::connection))
+                return websocket::error::no_connection;
+            if (!http::token_list{response_[http::field::connection]}.exists("upgrade"))
+                return websocket::error::no_connection_upgrade;
+
+            if (!response_.has(http::field::upgrade))
+                return websocket::error::no_upgrade;
+            if (!http::token_list{response_[http::field::upgrade]}.exists("websocket"))
+                return websocket::error::no_upgrade_websocket;
+
+            if (!response_.has(http::field::sec_websocket_accept))
+                return websocket::error::no_sec_accept;
+            if (response_[http::field::sec_websocket_accept] != sec_accept_for(key_))
+                return websocket::error::bad_sec_accept;
+
+            accepted_ = compression::accepted(response_[http::field::sec_websocket_extensions], offer_);
+            return {};
+        }
+
+        // Copy a response read by Beast's parser, then check it
+        error_code
+        check_parsed()
+        {
+            response_.assign(parser_.get());
+            return check();
+        }
+
+        void
+        finish(error_code ec)
+        {
+            ec_ = ec;
+            done_ = true;
+        }
+
+        std::string key_;
+        std::string request_;
+        std::size_t sent_ = 0;
+        compression::options offer_;
+        compression::options accepted_{.enable = false};
+        http::response_parser<http::string_body> parser_;
+        buffers::pooled_buffer in_;
+        std::uint32_t header_limit_;
+        compact_response response_;
+        error_code ec_;
+        bool fast_ = true;
+        bool done_ = false;
+    };
+
+    //------------------------------------------------------------------------------
+
+    struct connection_options
+    {
+        // Settings accepted during the handshake, see handshake::accepted()
+        compression::options deflate{.enable = false};
+
+        // Largest inbound message, after inflation. Zero means no limit.
+        std::size_t message_limit = 16 * 1024 * 1024;
+
+        // Hand out data as it arrives instead of whole messages. Each
+        // message event then carries the next piece of the message and
+        // `last` marks its end, so memory stays bounded by what was read
+        // rather than by the message size.
+        bool partial_messages = false;
+
+        // With partial_messages, the most a compressed piece inflates to
+        std::size_t piece_size = 64 * 1024;
+    };
+
+    enum class event_kind
+    {
+        // Nothing complete yet: feed more input
+        need_more,
+        message,
+        ping,
+        pong,
+        close
+    };
+
+    // What next() found. `payload` stays valid until the next call to any
+    // member of the connection.
+    struct event
+    {
+        event_kind kind = event_kind::need_more;
+
+        // For a message: whether it was sent as text
+        bool text = false;
+
+        // Message data, already inflated, or the control frame payload
+        net::const_buffer payload;
+
+        // For a close: the peer's code and reason
+        websocket::close_reason reason;
+
+        // For a message: false while more of it follows, which happens
+        // only with connection_options::partial_messages
+        bool last = true;
+    };
+
+    // Framing after the upgrade, RFC 6455 section 5.
+    //
+    // Outgoing messages are masked, and compressed when permessage-deflate
+    // was accepted, straight into the output buffer. Incoming bytes are
+    // parsed into events one at a time. A message that arrived in a single
+    // uncompressed frame is returned in place without a copy; fragments
+    // are joined and compressed messages inflated first. Pings are answered
+    // and a peer's close is echoed by queuing output, which the driver
+    // writes like any other. With partial_messages nothing is joined or
+    // buffered: frames are handed out piece by piece as their bytes come
+    // in, and compressed ones inflated a bounded piece at a time.
+    //
+    // A protocol violation fails the connection: next() reports it and a
+    // close frame with the matching status is queued.
+    class connection
+    {
+    public:
+        explicit connection(connection_options const &opts = {})
+            : opts_(opts)
+        {
+            if (opts_.deflate.inflate && opts_.deflate.peer_context_takeover)
+            {
+                inflater_ = std::make_unique<compression::zlib::inflate_stream>();
+                inflater_->reset(15);
+            }
+        }
+
+        connection(connection const &) = delete;
+        connection &operator=(connection const &) = delete;
+
+        //--------------------------------------------------------------------------
+        // Output
+
+        // Queue a data message. Returns false once a close has been sent.
+        bool
+        send(net::const_buffer payload, bool text = true)
+        {
+            if (close_sent_)
+                return false;
+            frame::message_options mo;
+            mo.text = text;
+            mo.compression = opts_.deflate;
+            frame::message_encoder{payload, mo}.encode(out_);
+            return true;
+        }
+
+        bool
+        ping(net::const_buffer payload = {})
+        {
+            if (close_sent_)
+                return false;
+            control(frame::opcode::ping, payload);
+            return true;
+        }
+
+        // Start the closing handshake. closed() becomes true once the peer
+        // has answered. The reason is cut to what a control frame holds, at
+        // the last whole UTF-8 sequence; Beast's reason_string already
+        // stops at that size, but the copy below must not depend on it.
+        void
+        close(websocket::close_reason const &reason = websocket::close_code::normal)
+        {
+            if (close_sent_)
+                return;
+            unsigned char body[125];
+            std::size_t n = 0;
+            if (reason.code != websocket::close_code::none)
+            {
+                body[n++] = static_cast<unsigned char>(reason.code >> 8);
+                body[n++] = static_cast<unsigned char>(reason.code);
+                std::string_view text{reason.reason.data(), reason.reason.size()};
+                if (text.size() > sizeof(body) - n)
+                {
+                    std::size_t cut = sizeof(body) - n;
+                    while (cut > 0 && (static_cast<unsigned char>(text[cut]) & 0xc0) == 0x80)
+                        --cut;
+                    text = text.substr(0, cut);
+                }
+                std::memcpy(body + n, text.data(), text.size());
+                n += text.size();
+            }
+            control(frame::opcode::close, net::buffer(body, n));
+            close_sent_ = true;
+        }
+
+        // Bytes waiting to be written
+        net::const_buffer
+        output() const noexcept
+        {
+            return out_.data();
+        }
+
+        void
+        consume_output(std::size_t n) noexcept
+        {
+            out_.consume(n);
+        }
+
+        //--------------------------------------------------------------------------
+        // Input
+
+        // Space for at least `n` bytes read from the transport
+        net::mutable_buffer
+        prepare(std::size_t n)
+        {
+            settle();
+            return in_.prepare(n);
+        }
+
+        void
+        commit(std::size_t n) noexcept
+        {
+            in_.commit(n);
+        }
+
+        void
+        receive(net::const_buffer b)
+        {
+            net::buffer_copy(prepare(b.size()), b);
+            commit(b.size());
+        }
+
+        // Largest inbound message; zero means no limit
+        std::size_t
+        message_limit() const noexcept
+        {
+            return opts_.message_limit;
+        }
+
+        void
+        message_limit(std::size_t n) noexcept
+        {
+            opts_.message_limit = n;
+        }
+
+        // The next event in the input received so far
+        event
+        next(error_code &ec)
+        {
+            ec = {};
+            settle();
+            while (!failed_ && !close_received_)
+            {
+                if (in_frame_)
+                {
+                    auto e = next_piece(ec);
+                    if (ec || e.kind != event_kind::need_more)
+                        return e;
+                    if (in_frame_ && consumed_ == 0)
+                        break;
+                    settle();
+                    continue;
+                }
+
+                auto const in = in_.data();
+                auto const *p = static_cast<unsigned char const *>(in.data());
+                std::size_t const avail = in.size();
+                if (avail < 2)
+                    break;
+
+                bool const fin = p[0] & 0x80;
+                bool const rsv1 = p[0] & 0x40;
+                auto const op = static_cast<frame::opcode>(p[0] & 0x0f);
+                if (p[1] & 0x80)
+                    return fail(ec, websocket::error::bad_masked_frame);
+                if (p[0] & 0x30)
+                    return fail(ec, websocket::error::bad_reserved_bits);
+
+                std::size_t header = 2;
+                std::uint64_t len = p[1] & 0x7f;
+                if (len == 126)
+                {
+                    if (avail < 4)
+                        break;
+                    len = (std::uint64_t{p[2]} << 8) | p[3];
+                    if (len < 126)
+                        return fail(ec, websocket::error::bad_size);
+                    header = 4;
+                }
+                else if (len == 127)
+                {
+                    if (avail < 10)
+                        break;
+                    len = 0;
+                    for (int i = 2; i < 10; ++i)
+                        len = (len << 8) | p[i];
+                    if (len <= 0xffff || (len >> 63))
+                        return fail(ec, websocket::error::bad_size);
+                    header = 10;
+                }
+
+                bool const control_frame = static_cast<unsigned char>(op) & 0x08;
+                if (control_frame)
+                {
+                    if (!fin)
+                        return fail(ec, websocket::error::bad_control_fragment);
+                    if (len > 125)
+                        return fail(ec, websocket::error::bad_control_size);
+                    if (rsv1)
+                        return fail(ec, websocket::error::bad_reserved_bits);
+                }
+                else if (op == frame::opcode::cont)
+                {
+                    if (!in_message_)
+                        return fail(ec, websocket::error::bad_continuation);
+                    if (rsv1)
+                        return fail(ec, websocket::error::bad_reserved_bits);
+                }
+                else if (op == frame::opcode::text || op == frame::opcode::binary)
+                {
+                    if (in_message_)
+                        return fail(ec, websocket::error::bad_data_frame);
+                    if (rsv1 && !opts_.deflate.inflate)
+                        return fail(ec, websocket::error::bad_reserved_bits);
+                }
+                else
+                    return fail(ec, websocket::error::bad_opcode);
+
+                std::uint64_t const so_far = !in_message_            ? 0
+                                             : opts_.partial_messages ? received_
+                                                                      : message_.size();
+                if (!control_frame && opts_.message_limit && len > opts_.message_limit - so_far)
+                    return fail(ec, websocket::error::message_too_big);
+
+                // Data is handed out as it arrives, see next_piece()
+                if (!control_frame && opts_.partial_messages)
+                {
+                    if (!in_message_)
+                        start_partial(op == frame::opcode::text, rsv1);
+                    received_ += len;
+                    frame_left_ = len;
+                    frame_fin_ = fin;
+                    in_frame_ = true;
+                    in_.consume(header);
+                    continue;
+                }
+
+                // Wait for the whole frame
+                if (avail - header < len)
+                    break;
+                net::const_buffer const payload{p + header, static_cast<std::size_t>(len)};
+                consumed_ = header + len;
+
+                switch (op)
+                {
+                case frame::opcode::ping:
+                    if (!close_sent_)
+                        control(frame::opcode::pong, payload);
+                    return {event_kind::ping, false, payload, {}};
+
+                case frame::opcode::pong:
+                    return {event_kind::pong, false, payload, {}};
+
+                case frame::opcode::close:
+                    return on_close(ec, payload);
+
+                default:
+                    break;
+                }
+
+                if (!in_message_)
+                {
+                    text_ = op == frame::opcode::text;
+                    compressed_ = rsv1;
+                }
+
+                // A whole message in one frame needs no copy unless it
+                // has to be inflated
+                net::const_buffer body = payload;
+                if (!fin || in_message_)
+                {
+                    if (!in_message_)
+                        message_.clear();
+                    net::buffer_copy(message_.prepare(payload.size()), payload);
+                    message_.commit(payload.size());
+                    if (!fin)
+                    {
+                        in_message_ = true;
+                        settle();
+                        continue;
+                    }
+                    in_message_ = false;
+                    body = message_.data();
+                }
+
+                if (compressed_)
+                {
+                    inflated_.clear();
+                    std::size_t const limit = opts_.message_limit ? opts_.message_limit : std::size_t(-1);
+                    if (inflater_)
+                        compression::inflate_message(body, inflated_, *inflater_, 15, limit, ec);
+                    else
+                        compression::inflate_message(body, inflated_, 15, limit, ec);
+                    if (ec)
+                        return fail(ec, ec == websocket::error::message_too_big
+                                            ? ec
+                                            : error_code{websocket::error::bad_frame_payload});
+                    body = inflated_.data();
+                }
+                if (text_ && !utf8::validate(body.data(), body.size()))
+                    return fail(ec, websocket::error::bad_frame_payload);
+                return {event_kind::message, text_, body, {}};
+            }
+            return {};
+        }
+
+        event
+        next()
+        {
+            error_code ec;
+            auto e = next(ec);
+            if (ec)
+                throw beast::system_error{ec};
+            return e;
+        }
+
+        // A close frame has been queued
+        bool
+        close_sent() const noexcept
+        {
+            return close_sent_;
+        }
+
+        // Both sides have sent a close frame. The transport may be shut
+        // down once output() is empty.
+        bool
+        closed() const noexcept
+        {
+            return close_sent_ && close_received_;
+        }
+
+    private:
+        void
+        start_partial(bool text, bool compressed)
+        {
+            in_message_ = true;
+            text_ = text;
+            compressed_ = compressed;
+            received_ = 0;
+            delivered_ = 0;
+            if (compressed_)
+            {
+                if (!inflater_)
+                    lease_.emplace(compression::deflate_pool::local().inflater(15));
+                progress_ = {};
+            }
+        }
+
+        // The next piece of the data frame being read, or need_more when
+        // none is ready
+        event
+        next_piece(error_code &ec)
+        {
+            auto const in = in_.data();
+            auto const n = static_cast<std::size_t>((std::min<std::uint64_t>)(in.size(), frame_left_));
+            bool const end = frame_fin_ && n == frame_left_;
+            net::const_buffer body{in.data(), n};
+            bool last = end;
+            if (compressed_)
+            {
+                auto &zi = inflater_ ? *inflater_ : **lease_;
+                std::size_t produced = 0;
+                inflated_.clear();
+                consumed_ = compression::inflate_some(body, end, inflated_.prepare(opts_.piece_size), produced,
+                                                      zi, progress_, ec);
+                if (ec)
+                    return fail(ec, websocket::error::bad_frame_payload);
+                inflated_.commit(produced);
+                body = inflated_.data();
+                last = progress_.done;
+            }
+            else
+                consumed_ = n;
+            frame_left_ -= consumed_;
+            delivered_ += body.size();
+            if (opts_.message_limit && delivered_ > opts_.message_limit)
+                return fail(ec, websocket::error::message_too_big);
+            if (text_ && !validator_.write(body.data(), body.size()))
+                return fail(ec, websocket::error::bad_frame_payload);
+            if (frame_left_ == 0 && (!frame_fin_ || last))
+                in_frame_ = false;
+            if (!last)
+                return body.size() ? event{event_kind::message, text_, body, {}, false} : event{};
+
+            in_message_ = false;
+            if (text_ && !validator_.finish())
+                return fail(ec, websocket::error::bad_frame_payload);
+            if (compressed_)
+            {
+                if (inflater_ && progress_.finished)
+                    inflater_->reset(15);
+                lease_.reset();
+            }
+            return {event_kind::message, text_, body, {}, true};
+        }
+
+        // Write a masked control frame to the output
+        void
+        control(frame::opcode op, net::const_buffer payload)
+        {
+            auto const key = frame::make_key();
+            auto mb = out_.prepare(frame::max_header_size + payload.size());
+            auto *p = static_cast<unsigned char *>(mb.data());
+            std::size_t const n = frame::encode_header(p, op, true, false, payload.size(), key);
+            frame::mask(p + n, static_cast<unsigned char const *>(payload.data()), payload.size(), key);
+            out_.commit(n + payload.size());
+        }
+
+        event
+        on_close(error_code &ec, net::const_buffer payload)
+        {
+            auto const *p = static_cast<unsigned char const *>(payload.data());
+            websocket::close_reason reason;
+            if (payload.size() == 1)
+                return fail(ec, websocket::error::bad_close_size);
+            if (payload.size() >= 2)
+            {
+                auto const code = static_cast<std::uint16_t>((p[0] << 8) | p[1]);
+                if (!detail::is_valid_close_code(code))
+                    return fail(ec, websocket::error::bad_close_code);
+                if (!utf8::validate(p + 2, payload.size() - 2))
+                    return fail(ec, websocket::error::bad_close_payload);
+                reason.code = code;
+                reason.reason.assign(reinterpret_cast<char const *>(p + 2), payload.size() - 2);
+            }
+            close_received_ = true;
+
+            // Echo the status, RFC 6455 section 5.5.1
+            if (!close_sent_)
+                close(websocket::close_reason{reason.code});
+            return {event_kind::close, false, payload, reason};
+        }
+
+        event
+        fail(error_code &ec, error_code e)
+        {
+            ec = e;
+            failed_ = true;
+            if (e == websocket::error::message_too_big)
+                close(websocket::close_code::too_big);
+            else if (e == websocket::error::bad_frame_payload)
+                close(websocket::close_code::bad_payload);
+            else
+                close(websocket::close_code::protocol_error);
+            return {};
+        }
+
+        // Drop the frame the previous event pointed into
+        void
+        settle() noexcept
+        {
+            in_.consume(consumed_);
+            consumed_ = 0;
+        }
+
+        connection_options opts_;
+        buffers::pooled_buffer in_;
+        buffers::pooled_buffer out_;
+        buffers::pooled_buffer message_;
+        buffers::pooled_buffer inflated_;
+
+        // Only when the peer keeps its window between messages
+        std::unique_ptr<compression::zlib::inflate_stream> inflater_;
+
+        // With partial_messages: the pooled inflater held for one message,
+        // the frame being handed out, and the message so far
+        std::optional<compression::deflate_pool::lease<compression::zlib::inflate_stream>> lease_;
+        compression::inflate_progress progress_;
+        utf8::validator validator_;
+        std::uint64_t frame_left_ = 0;
+        std::uint64_t received_ = 0;
+        std::uint64_t delivered_ = 0;
+        bool in_frame_ = false;
+        bool frame_fin_ = false;
+
+        std::size_t consumed_ = 0;
+        bool in_message_ = false;
+        bool text_ = false;
+        bool compressed_ = false;
+        bool close_sent_ = false;
+        bool close_received_ = false;
+        bool failed_ = false;
+    };
+
+}// namespace protocol
+
+#endif
@@ -0,0 +1,280 @@
+#ifndef WEBSOCKET_HANDSHAKE_PROTOCOL_IO_HPP
+#define WEBSOCKET_HANDSHAKE_PROTOCOL_IO_HPP
+
+#include "protocol.hpp"
+#include "task.hpp"
+#include "write_coalescer.hpp"
+
+#include <boost/asio/error.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/ssl/error.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/beast/websocket/error.hpp>
+#include <cstddef>
+
+namespace protocol {
+
+    // Drivers running the core over an Asio stream, blocking or as
+    // coroutines. Each only moves bytes: write whatever the core has to
+    // send, read when it needs more. The stream is anything with
+    // read_some/write_some, e.g. beast::ssl_stream<tcp::socket>.
+
+    // Bytes asked for on each read
+    static constexpr std::size_t read_size = 16 * 1024;
+
+    namespace detail {
+        // The peer closed the transport, with or without a TLS close_notify
+        inline bool
+        is_eof(error_code const &ec)
+        {
+            return ec == net::error::eof || ec == net::ssl::error::stream_truncated;
+        }
+    }// namespace detail
+
+    template<class SyncWriteStream, class Core>
+    void
+    write_output(SyncWriteStream &s, Core &core)
+    {
+        while (core.output().size())
+            core.consume_output(net::write(s, core.output()));
+    }
+
+    // Move whatever the core has queued behind the messages pushed to `w`
+    // and send them all in one write
+    template<class SyncWriteStream, class Core>
+    void
+    flush_output(frame::coalescing_writer<SyncWriteStream> &w, Core &core)
+    {
+        w.append(core.output());
+        core.consume_output(core.output().size());
+        w.flush();
+    }
+
+    // Send the upgrade request and read the response. Handshake failures
+    // are left in hs.error(); transport errors throw.
+    template<class SyncStream>
+    void
+    upgrade(SyncStream &s, handshake &hs)
+    {
+        write_output(s, hs);
+        while (!hs.done())
+        {
+            error_code ec;
+            hs.commit(s.read_some(hs.prepare(read_size), ec));
+            if (detail::is_eof(ec))
+                hs.receive_eof();
+            else if (ec)
+                throw beast::system_error{ec};
+        }
+    }
+
+    // Read until the connection has an event, writing any replies it
+    // queued on the way. Throws on protocol and transport errors.
+    template<class SyncStream>
+    event
+    read_event(SyncStream &s, connection &c)
+    {
+        for (;;)
+        {
+            error_code ec;
+            auto e = c.next(ec);
+            write_output(s, c);
+            if (ec)
+                throw beast::system_error{ec};
+            if (e.kind != event_kind::need_more)
+                return e;
+            c.commit(s.read_some(c.prepare(read_size)));
+        }
+    }
+
+    // Read until the next message, answering pings. A close from the peer
+    // throws websocket::error::closed.
+    template<class SyncStream>
+    event
+    read_message(SyncStream &s, connection &c)
+    {
+        for (;;)
+        {
+            auto e = read_event(s, c);
+            if (e.kind == event_kind::message)
+                return e;
+            if (e.kind == event_kind::close)
+                throw beast::system_error{websocket::error::closed};
+        }
+    }
+
+    // Send a close and read until the peer answers it
+    template<class SyncStream>
+    void
+    close(SyncStream &s, connection &c,
+          websocket::close_reason const &reason = websocket::close_code::normal)
+    {
+        c.close(reason);
+        write_output(s, c);
+        while (!c.closed())
+            read_event(s, c);
+    }
+
+    //------------------------------------------------------------------------------
+
+    // Coroutine drivers on coro::task. Operations resume the task on the
+    // stream's executor.
+    namespace tasks {
+        template<class AsyncWriteStream, class Core>
+        coro::task<void>
+        async_write_output(AsyncWriteStream &s, Core &core)
+        {
+            while (core.output().size())
+                core.consume_output(co_await net::async_write(s, core.output(), coro::use_task));
+        }
+
+        template<class AsyncStream>
+        coro::task<void>
+        async_upgrade(AsyncStream &s, handshake &hs)
+        {
+            co_await async_write_output(s, hs);
+            while (!hs.done())
+            {
+                error_code ec;
+                hs.commit(co_await s.async_read_some(hs.prepare(read_size), net::redirect_error(coro::use_task, ec)));
+                if (detail::is_eof(ec))
+                    hs.receive_eof();
+                else if (ec)
+                    throw beast::system_error{ec};
+            }
+        }
+
+        template<class AsyncStream>
+        coro::task<event>
+        async_read_event(AsyncStream &s, connection &c)
+        {
+            for (;;)
+            {
+                error_code ec;
+                auto e = c.next(ec);
+                co_await async_write_output(s, c);
+                if (ec)
+                    throw beast::system_error{ec};
+                if (e.kind != event_kind::need_more)
+                    co_return e;
+                c.commit(co_await s.async_read_some(c.prepare(read_size), coro::use_task));
+            }
+        }
+
+        template<class AsyncStream>
+        coro::task<event>
+        async_read_message(AsyncStream &s, connection &c)
+        {
+            for (;;)
+            {
+                auto e = co_await async_read_event(s, c);
+                if (e.kind == event_kind::message)
+                    co_return e;
+                if (e.kind == event_kind::close)
+                    throw beast::system_error{websocket::error::closed};
+            }
+        }
+
+        // Send a normal close and read until the peer answers it. Not a
+        // default argument, see inbound::async_read_message.
+        template<class AsyncStream>
+        coro::task<void>
+        async_close(AsyncStream &s, connection &c)
+        {
+            c.close(websocket::close_code::normal);
+            co_await async_write_output(s, c);
+            while (!c.closed())
+                co_await async_read_event(s, c);
+        }
+    }// namespace tasks
+
+    //------------------------------------------------------------------------------
+
+    // A transport and its connection read like a Beast websocket stream,
+    // so that inbound::read_chunks and inbound::read_message run on the
+    // core. The connection must have partial_messages set: each
+    // read_some() then copies out message data as it arrives, and a
+    // message of any size is received in bounded memory.
+    //
+    // Pings are answered on the way, and a close from the peer throws
+    // websocket::error::closed. Between reads the connection may send,
+    // but nothing else may read from it.
+    template<class Stream>
+    class message_stream
+    {
+    public:
+        message_stream(Stream &s, connection &c) noexcept
+            : s_(s)
+            , c_(c)
+        {
+        }
+
+        bool
+        got_text() const noexcept
+        {
+            return text_;
+        }
+
+        // True once read_some() has returned the end of a message
+        bool
+        is_message_done() const noexcept
+        {
+            return done_;
+        }
+
+        std::size_t
+        read_message_max() const noexcept
+        {
+            return c_.message_limit();
+        }
+
+        void
+        read_message_max(std::size_t n) noexcept
+        {
+            c_.message_limit(n);
+        }
+
+        std::size_t
+        read_some(net::mutable_buffer b)
+        {
+            if (!held_)
+                hold(read_message(s_, c_));
+            return take(b);
+        }
+
+    private:
+        void
+        hold(event const &e) noexcept
+        {
+            piece_ = e.payload;
+            last_ = e.last;
+            text_ = e.text;
+            held_ = true;
+            done_ = false;
+        }
+
+        std::size_t
+        take(net::mutable_buffer b) noexcept
+        {
+            std::size_t const n = net::buffer_copy(b, piece_);
+            piece_ += n;
+            if (piece_.size() == 0)
+            {
+                held_ = false;
+                done_ = last_;
+            }
+            return n;
+        }
+
+        Stream &s_;
+        connection &c_;
+        net::const_buffer piece_;
+        bool held_ = false;
+        bool last_ = false;
+        bool text_ = false;
+        bool done_ = false;
+    };
+
+}// namespace protocol
+
+#endif
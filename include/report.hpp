@@ -0,0 +1,498 @@
+#ifndef WEBSOCKET_HANDSHAKE_REPORT_HPP
+#define WEBSOCKET_HANDSHAKE_REPORT_HPP
+
+#include "compression.hpp"
+#include "console.hpp"
+#include "protocol.hpp"
+
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/http/field.hpp>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+
+namespace report {
+    namespace http = boost::beast::http;
+    using error_code = boost::beast::error_code;
+    using clock_type = std::chrono::steady_clock;
+
+    // Time spent in each step of setting up a connection
+    struct timings
+    {
+        std::chrono::nanoseconds resolve{};
+        std::chrono::nanoseconds connect{};
+        std::chrono::nanoseconds tls{};
+        std::chrono::nanoseconds upgrade{};
+    };
+
+    // Time since construction or the previous lap()
+    class stopwatch
+    {
+    public:
+        std::chrono::nanoseconds
+        lap() noexcept
+        {
+            auto const now = clock_type::now();
+            auto const d = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_);
+            last_ = now;
+            return d;
+        }
+
+    private:
+        clock_type::time_point last_ = clock_type::now();
+    };
+
+    // A string cut to at most N bytes, stored inline
+    template<std::size_t N>
+    struct inline_string
+    {
+        static_assert(N <= 0xffff);
+
+        char data[N];
+        std::uint16_t size = 0;
+        bool truncated = false;
+
+        void
+        assign(std::string_view s) noexcept
+        {
+            size = static_cast<std::uint16_t>((std::min)(s.size(), N));
+            truncated = s.size() > N;
+            std::memcpy(data, s.data(), size);
+        }
+
+        std::string_view
+        view() const noexcept
+        {
+            return {data, size};
+        }
+    };
+
+    // The outcome of one upgrade, as a plain value that can be copied
+    // between threads: the status, the fields worth keeping and the
+    // timings. Strings are cut to fit.
+    struct handshake_record
+    {
+        // A string literal such as "[async]"
+        char const *label = "";
+
+        std::uint16_t status = 0;
+        std::uint16_t fields = 0;
+        int error_value = 0;
+        boost::system::error_category const *error_category = nullptr;
+        bool negotiated = false;
+
+        // The response took the vectorized parser, see
+        // protocol::handshake::parsed_fast()
+        bool fast = false;
+
+        inline_string<32> reason;
+        inline_string<64> server;
+        inline_string<128> extensions;
+        inline_string<64> subprotocol;
+
+        // The start of the body of a declined upgrade
+        inline_string<64> body;
+
+        timings times;
+
+        error_code
+        error() const
+        {
+            return error_category ? error_code{error_value, *error_category} : error_code{};
+        }
+    };
+
+    static_assert(std::is_trivially_copyable_v<handshake_record>);
+
+    // Record the response to an upgrade. `res` is a
+    // websocket::response_type or protocol::compact_response.
+    template<class Response>
+    handshake_record
+    make_record(char const *label, Response const &res, error_code const &ec, timings const &t)
+    {
+        handshake_record r;
+        r.label = label;
+        r.status = static_cast<std::uint16_t>(res.result_int());
+        for (auto it = res.begin(); it != res.end(); ++it)
+            ++r.fields;
+        if (ec)
+        {
+            r.error_value = ec.value();
+            r.error_category = &ec.category();
+        }
+        r.negotiated = compression::negotiated(res);
+        r.reason.assign(res.reason());
+        r.server.assign(res[http::field::server]);
+        r.extensions.assign(res[http::field::sec_websocket_extensions]);
+        r.subprotocol.assign(res[http::field::sec_websocket_protocol]);
+        r.body.assign(res.body());
+        r.times = t;
+        return r;
+    }
+
+    // Record a connection that failed before its upgrade was read
+    inline handshake_record
+    make_record(char const *label, error_code const &ec, timings const &t)
+    {
+        handshake_record r;
+        r.label = label;
+        r.error_value = ec.value();
+        r.error_category = &ec.category();
+        r.times = t;
+        return r;
+    }
+
+    inline handshake_record
+    make_record(char const *label, protocol::handshake const &hs, timings const &t)
+    {
+        auto r = make_record(label, hs.response(), hs.error(), t);
+        r.fast = hs.parsed_fast();
+        return r;
+    }
+
+    inline double
+    to_us(std::chrono::nanoseconds d)
+    {
+        return std::chrono::duration<double, std::micro>(d).count();
+    }
+
+    inline std::ostream &
+    operator<<(std::ostream &os, handshake_record const &r)
+    {
+        os << r.label << " status=" << r.status
+           << " reason=\"" << r.reason.view() << "\""
+           << " error=\"" << r.error().message() << "\""
+           << " fields=" << r.fields
+           << " server=\"" << r.server.view() << "\""
+           << " extensions=\"" << r.extensions.view() << "\""
+           << " negotiated=" << r.negotiated
+           << " fast=" << r.fast
+           << " resolve_us=" << to_us(r.times.resolve)
+           << " connect_us=" << to_us(r.times.connect)
+           << " tls_us=" << to_us(r.times.tls)
+           << " upgrade_us=" << to_us(r.times.upgrade);
+        if (r.subprotocol.size)
+            os << " subprotocol=\"" << r.subprotocol.view() << "\"";
+        if (r.body.size)
+            os << " body=\"" << r.body.view() << (r.body.truncated ? "...\"" : "\"");
+        return os;
+    }
+
+    // Totals over every record the sink consumed
+    struct summary
+    {
+        std::size_t handshakes = 0;
+        std::size_t upgraded = 0;
+        std::size_t failed = 0;
+        std::size_t fast = 0;
+
+        // Records lost because the queue was full
+        std::size_t dropped = 0;
+
+        timings total;
+        timings max;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, summary const &s)
+    {
+        double const n = s.handshakes ? double(s.handshakes) : 1.0;
+        return os << "handshakes=" << s.handshakes
+                  << " upgraded=" << s.upgraded
+                  << " failed=" << s.failed
+                  << " fast=" << s.fast
+                  << " dropped=" << s.dropped
+                  << " avg_tls_us=" << to_us(s.total.tls) / n
+                  << " max_tls_us=" << to_us(s.max.tls)
+                  << " avg_upgrade_us=" << to_us(s.total.upgrade) / n
+                  << " max_upgrade_us=" << to_us(s.max.upgrade);
+    }
+
+    namespace detail {
+        // Bounded multi-producer, single-consumer queue of trivially
+        // copyable values, after Dmitry Vyukov's bounded queue.
+        //
+        // Each slot carries a sequence number telling whose turn it is: a
+        // producer claims a position with one CAS on head_ and publishes
+        // the value by advancing the slot's sequence; the consumer reads
+        // slots in order and hands them back a lap later. A full queue
+        // refuses the value rather than waiting.
+        template<class T, std::size_t Capacity>
+        class mpsc_queue
+        {
+            static_assert(std::has_single_bit(Capacity));
+            static_assert(std::is_trivially_copyable_v<T>);
+
+            struct slot
+            {
+                std::atomic<std::size_t> seq;
+                T value;
+            };
+
+        public:
+            mpsc_queue()
+            {
+                for (std::size_t i = 0; i < Capacity; ++i)
+                    slots_[i].seq.store(i, std::memory_order_relaxed);
+            }
+
+            bool
+            try_push(T const &v) noexcept
+            {
+                std::size_t pos = head_.load(std::memory_order_relaxed);
+                for (;;)
+                {
+                    slot &s = slots_[pos & (Capacity - 1)];
+                    std::size_t const seq = s.seq.load(std::memory_order_acquire);
+                    auto const diff = static_cast<std::ptrdiff_t>(seq - pos);
+                    if (diff == 0)
+                    {
+                        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                        {
+                            s.value = v;
+                            s.seq.store(pos + 1, std::memory_order_release);
+                            return true;
+                        }
+                    }
+                    else if (diff < 0)
+                    {
+                        dropped_.fetch_add(1, std::memory_order_relaxed);
+                        return false;
+                    }
+                    else
+                        pos = head_.load(std::memory_order_relaxed);
+                }
+            }
+
+            // Consumer only
+            bool
+            try_pop(T &out) noexcept
+            {
+                slot &s = slots_[tail_ & (Capacity - 1)];
+                if (s.seq.load(std::memory_order_acquire) != tail_ + 1)
+                    return false;
+                out = s.value;
+                s.seq.store(tail_ + Capacity, std::memory_order_release);
+                ++tail_;
+                return true;
+            }
+
+            // Consumer only
+            bool
+            ready() const noexcept
+            {
+                return slots_[tail_ & (Capacity - 1)].seq.load(std::memory_order_acquire) == tail_ + 1;
+            }
+
+            std::size_t
+            dropped() const noexcept
+            {
+                return dropped_.load(std::memory_order_relaxed);
+            }
+
+        private:
+            std::unique_ptr<slot[]> slots_{new slot[Capacity]};
+            alignas(64) std::atomic<std::size_t> head_{0};
+            alignas(64) std::size_t tail_ = 0;
+            std::atomic<std::size_t> dropped_{0};
+        };
+    }// namespace detail
+
+    struct sink_options
+    {
+        // Print each record through the console
+        bool print = true;
+
+        // When set, also append each record as a CSV row
+        std::FILE *csv = nullptr;
+    };
+
+    // Takes handshake records from any thread and deals with them on its
+    // own: printing, adding them to the summary and writing the CSV file.
+    //
+    // push() copies the record into the queue and returns; it never
+    // formats, locks or touches a file, so connection code can report an
+    // outcome without stalling its event loop. The consumer sleeps while
+    // the queue is empty and is only woken by a producer when it is about
+    // to sleep, as console's flusher is.
+    class sink
+    {
+    public:
+        static constexpr std::size_t capacity = 1024;
+
+        explicit sink(sink_options const &o = {})
+            : opts_(o)
+        {
+            if (opts_.csv)
+                std::fputs("label,status,reason,error,fields,server,extensions,subprotocol,"
+                           "body,negotiated,fast,resolve_us,connect_us,tls_us,upgrade_us\n",
+                           opts_.csv);
+            consumer_ = std::thread{[this] { run(); }};
+        }
+
+        sink(sink const &) = delete;
+        sink &operator=(sink const &) = delete;
+
+        ~sink()
+        {
+            stop_.store(true, std::memory_order_relaxed);
+            wake();
+            consumer_.join();
+        }
+
+        // Queue a record, or count it as dropped if the queue is full
+        bool
+        push(handshake_record const &r) noexcept
+        {
+            if (!queue_.try_push(r))
+                return false;
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_relaxed))
+                wake();
+            return true;
+        }
+
+        // Wait until every record pushed so far has been handled
+        void
+        flush()
+        {
+            std::size_t const target = passes_.load(std::memory_order_acquire) + 2;
+            while (passes_.load(std::memory_order_acquire) < target)
+            {
+                wake();
+                std::this_thread::yield();
+            }
+        }
+
+        summary
+        stats()
+        {
+            std::lock_guard lock{mutex_};
+            summary s = summary_;
+            s.dropped = queue_.dropped();
+            return s;
+        }
+
+    private:
+        void
+        wake() noexcept
+        {
+            pending_.store(true, std::memory_order_release);
+            pending_.notify_one();
+        }
+
+        void
+        run()
+        {
+            for (;;)
+            {
+                // Clear the wakeup before reading stop_, so that one
+                // sent with the stop request is not lost
+                pending_.exchange(false, std::memory_order_acquire);
+                bool const stopping = stop_.load(std::memory_order_relaxed);
+                handshake_record r;
+                while (queue_.try_pop(r))
+                    handle(r);
+                if (opts_.csv)
+                    std::fflush(opts_.csv);
+                passes_.fetch_add(1, std::memory_order_release);
+                if (stopping)
+                    return;
+
+                // Announce the nap, then look once more; see push()
+                sleeping_.store(true, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!queue_.ready())
+                    pending_.wait(false, std::memory_order_acquire);
+                sleeping_.store(false, std::memory_order_relaxed);
+            }
+        }
+
+        void
+        handle(handshake_record const &r)
+        {
+            {
+                std::lock_guard lock{mutex_};
+                ++summary_.handshakes;
+                if (r.error())
+                    ++summary_.failed;
+                else
+                    ++summary_.upgraded;
+                summary_.fast += r.fast;
+                add(summary_.total, summary_.max, r.times);
+            }
+            if (opts_.print)
+                console::println(r);
+            if (opts_.csv)
+                write_csv(r);
+        }
+
+        static void
+        add(timings &total, timings &max, timings const &t)
+        {
+            auto const one = [](auto &sum, auto &top, auto d) {
+                sum += d;
+                top = (std::max)(top, d);
+            };
+            one(total.resolve, max.resolve, t.resolve);
+            one(total.connect, max.connect, t.connect);
+            one(total.tls, max.tls, t.tls);
+            one(total.upgrade, max.upgrade, t.upgrade);
+        }
+
+        // A quoted field, with quotes inside doubled
+        void
+        put_quoted(std::string_view s)
+        {
+            std::fputc('"', opts_.csv);
+            for (char c : s)
+            {
+                if (c == '"')
+                    std::fputc('"', opts_.csv);
+                std::fputc(c, opts_.csv);
+            }
+            std::fputs("\",", opts_.csv);
+        }
+
+        void
+        write_csv(handshake_record const &r)
+        {
+            put_quoted(r.label);
+            std::fprintf(opts_.csv, "%u,", unsigned(r.status));
+            put_quoted(r.reason.view());
+            put_quoted(r.error().message());
+            std::fprintf(opts_.csv, "%u,", unsigned(r.fields));
+            put_quoted(r.server.view());
+            put_quoted(r.extensions.view());
+            put_quoted(r.subprotocol.view());
+            put_quoted(r.body.view());
+            std::fprintf(opts_.csv, "%d,%d,%.1f,%.1f,%.1f,%.1f\n", int(r.negotiated), int(r.fast),
+                         to_us(r.times.resolve), to_us(r.times.connect),
+                         to_us(r.times.tls), to_us(r.times.upgrade));
+        }
+
+        sink_options opts_;
+        detail::mpsc_queue<handshake_record, capacity> queue_;
+        std::mutex mutex_;
+        summary summary_;
+        std::atomic<bool> pending_{false};
+        std::atomic<bool> sleeping_{false};
+        std::atomic<bool> stop_{false};
+        std::atomic<std::size_t> passes_{0};
+        std::thread consumer_;
+    };
+
+}// namespace report
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef WEBSOCKET_HANDSHAKE_RPC_CLIENT_HPP
+#define WEBSOCKET_HANDSHAKE_RPC_CLIENT_HPP
+
+#include "duplex_session.hpp"
+#include "handler_memory.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core/error.hpp>
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace rpc {
+    namespace net = boost::asio;
+    namespace beast = boost::beast;
+
+    using request_id = std::uint64_t;
+
+    // Wire format for the request id: the id in decimal, one space, then
+    // the body. The peer must echo the prefix on its response. Any type
+    // with the same two members can be used instead.
+    struct prefix_codec
+    {
+        std::string
+        encode(request_id id, std::string_view body) const
+        {
+            char digits[20];
+            auto const end = std::to_chars(digits, digits + sizeof(digits), id).ptr;
+            std::string out;
+            out.reserve(std::size_t(end - digits) + 1 + body.size());
+            out.append(digits, end);
+            out += ' ';
+            out.append(body);
+            return out;
+        }
+
+        // The id and body of a response, or nothing if it carries no id
+        std::optional<std::pair<request_id, std::string_view>>
+        decode(std::string_view message) const
+        {
+            request_id id;
+            auto const r = std::from_chars(message.data(), message.data() + message.size(), id);
+            if (r.ec != std::errc{} || r.ptr == message.data() + message.size() || *r.ptr != ' ')
+                return std::nullopt;
+            return std::pair{id, message.substr(std::size_t(r.ptr - message.data()) + 1)};
+        }
+    };
+
+    struct client_stats
+    {
+        std::size_t calls = 0;
+        std::size_t completed = 0;
+        std::size_t timeouts = 0;
+        std::size_t failed = 0;
+
+        // Responses with no matching request, e.g. arriving after a timeout
+        std::size_t orphans = 0;
+
+        std::size_t in_flight = 0;
+        std::size_t peak_in_flight = 0;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, client_stats const &s)
+    {
+        return os << "calls=" << s.calls
+                  << " completed=" << s.completed
+                  << " timeouts=" << s.timeouts
+                  << " failed=" << s.failed
+                  << " orphans=" << s.orphans
+                  << " in_flight=" << s.in_flight
+                  << " peak_in_flight=" << s.peak_in_flight;
+    }
+
+    // Many requests in flight on one connection.
+    //
+    // async_call() tags the body with a fresh id, queues it on the session
+    // and suspends until the response with the same id arrives or the
+    // timeout expires. Responses may come back in any order. run() is the
+    // session's read loop and must be running for calls to complete; when
+    // it ends, calls still waiting fail with the reason.
+    //
+    // The state of each call lives in the awaiting coroutine's frame; the
+    // client only maps ids to it. Same strand rules as duplex::session;
+    // with session_options::workers, responses are still matched on the
+    // strand.
+    template<class Stream, class Codec = prefix_codec>
+    class client
+    {
+    public:
+        explicit client(Stream &ws, duplex::session_options opts = {}, Codec codec = {})
+            : offloaded_(opts.workers != nullptr)
+            , session_(ws, std::move(opts))
+            , codec_(std::move(codec))
+        {
+        }
+
+        duplex::session<Stream> &
+        session() noexcept
+        {
+            return session_;
+        }
+
+        client_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+        // Send `body` and wait for its response body. Throws
+        // net::error::timed_out when no response arrives in time.
+        net::awaitable<std::string>
+        async_call(std::string body, std::chrono::steady_clock::duration timeout)
+        {
+            if (error_)
+                throw beast::system_error{error_};
+
+            request_id const id = next_id_++;
+            call c{net::steady_timer{session_.get_executor(), timeout}};
+            pending_.emplace(id, &c);
+            ++stats_.calls;
+            ++stats_.in_flight;
+            stats_.peak_in_flight = (std::max)(stats_.peak_in_flight, stats_.in_flight);
+
+            outbound::push_result queued;
+            try
+            {
+                queued = co_await session_.async_send(codec_.encode(id, body));
+            } catch (...)
+            {
+                forget(id);
+                throw;
+            }
+            if (queued != outbound::push_result::queued)
+            {
+                // The queue is closing or shed the request
+                forget(id);
+                throw beast::system_error{net::error::no_buffer_space};
+            }
+
+            beast::error_code ec;
+            if (!c.done)
+                co_await c.timer.async_wait(net::redirect_error(memory::use_recycled_awaitable, ec));
+
+            --stats_.in_flight;
+            if (!c.done)
+            {
+                // Timed out, or run() ended while we were waiting
+                pending_.erase(id);
+                c.error = error_ ? error_ : beast::error_code{net::error::timed_out};
+            }
+            if (c.error)
+            {
+                ++(c.error == net::error::timed_out ? stats_.timeouts : stats_.failed);
+                throw beast::system_error{c.error};
+            }
+            ++stats_.completed;
+            co_return std::move(c.response);
+        }
+
+        // Read responses until the connection closes
+        net::awaitable<void>
+        run()
+        {
+            try
+            {
+                co_await session_.run([this](inbound::message m) {
+                    // On a pool thread the calls' state is out of reach. The
+                    // post lands on the strand ahead of the read loop's own
+                    // resumption, so responses are matched in order.
+                    if (offloaded_)
+                        net::post(session_.get_executor(), [this, m = std::move(m)] { dispatch(m); });
+                    else
+                        dispatch(m);
+                });
+                fail_all(net::error::connection_aborted);
+            } catch (beast::system_error const &e)
+            {
+                fail_all(e.code());
+                throw;
+            }
+        }
+
+        void
+        close()
+        {
+            session_.close();
+        }
+
+    private:
+        struct call
+        {
+            net::steady_timer timer;
+            std::string response{};
+            beast::error_code error{};
+            bool done = false;
+        };
+
+        void
+        dispatch(inbound::message const &m)
+        {
+            auto const data = m.data();
+            auto const r = codec_.decode({static_cast<char const *>(data.data()), data.size()});
+            auto const it = r ? pending_.find(r->first) : pending_.end();
+            if (it == pending_.end())
+            {
+                ++stats_.orphans;
+                return;
+            }
+            call &c = *it->second;
+            pending_.erase(it);
+            c.response.assign(r->second);
+            c.done = true;
+            c.timer.cancel();
+        }
+
+        void
+        forget(request_id id)
+        {
+            pending_.erase(id);
+            --stats_.in_flight;
+            ++stats_.failed;
+        }
+
+        void
+        fail_all(beast::error_code ec)
+        {
+            error_ = ec;
+            for (auto &[id, c] : pending_)
+            {
+                c->error = ec;
+                c->done = true;
+                c->timer.cancel();
+            }
+            pending_.clear();
+        }
+
+        bool offloaded_;
+        duplex::session<Stream> session_;
+        Codec codec_;
+        std::unordered_map<request_id, call *> pending_;
+        request_id next_id_ = 1;
+        beast::error_code error_;
+        client_stats stats_;
+    };
+
+}// namespace rpc
+
+#endif
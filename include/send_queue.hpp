@@ -0,0 +1,482 @@
+#ifndef WEBSOCKET_HANDSHAKE_SEND_QUEUE_HPP
+#define WEBSOCKET_HANDSHAKE_SEND_QUEUE_HPP
+
+#include "handler_memory.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/core/error.hpp>
+#include <boost/beast/websocket/rfc6455.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <utility>
+
+namespace outbound {
+    namespace net = boost::asio;
+    namespace beast = boost::beast;
+    namespace websocket = boost::beast::websocket;
+
+    // What happens to a message that would take the queue past its limit
+    enum class overflow_policy
+    {
+        // async_push waits until the queue drains below the low watermark;
+        // try_push refuses the message
+        block,
+        // Discard the message being pushed
+        drop_newest,
+        // Discard queued messages, oldest first, to make room
+        drop_oldest
+    };
+
+    enum class push_result
+    {
+        queued,
+        would_block,
+        dropped
+    };
+
+    struct queue_options
+    {
+        // Producers are told to slow down above this many queued bytes...
+        std::size_t high_watermark = 1024 * 1024;
+
+        // ...and that they may resume once it falls to this
+        std::size_t low_watermark = 256 * 1024;
+
+        // The overflow policy applies beyond this
+        std::size_t limit = 4 * 1024 * 1024;
+
+        overflow_policy policy = overflow_policy::block;
+
+        // Upper bound on how long a control frame waits behind bulk data.
+        // Bulk messages are cut into fragments sized from the measured
+        // write throughput so that one fragment takes about this long.
+        std::chrono::microseconds max_control_delay{2000};
+
+        // Bounds for the automatic fragment size
+        std::size_t min_fragment = 4 * 1024;
+        std::size_t max_fragment = 1024 * 1024;
+    };
+
+    struct queue_metrics
+    {
+        std::size_t depth = 0;
+        std::size_t bytes = 0;
+        std::size_t peak_depth = 0;
+        std::size_t peak_bytes = 0;
+        std::size_t sent = 0;
+        std::size_t dropped = 0;
+        std::size_t blocked = 0;
+        std::size_t high_watermarks = 0;
+        std::size_t fragments = 0;
+        std::size_t fragment_size = 0;
+        std::size_t control_sent = 0;
+        std::chrono::microseconds max_control_wait{0};
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, queue_metrics const &m)
+    {
+        return os << "depth=" << m.depth
+                  << " bytes=" << m.bytes
+                  << " peak_depth=" << m.peak_depth
+                  << " peak_bytes=" << m.peak_bytes
+                  << " sent=" << m.sent
+                  << " dropped=" << m.dropped
+                  << " blocked=" << m.blocked
+                  << " high_watermarks=" << m.high_watermarks
+                  << " fragments=" << m.fragments
+                  << " fragment_size=" << m.fragment_size
+                  << " control_sent=" << m.control_sent
+                  << " max_control_wait_us=" << m.max_control_wait.count();
+    }
+
+    // Per-connection send queue with backpressure.
+    //
+    // Beast allows one outstanding async_write per stream. Producers push
+    // messages here without waiting for the wire; the queue keeps exactly
+    // one write in flight and starts the next from its completion. When
+    // the queued bytes reach the high watermark the on_high callback runs
+    // once, and on_low runs when they fall back to the low watermark.
+    // Beyond the limit the overflow policy decides.
+    //
+    // Control frames have their own lane. Bulk messages go out as
+    // fragments with write_some, and a queued ping, pong or close is sent
+    // before the next fragment, so it never waits behind more than one
+    // fragment. A close also ends the message being sent and discards the
+    // rest of the bulk lane, as no data may follow it.
+    //
+    // Writes go through Beast's own writer, so a read loop may run on the
+    // same stream at the same time: Beast serializes its automatic pong
+    // and close replies with our writes. All member functions must be
+    // called from the stream's executor, and the queue must outlive the
+    // write in flight; async_drain() waits for it.
+    template<class Stream>
+    class send_queue
+    {
+    public:
+        explicit send_queue(Stream &ws, queue_options opts = {})
+            : ws_(ws)
+            , opts_(opts)
+            , space_(ws.get_executor(), std::chrono::steady_clock::time_point::max())
+            , idle_(ws.get_executor(), std::chrono::steady_clock::time_point::max())
+            , fragment_(std::clamp<std::size_t>(16 * 1024, opts.min_fragment, opts.max_fragment))
+        {
+            metrics_.fragment_size = fragment_;
+        }
+
+        send_queue(send_queue const &) = delete;
+        send_queue &operator=(send_queue const &) = delete;
+
+        void
+        on_high_watermark(std::function<void()> f)
+        {
+            on_high_ = std::move(f);
+        }
+
+        void
+        on_low_watermark(std::function<void()> f)
+        {
+            on_low_ = std::move(f);
+        }
+
+        queue_metrics const &
+        metrics() const noexcept
+        {
+            return metrics_;
+        }
+
+        // True between crossing the high watermark and draining to the low
+        bool
+        above_high_watermark() const noexcept
+        {
+            return above_high_;
+        }
+
+        // The error that stopped the queue, if any
+        beast::error_code
+        error() const noexcept
+        {
+            return error_;
+        }
+
+        // Queue a message without waiting
+        push_result
+        try_push(std::string payload, bool text = true)
+        {
+            if (error_ || closing_)
+            {
+                ++metrics_.dropped;
+                return push_result::dropped;
+            }
+            if (!fits(payload.size()))
+            {
+                switch (opts_.policy)
+                {
+                case overflow_policy::block:
+                    return push_result::would_block;
+                case overflow_policy::drop_newest:
+                    ++metrics_.dropped;
+                    return push_result::dropped;
+                case overflow_policy::drop_oldest:
+                    evict_for(payload.size());
+                    break;
+                }
+            }
+            enqueue(std::move(payload), text);
+            return push_result::queued;
+        }
+
+        // Queue a message, waiting for room under the block policy. The
+        // drop policies apply the limit as try_push() does.
+        net::awaitable<push_result>
+        async_push(std::string payload, bool text = true)
+        {
+            if (opts_.policy != overflow_policy::block)
+            {
+                if (error_)
+                    throw beast::system_error{error_};
+                co_return try_push(std::move(payload), text);
+            }
+            if (!error_ && !fits(payload.size()))
+            {
+                ++metrics_.blocked;
+                while (!error_ && (above_high_ || !fits(payload.size())) && !queue_.empty())
+                {
+                    beast::error_code ec;
+                    co_await space_.async_wait(net::redirect_error(memory::use_recycled_awaitable, ec));
+                }
+            }
+            if (error_)
+                throw beast::system_error{error_};
+            if (closing_)
+            {
+                ++metrics_.dropped;
+                co_return push_result::dropped;
+            }
+            enqueue(std::move(payload), text);
+            co_return push_result::queued;
+        }
+
+        // Control frames, sent ahead of any bulk data still queued
+        void
+        ping(websocket::ping_data payload = {})
+        {
+            push_control({control::ping, std::move(payload), {}});
+        }
+
+        void
+        pong(websocket::ping_data payload = {})
+        {
+            push_control({control::pong, std::move(payload), {}});
+        }
+
+        void
+        close(websocket::close_reason reason = websocket::close_code::normal)
+        {
+            if (closing_)
+                return;
+            closing_ = true;
+            push_control({control::close, {}, std::move(reason)});
+        }
+
+        // Wait until every queued message has been written
+        net::awaitable<void>
+        async_drain()
+        {
+            while ((!queue_.empty() || !controls_.empty() || writing_) && !error_)
+            {
+                beast::error_code ec;
+                co_await idle_.async_wait(net::redirect_error(memory::use_recycled_awaitable, ec));
+            }
+            if (error_)
+                throw beast::system_error{error_};
+        }
+
+    private:
+        struct message
+        {
+            std::string payload;
+            bool text;
+            std::size_t offset = 0;
+        };
+
+        struct control
+        {
+            enum kind_type
+            {
+                ping,
+                pong,
+                close
+            } kind;
+            websocket::ping_data payload;
+            websocket::close_reason reason;
+            std::chrono::steady_clock::time_point queued = std::chrono::steady_clock::now();
+        };
+
+        bool
+        fits(std::size_t n) const noexcept
+        {
+            return metrics_.bytes + n <= opts_.limit;
+        }
+
+        // Drop queued messages from the front, skipping one that is partly
+        // written, until `n` more bytes fit
+        void
+        evict_for(std::size_t n)
+        {
+            std::size_t const first = !queue_.empty() && (queue_.front().offset || bulk_in_flight_) ? 1 : 0;
+            while (!fits(n) && queue_.size() > first)
+            {
+                auto it = queue_.begin() + first;
+                metrics_.bytes -= it->payload.size();
+                --metrics_.depth;
+                ++metrics_.dropped;
+                queue_.erase(it);
+            }
+            check_low();
+        }
+
+        void
+        enqueue(std::string payload, bool text)
+        {
+            metrics_.bytes += payload.size();
+            ++metrics_.depth;
+            metrics_.peak_bytes = (std::max)(metrics_.peak_bytes, metrics_.bytes);
+            metrics_.peak_depth = (std::max)(metrics_.peak_depth, metrics_.depth);
+            queue_.push_back({std::move(payload), text});
+
+            if (!above_high_ && metrics_.bytes >= opts_.high_watermark)
+            {
+                above_high_ = true;
+                ++metrics_.high_watermarks;
+                if (on_high_)
+                    on_high_();
+            }
+            if (!writing_)
+                write_next();
+        }
+
+        void
+        push_control(control c)
+        {
+            if (error_)
+                return;
+            controls_.push_back(std::move(c));
+            if (!writing_)
+                write_next();
+        }
+
+        void
+        write_next()
+        {
+            writing_ = true;
+            if (!controls_.empty())
+            {
+                auto &c = controls_.front();
+                auto waited = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - c.queued);
+                metrics_.max_control_wait = (std::max)(metrics_.max_control_wait, waited);
+                auto handler = memory::recycled([this](beast::error_code ec) { on_control(ec); });
+                switch (c.kind)
+                {
+                case control::ping: ws_.async_ping(c.payload, handler); break;
+                case control::pong: ws_.async_pong(c.payload, handler); break;
+                case control::close: ws_.async_close(c.reason, handler); break;
+                }
+                return;
+            }
+
+            auto &m = queue_.front();
+            if (m.offset == 0)
+                ws_.text(m.text);
+            std::size_t const n = (std::min)(fragment_, m.payload.size() - m.offset);
+            bool const fin = m.offset + n == m.payload.size();
+            bulk_in_flight_ = true;
+            started_ = std::chrono::steady_clock::now();
+            ws_.async_write_some(fin, net::buffer(m.payload.data() + m.offset, n),
+                                 memory::recycled([this](beast::error_code ec, std::size_t) { on_write(ec); }));
+        }
+
+        void
+        fail(beast::error_code ec)
+        {
+            error_ = ec;
+            space_.cancel();
+            idle_.cancel();
+        }
+
+        void
+        on_control(beast::error_code ec)
+        {
+            writing_ = false;
+            if (ec)
+                return fail(ec);
+            ++metrics_.control_sent;
+            bool const closed = controls_.front().kind == control::close;
+            controls_.pop_front();
+            if (closed)
+            {
+                // Nothing may follow a close frame
+                metrics_.dropped += queue_.size();
+                metrics_.depth = 0;
+                metrics_.bytes = 0;
+                queue_.clear();
+                controls_.clear();
+            }
+            resume();
+        }
+
+        void
+        on_write(beast::error_code ec)
+        {
+            writing_ = false;
+            bulk_in_flight_ = false;
+            if (ec)
+                return fail(ec);
+
+            auto &m = queue_.front();
+            std::size_t const n = (std::min)(fragment_, m.payload.size() - m.offset);
+            m.offset += n;
+            metrics_.bytes -= n;
+            ++metrics_.fragments;
+            tune_fragment(n);
+            if (m.offset == m.payload.size())
+            {
+                --metrics_.depth;
+                ++metrics_.sent;
+                queue_.pop_front();
+            }
+
+            check_low();
+            resume();
+        }
+
+        // Leave the high state once queued bytes fall to the low watermark,
+        // whether they were written or evicted
+        void
+        check_low()
+        {
+            if (above_high_ && metrics_.bytes <= opts_.low_watermark)
+            {
+                above_high_ = false;
+                if (on_low_)
+                    on_low_();
+                space_.cancel();
+            }
+        }
+
+        void
+        resume()
+        {
+            if (!controls_.empty() || !queue_.empty())
+                return write_next();
+            space_.cancel();
+            idle_.cancel();
+        }
+
+        // Size the next fragment so it takes about max_control_delay at the
+        // throughput the last ones achieved
+        void
+        tune_fragment(std::size_t n)
+        {
+            auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started_).count();
+            if (n < fragment_ || elapsed <= 0)
+                return;
+            double const rate = double(n) / elapsed;
+            rate_ = rate_ > 0 ? 0.8 * rate_ + 0.2 * rate : rate;
+            auto const target = rate_ * std::chrono::duration<double>(opts_.max_control_delay).count();
+            fragment_ = std::clamp(static_cast<std::size_t>(target), opts_.min_fragment, opts_.max_fragment);
+            metrics_.fragment_size = fragment_;
+        }
+
+        Stream &ws_;
+        queue_options opts_;
+        std::deque<message> queue_;
+        std::deque<control> controls_;
+        net::steady_timer space_;
+        net::steady_timer idle_;
+        std::function<void()> on_high_;
+        std::function<void()> on_low_;
+        queue_metrics metrics_;
+        beast::error_code error_;
+        std::size_t fragment_;
+        double rate_ = 0;
+        std::chrono::steady_clock::time_point started_;
+        bool writing_ = false;
+        bool bulk_in_flight_ = false;
+        bool above_high_ = false;
+        bool closing_ = false;
+    };
+
+}// namespace outbound
+
+#endif
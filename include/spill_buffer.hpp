@@ -0,0 +1,291 @@
+#ifndef WEBSOCKET_HANDSHAKE_SPILL_BUFFER_HPP
+#define WEBSOCKET_HANDSHAKE_SPILL_BUFFER_HPP
+
+#include "buffer_pool.hpp"
+#include "chunk_reader.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/error.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace inbound {
+    namespace beast = boost::beast;
+
+    struct spill_options
+    {
+        // Messages up to this size stay in memory
+        std::size_t threshold = 1024 * 1024;
+
+        // Where spill files are created. Empty means $TMPDIR, or /tmp.
+        std::string directory;
+
+        // Chunking and size limit for the underlying reads. A spilled
+        // message is bounded by this limit rather than by memory, so it
+        // stays finite: 256 MiB unless set larger here. Zero falls back to
+        // the stream's own limit.
+        chunk_options read{.message_limit = 256 * 1024 * 1024};
+    };
+
+    class spill_writer;
+
+    // A received message, held either in a pooled buffer or, past the
+    // spill threshold, in an unlinked temp file mapped read-only.
+    //
+    // The file has no name once created, so it disappears when the message
+    // is destroyed or the process exits. Its pages live in the page cache
+    // and can be evicted under memory pressure instead of counting against
+    // the connection's heap.
+    class message
+    {
+    public:
+        message() = default;
+
+        message(message &&other) noexcept
+            : memory_(std::move(other.memory_))
+            , fd_(std::exchange(other.fd_, -1))
+            , map_(std::exchange(other.map_, nullptr))
+            , size_(std::exchange(other.size_, 0))
+            , text_(other.text_)
+        {
+        }
+
+        message &
+        operator=(message &&other) noexcept
+        {
+            if (this != &other)
+            {
+                unmap();
+                memory_ = std::move(other.memory_);
+                fd_ = std::exchange(other.fd_, -1);
+                map_ = std::exchange(other.map_, nullptr);
+                size_ = std::exchange(other.size_, 0);
+                text_ = other.text_;
+            }
+            return *this;
+        }
+
+        ~message()
+        {
+            unmap();
+        }
+
+        // True if the payload lives in a temp file
+        bool
+        spilled() const noexcept
+        {
+            return fd_ != -1;
+        }
+
+        bool
+        text() const noexcept
+        {
+            return text_;
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return spilled() ? size_ : memory_.size();
+        }
+
+        net::const_buffer
+        data() const noexcept
+        {
+            if (spilled())
+                return {map_, size_};
+            return memory_.data();
+        }
+
+    private:
+        friend class spill_writer;
+
+        void
+        unmap() noexcept
+        {
+            if (map_)
+                ::munmap(map_, size_);
+            if (fd_ != -1)
+                ::close(fd_);
+            map_ = nullptr;
+            fd_ = -1;
+        }
+
+        buffers::pooled_buffer memory_;
+        int fd_ = -1;
+        void *map_ = nullptr;
+        std::size_t size_ = 0;
+        bool text_ = true;
+    };
+
+    namespace detail {
+        [[noreturn]] inline void
+        throw_errno(char const *what)
+        {
+            throw beast::system_error{beast::error_code{errno, beast::system_category()}, what};
+        }
+
+        inline int
+        open_spill_file(std::string dir)
+        {
+            if (dir.empty())
+            {
+                char const *tmp = std::getenv("TMPDIR");
+                dir = tmp && *tmp ? tmp : "/tmp";
+            }
+            std::string path = dir + "/websocket-spill-XXXXXX";
+            int const fd = ::mkstemp(path.data());
+            if (fd == -1)
+                throw_errno("mkstemp");
+            ::unlink(path.c_str());
+            return fd;
+        }
+
+        // Write all of `b` at `offset`
+        inline void
+        write_at(int fd, net::const_buffer b, off_t offset)
+        {
+            auto p = static_cast<char const *>(b.data());
+            std::size_t n = b.size();
+            while (n)
+            {
+                ssize_t const r = ::pwrite(fd, p, n, offset);
+                if (r == -1)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    throw_errno("pwrite");
+                }
+                p += r;
+                n -= static_cast<std::size_t>(r);
+                offset += r;
+            }
+        }
+
+        inline void
+        resize_file(int fd, std::size_t n)
+        {
+            if (::ftruncate(fd, static_cast<off_t>(n)) == -1)
+                throw_errno("ftruncate");
+        }
+    }// namespace detail
+
+    // Collects the chunks of one message, switching from memory to a temp
+    // file when the threshold is crossed.
+    //
+    // The file is sized ahead of the writes with ftruncate, which only
+    // reserves a sparse range, doubling each time it runs out. Each chunk
+    // is then written at its offset with pwrite, and finish() trims the
+    // file to the message before mapping it.
+    class spill_writer
+    {
+    public:
+        explicit spill_writer(spill_options const &opts)
+            : opts_(opts)
+        {
+        }
+
+        void
+        append(net::const_buffer chunk)
+        {
+            if (m_.fd_ == -1 && m_.memory_.size() + chunk.size() > opts_.threshold)
+            {
+                // Move what we have so far to the file
+                m_.fd_ = detail::open_spill_file(opts_.directory);
+                reserve(m_.memory_.size() + chunk.size());
+                detail::write_at(m_.fd_, m_.memory_.data(), 0);
+                m_.size_ = m_.memory_.size();
+                m_.memory_ = buffers::pooled_buffer{};
+            }
+            if (m_.fd_ != -1)
+            {
+                reserve(m_.size_ + chunk.size());
+                detail::write_at(m_.fd_, chunk, static_cast<off_t>(m_.size_));
+                m_.size_ += chunk.size();
+                return;
+            }
+            auto mb = m_.memory_.prepare(chunk.size());
+            net::buffer_copy(mb, chunk);
+            m_.memory_.commit(chunk.size());
+        }
+
+        message
+        finish(bool text)
+        {
+            m_.text_ = text;
+            if (m_.fd_ != -1)
+            {
+                if (reserved_ != m_.size_)
+                    detail::resize_file(m_.fd_, m_.size_);
+                void *p = ::mmap(nullptr, m_.size_, PROT_READ, MAP_PRIVATE, m_.fd_, 0);
+                if (p == MAP_FAILED)
+                    detail::throw_errno("mmap");
+                m_.map_ = p;
+            }
+            return std::move(m_);
+        }
+
+    private:
+        // Make the file at least `n` bytes long
+        void
+        reserve(std::size_t n)
+        {
+            if (n <= reserved_)
+                return;
+            reserved_ = (std::max)(n, 2 * reserved_);
+            detail::resize_file(m_.fd_, reserved_);
+        }
+
+        spill_options const &opts_;
+        message m_;
+        std::size_t reserved_ = 0;
+    };
+
+    // Read one message, spilling it to a mapped temp file if it is larger
+    // than the threshold
+    template<class Stream>
+    message
+    read_message(Stream &ws, spill_options const &opts = {})
+    {
+        spill_writer w{opts};
+        chunk_reader<Stream> reader{ws, opts.read};
+        do
+            w.append(reader.next());
+        while (!reader.done());
+        return w.finish(reader.text());
+    }
+
+    template<class Stream>
+    net::awaitable<message>
+    async_read_message(Stream &ws, spill_options opts)
+    {
+        spill_writer w{opts};
+        chunk_reader<Stream> reader{ws, opts.read};
+        do
+            w.append(co_await reader.async_next());
+        while (!reader.done());
+        co_return w.finish(reader.text());
+    }
+
+    // Not a default argument: GCC destroys defaulted coroutine parameters
+    // of class type twice
+    template<class Stream>
+    net::awaitable<message>
+    async_read_message(Stream &ws)
+    {
+        spill_options opts;
+        return async_read_message(ws, std::move(opts));
+    }
+
+}// namespace inbound
+
+#endif
@@ -0,0 +1,517 @@
+#ifndef WEBSOCKET_HANDSHAKE_TASK_HPP
+#define WEBSOCKET_HANDSHAKE_TASK_HPP
+
+#include "handler_memory.hpp"
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/system/system_error.hpp>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace coro {
+    namespace net = boost::asio;
+
+    // A lazy coroutine for linear connection flows.
+    //
+    // Compared to net::awaitable it carries no executor and no call stack
+    // of its own: a task starts when awaited, resumes its awaiter by
+    // symmetric transfer when it finishes, and its frame comes from the
+    // thread's memory::recycler. Socket operations are awaited with
+    // coro::use_task and resume the task directly from their completion
+    // handler, on the executor of the I/O object, so every I/O object a
+    // task uses must share one thread or strand.
+    //
+    // Symmetric transfer keeps long chains of synchronously completing
+    // awaits off the stack only when the compiler turns it into a tail
+    // call, which GCC does with optimization enabled.
+    //
+    //     coro::task<std::size_t> f(tcp::socket &s, net::mutable_buffer b)
+    //     {
+    //         co_return co_await s.async_read_some(b, coro::use_task);
+    //     }
+    template<class T = void>
+    class task;
+
+    namespace detail {
+        // Frames of every coroutine in this file are recycled per thread
+        struct pooled_frame
+        {
+            static void *
+            operator new(std::size_t n)
+            {
+                return memory::recycler::local().allocate(n);
+            }
+
+            static void
+            operator delete(void *p, std::size_t n) noexcept
+            {
+                memory::recycler::local().deallocate(p, n);
+            }
+        };
+
+        struct promise_base : pooled_frame
+        {
+            struct final_awaiter
+            {
+                bool
+                await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                template<class Promise>
+                std::coroutine_handle<>
+                await_suspend(std::coroutine_handle<Promise> h) noexcept
+                {
+                    auto next = h.promise().continuation;
+                    return next ? next : std::noop_coroutine();
+                }
+
+                void
+                await_resume() const noexcept
+                {
+                }
+            };
+
+            std::suspend_always
+            initial_suspend() const noexcept
+            {
+                return {};
+            }
+
+            final_awaiter
+            final_suspend() const noexcept
+            {
+                return {};
+            }
+
+            std::coroutine_handle<> continuation;
+        };
+
+        template<class T>
+        struct promise final : promise_base
+        {
+            task<T>
+            get_return_object() noexcept;
+
+            template<class U>
+            void
+            return_value(U &&v)
+            {
+                result.template emplace<1>(std::forward<U>(v));
+            }
+
+            void
+            unhandled_exception() noexcept
+            {
+                result.template emplace<2>(std::current_exception());
+            }
+
+            T
+            take()
+            {
+                if (result.index() == 2)
+                    std::rethrow_exception(std::get<2>(result));
+                return std::move(std::get<1>(result));
+            }
+
+            std::variant<std::monostate, T, std::exception_ptr> result;
+        };
+
+        template<>
+        struct promise<void> final : promise_base
+        {
+            task<void>
+            get_return_object() noexcept;
+
+            void
+            return_void() noexcept
+            {
+            }
+
+            void
+            unhandled_exception() noexcept
+            {
+                error = std::current_exception();
+            }
+
+            void
+            take()
+            {
+                if (error)
+                    std::rethrow_exception(error);
+            }
+
+            std::exception_ptr error;
+        };
+    }// namespace detail
+
+    template<class T>
+    class task
+    {
+    public:
+        using promise_type = detail::promise<T>;
+
+        task(task &&other) noexcept
+            : h_(std::exchange(other.h_, nullptr))
+        {
+        }
+
+        task &operator=(task &&) = delete;
+
+        ~task()
+        {
+            if (h_)
+                h_.destroy();
+        }
+
+        auto
+        operator co_await() &&noexcept
+        {
+            struct awaiter
+            {
+                std::coroutine_handle<promise_type> h;
+
+                bool
+                await_ready() const noexcept
+                {
+                    return false;
+                }
+
+                std::coroutine_handle<>
+                await_suspend(std::coroutine_handle<> caller) noexcept
+                {
+                    h.promise().continuation = caller;
+                    return h;
+                }
+
+                T
+                await_resume()
+                {
+                    return h.promise().take();
+                }
+            };
+            return awaiter{h_};
+        }
+
+    private:
+        friend promise_type;
+
+        explicit task(std::coroutine_handle<promise_type> h) noexcept
+            : h_(h)
+        {
+        }
+
+        std::coroutine_handle<promise_type> h_;
+    };
+
+    namespace detail {
+        template<class T>
+        task<T>
+        promise<T>::get_return_object() noexcept
+        {
+            return task<T>{std::coroutine_handle<promise<T>>::from_promise(*this)};
+        }
+
+        inline task<void>
+        promise<void>::get_return_object() noexcept
+        {
+            return task<void>{std::coroutine_handle<promise<void>>::from_promise(*this)};
+        }
+
+        // Eagerly started, self-destroying coroutine that owns a spawned task
+        struct root
+        {
+            struct promise_type : pooled_frame
+            {
+                root
+                get_return_object() const noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never
+                initial_suspend() const noexcept
+                {
+                    return {};
+                }
+
+                std::suspend_never
+                final_suspend() const noexcept
+                {
+                    return {};
+                }
+
+                void
+                return_void() const noexcept
+                {
+                }
+
+                void
+                unhandled_exception() const noexcept
+                {
+                    std::terminate();
+                }
+            };
+        };
+
+        template<class T, class Handler>
+        root
+        run_root(task<T> t, Handler handler)
+        {
+            std::exception_ptr e;
+            if constexpr (std::is_void_v<T>)
+            {
+                try
+                {
+                    co_await std::move(t);
+                } catch (...)
+                {
+                    e = std::current_exception();
+                }
+                handler(e);
+            }
+            else
+            {
+                std::optional<T> r;
+                try
+                {
+                    r.emplace(co_await std::move(t));
+                } catch (...)
+                {
+                    e = std::current_exception();
+                }
+                handler(e, std::move(r));
+            }
+        }
+    }// namespace detail
+
+    // Start `t` on `ex`. `handler(std::exception_ptr)` is called when it
+    // finishes, with an optional<T> result after the exception for a
+    // task<T>.
+    template<class Executor, class T, class Handler>
+    void
+    spawn(Executor const &ex, task<T> t, Handler handler)
+    {
+        net::post(ex, [t = std::move(t), handler = std::move(handler)]() mutable {
+            detail::run_root(std::move(t), std::move(handler));
+        });
+    }
+
+    //------------------------------------------------------------------------------
+
+    // Completion token: the operation returns an awaitable for its result.
+    // An error_code as the first completion argument is thrown as a
+    // system_error; combine with net::redirect_error to receive it instead.
+    struct use_task_t
+    {
+    };
+
+    inline constexpr use_task_t use_task{};
+
+    namespace detail {
+        // What co_await yields for an operation completing with Args...:
+        // nothing, the one value, or a tuple, after any leading error_code
+        template<class... Args>
+        struct values_of
+        {
+            using type = std::tuple<Args...>;
+        };
+
+        template<class Arg>
+        struct values_of<Arg>
+        {
+            using type = Arg;
+        };
+
+        template<>
+        struct values_of<>
+        {
+            using type = void;
+        };
+
+        template<class... Args>
+        struct op_result : values_of<Args...>
+        {
+        };
+
+        template<class... Args>
+        struct op_result<boost::system::error_code, Args...> : values_of<Args...>
+        {
+        };
+
+        // Shared by an operation's handler and its awaiter. Whichever lets
+        // go last frees it.
+        template<class... Args>
+        struct op_state : pooled_frame
+        {
+            std::optional<std::tuple<Args...>> args;
+            std::coroutine_handle<> waiter;
+            int refs = 2;
+
+            void
+            unref() noexcept
+            {
+                if (--refs == 0)
+                    delete this;
+            }
+        };
+
+        template<class... Args>
+        class op_handler
+        {
+        public:
+            using allocator_type = memory::recycling_allocator<void>;
+
+            explicit op_handler(op_state<Args...> *s) noexcept
+                : s_(s)
+            {
+            }
+
+            op_handler(op_handler &&other) noexcept
+                : s_(std::exchange(other.s_, nullptr))
+            {
+            }
+
+            op_handler &operator=(op_handler &&) = delete;
+
+            // Destroyed without being called, e.g. when its io_context is
+            // torn down: the awaiting task is never resumed
+            ~op_handler()
+            {
+                if (s_)
+                    s_->unref();
+            }
+
+            allocator_type
+            get_allocator() const noexcept
+            {
+                return {};
+            }
+
+            template<class... Results>
+            void
+            operator()(Results &&...results)
+            {
+                auto *s = std::exchange(s_, nullptr);
+                s->args.emplace(std::forward<Results>(results)...);
+                auto waiter = s->waiter;
+                s->unref();
+                if (waiter)
+                    waiter.resume();
+            }
+
+        private:
+            op_state<Args...> *s_;
+        };
+
+        template<class... Args>
+        class op_awaiter
+        {
+        public:
+            using result_type = typename op_result<Args...>::type;
+
+            explicit op_awaiter(op_state<Args...> *s) noexcept
+                : s_(s)
+            {
+            }
+
+            op_awaiter(op_awaiter &&other) noexcept
+                : s_(std::exchange(other.s_, nullptr))
+            {
+            }
+
+            op_awaiter &operator=(op_awaiter &&) = delete;
+
+            ~op_awaiter()
+            {
+                if (s_)
+                    s_->unref();
+            }
+
+            bool
+            await_ready() const noexcept
+            {
+                return s_->args.has_value();
+            }
+
+            void
+            await_suspend(std::coroutine_handle<> h) noexcept
+            {
+                s_->waiter = h;
+            }
+
+            result_type
+            await_resume()
+            {
+                return std::apply([](auto &...a) { return unpack(a...); }, *s_->args);
+            }
+
+        private:
+            template<class First, class... Rest>
+            static result_type
+            unpack(First &first, Rest &...rest)
+            {
+                if constexpr (std::is_same_v<First, boost::system::error_code>)
+                {
+                    if (first)
+                        throw boost::system::system_error{first};
+                    return values(rest...);
+                }
+                else
+                    return values(first, rest...);
+            }
+
+            static result_type
+            unpack()
+            {
+                return values();
+            }
+
+            template<class... A>
+            static result_type
+            values(A &...a)
+            {
+                if constexpr (std::is_void_v<result_type>)
+                    return;
+                else
+                    return result_type{std::move(a)...};
+            }
+
+            op_state<Args...> *s_;
+        };
+    }// namespace detail
+
+}// namespace coro
+
+namespace boost::asio {
+    template<class... Args>
+    class async_result<coro::use_task_t, void(Args...)>
+    {
+    public:
+        using state_type = coro::detail::op_state<std::decay_t<Args>...>;
+        using return_type = coro::detail::op_awaiter<std::decay_t<Args>...>;
+
+        // The operation starts here; the awaiter only collects its result
+        template<class Initiation, class... InitArgs>
+        static return_type
+        initiate(Initiation &&initiation, coro::use_task_t, InitArgs &&...args)
+        {
+            auto *s = new state_type;
+            return_type awaiter{s};
+            std::forward<Initiation>(initiation)(coro::detail::op_handler<std::decay_t<Args>...>{s},
+                                                 std::forward<InitArgs>(args)...);
+            return awaiter;
+        }
+    };
+}// namespace boost::asio
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WEBSOCKET_HANDSHAKE_TRANSPORT_HPP
+#define WEBSOCKET_HANDSHAKE_TRANSPORT_HPP
+
+#include <boost/asio/detail/config.hpp>
+
+namespace transport {
+
+    // The kernel interface Asio drives socket I/O with.
+    //
+    // Configuring with -DUSE_IO_URING=ON (Boost 1.78 or later, liburing)
+    // defines BOOST_ASIO_HAS_IO_URING and BOOST_ASIO_DISABLE_EPOLL. Asio
+    // then runs every socket operation through one io_uring per
+    // io_context: reads and writes are submitted as ring entries, several
+    // per io_uring_enter, and complete without a readiness round trip.
+    // tcp::socket keeps its type, so websocket::stream<beast::ssl_stream<
+    // tcp::socket>> picks up the new backend without code changes.
+    inline constexpr char const *
+    backend()
+    {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+        return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+        return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+        return "kqueue";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+        return "iocp";
+#else
+        return "select";
+#endif
+    }
+
+}// namespace transport
+
+#endif
@@ -0,0 +1,381 @@
+#ifndef WEBSOCKET_HANDSHAKE_UPGRADE_PARSER_HPP
+#define WEBSOCKET_HANDSHAKE_UPGRADE_PARSER_HPP
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSOCKET_HANDSHAKE_UPGRADE_X86 1
+#endif
+
+namespace protocol {
+
+    // What the client needs from a server's 101 reply. The views point
+    // into the parsed bytes; a field that was absent has a null data().
+    struct upgrade_response
+    {
+        std::string_view reason;
+        std::string_view connection;
+        std::string_view upgrade;
+        std::string_view sec_accept;
+        std::string_view extensions;
+        std::string_view subprotocol;
+
+        // Header lines, including those not kept above
+        std::size_t fields = 0;
+
+        // Bytes up to and including the blank line after the headers
+        std::size_t size = 0;
+    };
+
+    enum class parse_result
+    {
+        complete,
+        // A prefix of a response this parser accepts: feed more bytes
+        incomplete,
+        // Anything else, valid or not, is left to the general parser
+        fallback
+    };
+
+    namespace detail {
+        // Return the first byte in [p, end) that ends a field value: a
+        // control character or DEL. `end` if none. HTAB is valid inside a
+        // value but rare, and Beast's parser refuses it, so it is left to
+        // the fallback.
+        using scan_fn = char const *(*) (char const *p, char const *end);
+
+        // Bytes that may appear in a field name, RFC 7230 section 3.2.6
+        struct token_table
+        {
+            bool ok[256] = {};
+
+            constexpr token_table()
+            {
+                for (int c = '0'; c <= '9'; ++c)
+                    ok[c] = true;
+                for (int c = 'a'; c <= 'z'; ++c)
+                    ok[c] = ok[c - 'a' + 'A'] = true;
+                for (unsigned char c : std::string_view{"!#$%&'*+-.^_`|~"})
+                    ok[c] = true;
+            }
+        };
+
+        inline constexpr token_table tokens{};
+
+        inline bool
+        ends_value(unsigned char c)
+        {
+            return c < 0x20 || c == 0x7f;
+        }
+
+        inline bool
+        ends_name(unsigned char c)
+        {
+            return c <= 0x20 || c == ':' || c == 0x7f;
+        }
+
+        inline char const *
+        value_end_scalar(char const *p, char const *end)
+        {
+            while (p != end && !ends_value(static_cast<unsigned char>(*p)))
+                ++p;
+            return p;
+        }
+
+        inline char const *
+        name_end_scalar(char const *p, char const *end)
+        {
+            while (p != end && !ends_name(static_cast<unsigned char>(*p)))
+                ++p;
+            return p;
+        }
+
+#if defined(WEBSOCKET_HANDSHAKE_UPGRADE_X86)
+        // Byte ranges for PCMPESTRI, as picohttpparser does: every pair is
+        // an inclusive range of bytes to stop at
+        alignas(16) inline constexpr char value_ranges[16] = {'\x00', '\x1f', '\x7f', '\x7f'};
+        alignas(16) inline constexpr char name_ranges[16] = {'\x00', '\x20', ':', ':', '\x7f', '\x7f'};
+
+        __attribute__((target("sse4.2"))) inline char const *
+        find_ranges_sse42(char const *p, char const *end, char const *ranges, int ranges_size)
+        {
+            __m128i const r = _mm_load_si128(reinterpret_cast<__m128i const *>(ranges));
+            for (; end - p >= 16; p += 16)
+            {
+                __m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+                int const i = _mm_cmpestri(r, ranges_size, b, 16,
+                                           _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+                if (i != 16)
+                    return p + i;
+            }
+            return p;
+        }
+
+        __attribute__((target("sse4.2"))) inline char const *
+        value_end_sse42(char const *p, char const *end)
+        {
+            return value_end_scalar(find_ranges_sse42(p, end, value_ranges, 4), end);
+        }
+
+        __attribute__((target("sse4.2"))) inline char const *
+        name_end_sse42(char const *p, char const *end)
+        {
+            return name_end_scalar(find_ranges_sse42(p, end, name_ranges, 6), end);
+        }
+
+        // Bytes at or below 0x1f, by unsigned comparison
+        __attribute__((target("avx2"))) inline __m256i
+        controls_avx2(__m256i b)
+        {
+            return _mm256_cmpeq_epi8(_mm256_min_epu8(b, _mm256_set1_epi8(0x1f)), b);
+        }
+
+        __attribute__((target("avx2"))) inline char const *
+        value_end_avx2(char const *p, char const *end)
+        {
+            __m256i const del = _mm256_set1_epi8(0x7f);
+            for (; end - p >= 32; p += 32)
+            {
+                __m256i const b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+                __m256i const stop = _mm256_or_si256(controls_avx2(b), _mm256_cmpeq_epi8(b, del));
+                if (auto const m = static_cast<std::uint32_t>(_mm256_movemask_epi8(stop)))
+                    return p + std::countr_zero(m);
+            }
+            return value_end_scalar(p, end);
+        }
+
+        __attribute__((target("avx2"))) inline char const *
+        name_end_avx2(char const *p, char const *end)
+        {
+            __m256i const space = _mm256_set1_epi8(' ');
+            __m256i const colon = _mm256_set1_epi8(':');
+            __m256i const del = _mm256_set1_epi8(0x7f);
+            for (; end - p >= 32; p += 32)
+            {
+                __m256i const b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+                __m256i const stop = _mm256_or_si256(
+                _mm256_or_si256(controls_avx2(b), _mm256_cmpeq_epi8(b, space)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(b, colon), _mm256_cmpeq_epi8(b, del)));
+                if (auto const m = static_cast<std::uint32_t>(_mm256_movemask_epi8(stop)))
+                    return p + std::countr_zero(m);
+            }
+            return name_end_scalar(p, end);
+        }
+#endif
+
+        struct scanner
+        {
+            char const *name = nullptr;
+            scan_fn value_end = &value_end_scalar;
+            scan_fn name_end = &name_end_scalar;
+        };
+
+        inline scanner
+        select_scanner()
+        {
+#if defined(WEBSOCKET_HANDSHAKE_UPGRADE_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return {"avx2", &value_end_avx2, &name_end_avx2};
+            if (__builtin_cpu_supports("sse4.2"))
+                return {"sse4.2", &value_end_sse42, &name_end_sse42};
+#endif
+            return {"scalar", &value_end_scalar, &name_end_scalar};
+        }
+
+        inline scanner const &
+        active_scanner()
+        {
+            static scanner const s = select_scanner();
+            return s;
+        }
+
+        inline bool
+        iequals(std::string_view a, std::string_view b)
+        {
+            if (a.size() != b.size())
+                return false;
+            for (std::size_t i = 0; i < a.size(); ++i)
+                if ((a[i] | 0x20) != b[i])
+                    return false;
+            return true;
+        }
+
+        inline std::string_view
+        trim_ows(std::string_view s)
+        {
+            while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+                s.remove_suffix(1);
+            return s;
+        }
+
+        // A comma separated list of tokens with optional whitespace, as
+        // Beast requires of Connection
+        inline bool
+        is_token_list(std::string_view s)
+        {
+            while (!s.empty())
+            {
+                auto const comma = s.find(',');
+                auto item = s.substr(0, comma);
+                while (!item.empty() && (item.front() == ' ' || item.front() == '\t'))
+                    item.remove_prefix(1);
+                item = trim_ows(item);
+                for (unsigned char c : item)
+                    if (!tokens.ok[c])
+                        return false;
+                if (comma == s.npos)
+                    break;
+                s.remove_prefix(comma + 1);
+            }
+            return true;
+        }
+
+        // Keep `value` in `slot`, refusing a second occurrence, which the
+        // general parser would combine
+        inline bool
+        keep(std::string_view &slot, std::string_view value)
+        {
+            if (slot.data())
+                return false;
+            slot = value;
+            return true;
+        }
+    }// namespace detail
+
+    // Parse the start of `in` as a server's reply to the upgrade request
+    // using `s` to find the ends of names and values.
+    //
+    // Only the common shape is accepted: "HTTP/1.1 101", CRLF line ends,
+    // token field names, no obsolete line folding, no message body and
+    // each of the kept fields at most once. Everything else, including
+    // every malformed input, returns fallback without reading past `in`,
+    // so the caller can hand the bytes to a general HTTP parser.
+    //
+    // `on_field(name, value)` sees every field as it is parsed, and
+    // returning false from it falls back. A call that ends incomplete may
+    // already have reported some fields.
+    template<class OnField>
+    parse_result
+    parse_upgrade_response(std::string_view in, upgrade_response &out, detail::scanner const &s, OnField &&on_field)
+    {
+        using detail::iequals;
+
+        static constexpr std::string_view start = "HTTP/1.1 101 ";
+        out = {};
+        char const *const begin = in.data();
+        char const *const end = begin + in.size();
+        char const *p = begin;
+
+        // Status line
+        if (in.size() < start.size())
+            return in == start.substr(0, in.size()) ? parse_result::incomplete : parse_result::fallback;
+        if (in.substr(0, start.size()) != start)
+            return parse_result::fallback;
+        p += start.size();
+        char const *eol = s.value_end(p, end);
+        if (end - eol < 2)
+            return parse_result::incomplete;
+        if (eol[0] != '\r' || eol[1] != '\n')
+            return parse_result::fallback;
+        out.reason = std::string_view{p, static_cast<std::size_t>(eol - p)};
+        p = eol + 2;
+
+        for (;;)
+        {
+            if (p == end)
+                return parse_result::incomplete;
+            if (p[0] == '\r')
+            {
+                if (end - p < 2)
+                    return parse_result::incomplete;
+                if (p[1] != '\n')
+                    return parse_result::fallback;
+                out.size = static_cast<std::size_t>(p + 2 - begin);
+                return parse_result::complete;
+            }
+
+            // Name, then the colon right after it
+            char const *const name_end = s.name_end(p, end);
+            if (name_end == end)
+                return parse_result::incomplete;
+            if (name_end == p || *name_end != ':')
+                return parse_result::fallback;
+            std::string_view const name{p, static_cast<std::size_t>(name_end - p)};
+            for (unsigned char c : name)
+                if (!detail::tokens.ok[c])
+                    return parse_result::fallback;
+
+            // Value without the whitespace around it
+            p = name_end + 1;
+            while (p != end && (*p == ' ' || *p == '\t'))
+                ++p;
+            eol = s.value_end(p, end);
+            if (end - eol < 2)
+                return parse_result::incomplete;
+            if (eol[0] != '\r' || eol[1] != '\n')
+                return parse_result::fallback;
+            auto const value = detail::trim_ows(std::string_view{p, static_cast<std::size_t>(eol - p)});
+            p = eol + 2;
+            ++out.fields;
+
+            bool ok = true;
+            switch (name.size())
+            {
+            case 7:
+                if (iequals(name, "upgrade"))
+                    ok = detail::keep(out.upgrade, value);
+                break;
+            case 10:
+                if (iequals(name, "connection"))
+                    ok = detail::is_token_list(value) && detail::keep(out.connection, value);
+                break;
+            case 14:
+                ok = !iequals(name, "content-length") || value == "0";
+                break;
+            case 17:
+                ok = !iequals(name, "transfer-encoding");
+                break;
+            case 20:
+                if (iequals(name, "sec-websocket-accept"))
+                    ok = detail::keep(out.sec_accept, value);
+                break;
+            case 22:
+                if (iequals(name, "sec-websocket-protocol"))
+                    ok = detail::keep(out.subprotocol, value);
+                break;
+            case 24:
+                if (iequals(name, "sec-websocket-extensions"))
+                    ok = detail::keep(out.extensions, value);
+                break;
+            }
+            if (!ok || !on_field(name, value))
+                return parse_result::fallback;
+        }
+    }
+
+    inline parse_result
+    parse_upgrade_response(std::string_view in, upgrade_response &out, detail::scanner const &s)
+    {
+        return parse_upgrade_response(in, out, s, [](std::string_view, std::string_view) { return true; });
+    }
+
+    // As above, with the widest scanner the CPU supports
+    inline parse_result
+    parse_upgrade_response(std::string_view in, upgrade_response &out)
+    {
+        return parse_upgrade_response(in, out, detail::active_scanner());
+    }
+
+    inline char const *
+    upgrade_parser_kernel_name()
+    {
+        return detail::active_scanner().name;
+    }
+
+}// namespace protocol
+
+#endif
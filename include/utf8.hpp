@@ -0,0 +1,397 @@
+#ifndef WEBSOCKET_HANDSHAKE_UTF8_HPP
+#define WEBSOCKET_HANDSHAKE_UTF8_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WEBSOCKET_HANDSHAKE_UTF8_X86 1
+#endif
+
+namespace utf8 {
+
+    namespace detail {
+        // Vector state carried between calls: the previous 32 input bytes
+        // and whether they ended in the middle of a sequence.
+        struct simd_state
+        {
+            alignas(32) unsigned char prev[32] = {};
+            bool incomplete = false;
+            bool error = false;
+        };
+
+        // Processes `n` bytes, a multiple of 32
+        using blocks_fn = void (*)(simd_state &, unsigned char const *, std::size_t);
+
+        // Error classes of the lookup algorithm (Keiser and Lemire,
+        // "Validating UTF-8 In Less Than One Instruction Per Byte"). Each
+        // pair of adjacent bytes is classified by three 16-entry tables
+        // indexed by the high and low nibble of the first byte and the
+        // high nibble of the second; the AND of the three is non-zero
+        // only for invalid pairs.
+        constexpr unsigned char too_short = 1 << 0;
+        constexpr unsigned char too_long = 1 << 1;
+        constexpr unsigned char overlong_3 = 1 << 2;
+        constexpr unsigned char too_large = 1 << 3;
+        constexpr unsigned char surrogate = 1 << 4;
+        constexpr unsigned char overlong_2 = 1 << 5;
+        constexpr unsigned char too_large_1000 = 1 << 6;
+        constexpr unsigned char overlong_4 = 1 << 6;
+        constexpr unsigned char two_conts = 1 << 7;
+        constexpr unsigned char carry = too_short | too_long | two_conts;
+
+        alignas(16) constexpr unsigned char byte_1_high[16] = {
+        too_long, too_long, too_long, too_long,
+        too_long, too_long, too_long, too_long,
+        two_conts, two_conts, two_conts, two_conts,
+        too_short | overlong_2,
+        too_short,
+        too_short | overlong_3 | surrogate,
+        too_short | too_large | too_large_1000 | overlong_4};
+
+        alignas(16) constexpr unsigned char byte_1_low[16] = {
+        carry | overlong_3 | overlong_2 | overlong_4,
+        carry | overlong_2,
+        carry,
+        carry,
+        carry | too_large,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000 | surrogate,
+        carry | too_large | too_large_1000,
+        carry | too_large | too_large_1000};
+
+        alignas(16) constexpr unsigned char byte_2_high[16] = {
+        too_short, too_short, too_short, too_short,
+        too_short, too_short, too_short, too_short,
+        too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 | overlong_4,
+        too_long | overlong_2 | two_conts | overlong_3 | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_long | overlong_2 | two_conts | surrogate | too_large,
+        too_short, too_short, too_short, too_short};
+
+        // A vector's last bytes start a sequence that needs more input
+        // when the last byte is >= 0xc0, the second to last >= 0xe0 or the
+        // third to last >= 0xf0.
+        alignas(32) constexpr unsigned char incomplete_max[32] = {
+        255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 255, 255, 255,
+        255, 255, 255, 255, 255, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1};
+
+#if defined(WEBSOCKET_HANDSHAKE_UTF8_X86)
+        __attribute__((target("avx2"))) inline void
+        blocks_avx2(simd_state &st, unsigned char const *p, std::size_t n)
+        {
+            // The tables in both 128-bit lanes, as vpshufb works per lane
+            __m256i const t1h = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i const *>(byte_1_high)));
+            __m256i const t1l = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i const *>(byte_1_low)));
+            __m256i const t2h = _mm256_broadcastsi128_si256(_mm_load_si128(reinterpret_cast<__m128i const *>(byte_2_high)));
+            __m256i const nibble = _mm256_set1_epi8(0x0f);
+            __m256i const max = _mm256_load_si256(reinterpret_cast<__m256i const *>(incomplete_max));
+
+            __m256i prev_input = _mm256_load_si256(reinterpret_cast<__m256i const *>(st.prev));
+            __m256i error = _mm256_setzero_si256();
+            bool incomplete = st.incomplete;
+
+            for (; n >= 32; n -= 32, p += 32)
+            {
+                __m256i const input = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(p));
+                if (_mm256_movemask_epi8(input) == 0)
+                {
+                    // All ASCII: only a sequence left open before is wrong
+                    if (incomplete)
+                        error = _mm256_set1_epi8(1);
+                    incomplete = false;
+                    prev_input = input;
+                    continue;
+                }
+
+                // Bytes shifted in from the previous vector
+                __m256i const shuffled = _mm256_permute2x128_si256(prev_input, input, 0x21);
+                __m256i const prev1 = _mm256_alignr_epi8(input, shuffled, 15);
+                __m256i const prev2 = _mm256_alignr_epi8(input, shuffled, 14);
+                __m256i const prev3 = _mm256_alignr_epi8(input, shuffled, 13);
+
+                __m256i const b1h = _mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+                __m256i const b1l = _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nibble));
+                __m256i const b2h = _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+                __m256i const sc = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+                // Third and fourth bytes of a sequence must be continuations
+                __m256i const third = _mm256_subs_epu8(prev2, _mm256_set1_epi8(char(0xe0 - 0x80)));
+                __m256i const fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8(char(0xf0 - 0x80)));
+                __m256i const must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8(char(0x80)));
+                error = _mm256_or_si256(error, _mm256_xor_si256(must23, sc));
+
+                incomplete = !_mm256_testz_si256(_mm256_subs_epu8(input, max), _mm256_subs_epu8(input, max));
+                prev_input = input;
+            }
+
+            _mm256_store_si256(reinterpret_cast<__m256i *>(st.prev), prev_input);
+            st.incomplete = incomplete;
+            st.error = st.error || !_mm256_testz_si256(error, error);
+        }
+
+        __attribute__((target("ssse3"))) inline void
+        blocks_ssse3(simd_state &st, unsigned char const *p, std::size_t n)
+        {
+            __m128i const t1h = _mm_load_si128(reinterpret_cast<__m128i const *>(byte_1_high));
+            __m128i const t1l = _mm_load_si128(reinterpret_cast<__m128i const *>(byte_1_low));
+            __m128i const t2h = _mm_load_si128(reinterpret_cast<__m128i const *>(byte_2_high));
+            __m128i const nibble = _mm_set1_epi8(0x0f);
+            __m128i const max = _mm_load_si128(reinterpret_cast<__m128i const *>(incomplete_max + 16));
+
+            __m128i prev_input = _mm_load_si128(reinterpret_cast<__m128i const *>(st.prev + 16));
+            __m128i error = _mm_setzero_si128();
+            bool incomplete = st.incomplete;
+
+            for (; n >= 16; n -= 16, p += 16)
+            {
+                __m128i const input = _mm_loadu_si128(reinterpret_cast<__m128i const *>(p));
+                if (_mm_movemask_epi8(input) == 0)
+                {
+                    if (incomplete)
+                        error = _mm_set1_epi8(1);
+                    incomplete = false;
+                    prev_input = input;
+                    continue;
+                }
+
+                __m128i const prev1 = _mm_alignr_epi8(input, prev_input, 15);
+                __m128i const prev2 = _mm_alignr_epi8(input, prev_input, 14);
+                __m128i const prev3 = _mm_alignr_epi8(input, prev_input, 13);
+
+                __m128i const b1h = _mm_shuffle_epi8(t1h, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+                __m128i const b1l = _mm_shuffle_epi8(t1l, _mm_and_si128(prev1, nibble));
+                __m128i const b2h = _mm_shuffle_epi8(t2h, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+                __m128i const sc = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+                __m128i const third = _mm_subs_epu8(prev2, _mm_set1_epi8(char(0xe0 - 0x80)));
+                __m128i const fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(char(0xf0 - 0x80)));
+                __m128i const must23 = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8(char(0x80)));
+                error = _mm_or_si128(error, _mm_xor_si128(must23, sc));
+
+                incomplete = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(input, max), _mm_setzero_si128())) != 0xffff;
+                prev_input = input;
+            }
+
+            // Keep the layout of the 32-byte state: last input in the top half
+            _mm_store_si128(reinterpret_cast<__m128i *>(st.prev + 16), prev_input);
+            st.incomplete = incomplete;
+            st.error = st.error || _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xffff;
+        }
+#endif
+
+        inline blocks_fn
+        select_kernel(char const *&name)
+        {
+#if defined(WEBSOCKET_HANDSHAKE_UTF8_X86)
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+            {
+                name = "avx2";
+                return &blocks_avx2;
+            }
+            if (__builtin_cpu_supports("ssse3"))
+            {
+                name = "ssse3";
+                return &blocks_ssse3;
+            }
+#endif
+            name = "scalar";
+            return nullptr;
+        }
+
+        struct kernel
+        {
+            char const *name = nullptr;
+            blocks_fn fn = select_kernel(name);
+        };
+
+        inline kernel const &
+        active_kernel()
+        {
+            static kernel const k;
+            return k;
+        }
+    }// namespace detail
+
+    // Byte-at-a-time validator following table 3-7 of the Unicode
+    // standard, with an eight byte ASCII fast path. Used when the CPU has
+    // no suitable vector unit.
+    class scalar_validator
+    {
+    public:
+        bool
+        write(void const *data, std::size_t n)
+        {
+            auto p = static_cast<unsigned char const *>(data);
+            auto const end = p + n;
+            while (p != end && !error_)
+            {
+                if (need_ == 0)
+                {
+                    // Skip ASCII eight bytes at a time
+                    while (end - p >= 8)
+                    {
+                        std::uint64_t v;
+                        std::memcpy(&v, p, 8);
+                        if (v & 0x8080808080808080ull)
+                            break;
+                        p += 8;
+                    }
+                    if (p == end)
+                        break;
+                    unsigned char const b = *p++;
+                    if (b < 0x80)
+                        continue;
+                    lo_ = 0x80;
+                    hi_ = 0xbf;
+                    if (b >= 0xc2 && b <= 0xdf)
+                        need_ = 1;
+                    else if (b >= 0xe0 && b <= 0xef)
+                    {
+                        need_ = 2;
+                        if (b == 0xe0)
+                            lo_ = 0xa0;
+                        else if (b == 0xed)
+                            hi_ = 0x9f;
+                    }
+                    else if (b >= 0xf0 && b <= 0xf4)
+                    {
+                        need_ = 3;
+                        if (b == 0xf0)
+                            lo_ = 0x90;
+                        else if (b == 0xf4)
+                            hi_ = 0x8f;
+                    }
+                    else
+                        error_ = true;
+                    continue;
+                }
+                unsigned char const b = *p++;
+                if (b < lo_ || b > hi_)
+                    error_ = true;
+                --need_;
+                lo_ = 0x80;
+                hi_ = 0xbf;
+            }
+            return !error_;
+        }
+
+        bool
+        finish()
+        {
+            bool const ok = !error_ && need_ == 0;
+            *this = scalar_validator{};
+            return ok;
+        }
+
+    private:
+        unsigned char lo_ = 0x80;
+        unsigned char hi_ = 0xbf;
+        int need_ = 0;
+        bool error_ = false;
+    };
+
+    // Incremental UTF-8 validator for text messages.
+    //
+    // Feed the payload of each fragment to write() as it arrives and call
+    // finish() at the end of the message. Whole 32-byte blocks go through
+    // the vector kernel picked at runtime; shorter pieces are staged until
+    // a block is full. write() returns false once the input so far cannot
+    // be valid, which may be up to one block after the offending byte.
+    class validator
+    {
+    public:
+        validator() = default;
+
+        // Use a specific block kernel, or the scalar code when null
+        explicit validator(detail::blocks_fn fn)
+            : fn_(fn)
+        {
+        }
+
+        bool
+        write(void const *data, std::size_t n)
+        {
+            auto const fn = fn_;
+            if (!fn)
+                return scalar_.write(data, n);
+            if (state_.error)
+                return false;
+
+            auto p = static_cast<unsigned char const *>(data);
+            if (staged_)
+            {
+                std::size_t const take = n < 32 - staged_ ? n : 32 - staged_;
+                std::memcpy(stage_ + staged_, p, take);
+                staged_ += take;
+                p += take;
+                n -= take;
+                if (staged_ < 32)
+                    return true;
+                fn(state_, stage_, 32);
+                staged_ = 0;
+            }
+            std::size_t const whole = n & ~std::size_t{31};
+            if (whole)
+                fn(state_, p, whole);
+            std::memcpy(stage_, p + whole, n - whole);
+            staged_ = n - whole;
+            return !state_.error;
+        }
+
+        // True when everything written forms complete, valid UTF-8. Resets
+        // the validator for the next message.
+        bool
+        finish()
+        {
+            auto const fn = fn_;
+            if (!fn)
+                return scalar_.finish();
+
+            // Pad with ASCII so an open sequence shows up as too short
+            std::memset(stage_ + staged_, 0, 32 - staged_);
+            fn(state_, stage_, 32);
+            bool const ok = !state_.error && !state_.incomplete;
+            state_ = detail::simd_state{};
+            staged_ = 0;
+            return ok;
+        }
+
+    private:
+        detail::blocks_fn fn_ = detail::active_kernel().fn;
+        detail::simd_state state_;
+        alignas(32) unsigned char stage_[32];
+        std::size_t staged_ = 0;
+        scalar_validator scalar_;
+    };
+
+    // Validate a complete buffer
+    inline bool
+    validate(void const *data, std::size_t n)
+    {
+        validator v;
+        v.write(data, n);
+        return v.finish();
+    }
+
+    inline char const *
+    kernel_name()
+    {
+        return detail::active_kernel().name;
+    }
+
+}// namespace utf8
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef WEBSOCKET_HANDSHAKE_WORK_STEALING_HPP
+#define WEBSOCKET_HANDSHAKE_WORK_STEALING_HPP
+
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/execution/outstanding_work.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/beast/core/bind_handler.hpp>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace runtime {
+    namespace net = boost::asio;
+    namespace beast = boost::beast;
+
+    struct stealing_stats
+    {
+        std::size_t executed = 0;
+
+        // Tasks run by a worker other than the one they were queued on
+        std::size_t stolen = 0;
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, stealing_stats const &s)
+    {
+        return os << "executed=" << s.executed
+                  << " stolen=" << s.stolen;
+    }
+
+    // Worker threads for CPU-bound work, with one task deque each.
+    //
+    // A task goes to the deque its submitter maps to: each submitting
+    // thread has a home deque, or the caller passes a hint such as a
+    // connection id so one connection's work stays together. The owner
+    // takes its newest task first, while it is still warm in cache; a
+    // worker whose deque is empty takes the oldest task from another
+    // deque instead of sleeping, so a few hot connections can no longer
+    // keep one core busy while the others idle.
+    //
+    // Deques are guarded by a mutex each. Tasks here are parsing or
+    // decompressing whole messages, long enough that an uncontended lock
+    // per task is noise.
+    class work_stealing_pool
+    {
+    public:
+        explicit work_stealing_pool(std::size_t threads = 0)
+        {
+            if (threads == 0)
+                threads = (std::max)(1u, std::thread::hardware_concurrency());
+            for (std::size_t i = 0; i < threads; ++i)
+                queues_.push_back(std::make_unique<queue>());
+            for (std::size_t i = 0; i < threads; ++i)
+                threads_.emplace_back([this, i] { work(i); });
+        }
+
+        work_stealing_pool(work_stealing_pool const &) = delete;
+        work_stealing_pool &operator=(work_stealing_pool const &) = delete;
+
+        // Runs the queued tasks, then joins the workers
+        ~work_stealing_pool()
+        {
+            {
+                std::lock_guard lock{sleep_mutex_};
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            for (auto &t : threads_)
+                t.join();
+        }
+
+        std::size_t
+        size() const noexcept
+        {
+            return queues_.size();
+        }
+
+        stealing_stats
+        stats() const noexcept
+        {
+            return {executed_.load(std::memory_order_relaxed), stolen_.load(std::memory_order_relaxed)};
+        }
+
+        // Queue `f()` on the deque for `hint`
+        template<class F>
+        void
+        submit(F f, std::size_t hint)
+        {
+            auto &q = *queues_[hint % queues_.size()];
+            // Counted before the task is published, so the worker that
+            // takes it, through the deque's mutex, always sees the count
+            // and its decrement never takes it below zero
+            pending_.fetch_add(1, std::memory_order_release);
+            {
+                std::lock_guard lock{q.mutex};
+                q.tasks.push_back(std::make_unique<task_impl<F>>(std::move(f)));
+            }
+            {
+                // Pairs with the check under the lock in work()
+                std::lock_guard lock{sleep_mutex_};
+            }
+            wake_.notify_one();
+        }
+
+        // Queue `f()` on the calling thread's home deque
+        template<class F>
+        void
+        submit(F f)
+        {
+            thread_local std::size_t const home = next_home_.fetch_add(1, std::memory_order_relaxed);
+            submit(std::move(f), home);
+        }
+
+    private:
+        struct task
+        {
+            virtual ~task() = default;
+            virtual void run() = 0;
+        };
+
+        template<class F>
+        struct task_impl final : task
+        {
+            explicit task_impl(F f)
+                : f(std::move(f))
+            {
+            }
+
+            void
+            run() override
+            {
+                f();
+            }
+
+            F f;
+        };
+
+        using task_ptr = std::unique_ptr<task>;
+
+        struct queue
+        {
+            std::mutex mutex;
+            std::deque<task_ptr> tasks;
+        };
+
+        task_ptr
+        pop(std::size_t self)
+        {
+            auto &q = *queues_[self];
+            std::lock_guard lock{q.mutex};
+            if (q.tasks.empty())
+                return nullptr;
+            auto t = std::move(q.tasks.back());
+            q.tasks.pop_back();
+            return t;
+        }
+
+        task_ptr
+        steal(std::size_t self)
+        {
+            for (std::size_t k = 1; k < queues_.size(); ++k)
+            {
+                auto &q = *queues_[(self + k) % queues_.size()];
+                std::lock_guard lock{q.mutex};
+                if (q.tasks.empty())
+                    continue;
+                auto t = std::move(q.tasks.front());
+                q.tasks.pop_front();
+                return t;
+            }
+            return nullptr;
+        }
+
+        void
+        work(std::size_t self)
+        {
+            for (;;)
+            {
+                bool stolen = false;
+                task_ptr t = pop(self);
+                if (!t)
+                {
+                    t = steal(self);
+                    stolen = t != nullptr;
+                }
+                if (t)
+                {
+                    pending_.fetch_sub(1, std::memory_order_relaxed);
+                    t->run();
+                    executed_.fetch_add(1, std::memory_order_relaxed);
+                    if (stolen)
+                        stolen_.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                std::unique_lock lock{sleep_mutex_};
+                if (pending_.load(std::memory_order_acquire) != 0)
+                    continue;
+                if (stopping_)
+                    return;
+                wake_.wait(lock);
+            }
+        }
+
+        std::vector<std::unique_ptr<queue>> queues_;
+        std::vector<std::thread> threads_;
+        std::mutex sleep_mutex_;
+        std::condition_variable wake_;
+        std::atomic<std::size_t> pending_{0};
+        std::atomic<std::size_t> executed_{0};
+        std::atomic<std::size_t> stolen_{0};
+        std::atomic<std::size_t> next_home_{0};
+        bool stopping_ = false;
+    };
+
+    namespace detail {
+        template<class R>
+        struct offload_signature
+        {
+            using type = void(std::exception_ptr, R);
+        };
+
+        template<>
+        struct offload_signature<void>
+        {
+            using type = void(std::exception_ptr);
+        };
+    }// namespace detail
+
+    // Run `f()` on the work-stealing pool and complete on the caller's
+    // executor with its result, or the exception it threw. The socket
+    // stays with its io_context; only the computation moves.
+    //
+    //     auto doc = co_await runtime::offload(pool, [&] { return parse(msg); },
+    //                                          net::use_awaitable);
+    template<class F, class CompletionToken>
+    auto
+    offload(work_stealing_pool &pool, F f, CompletionToken &&token, std::size_t hint = std::size_t(-1))
+    {
+        using result = std::invoke_result_t<F &>;
+        using signature = typename detail::offload_signature<result>::type;
+        return net::async_initiate<CompletionToken, signature>(
+        [&pool, hint](auto handler, F f) {
+            // Keep the caller's context alive until the result is posted back
+            auto ex = net::prefer(net::get_associated_executor(handler),
+                                  net::execution::outstanding_work.tracked);
+            auto job = [handler = std::move(handler), f = std::move(f), ex]() mutable {
+                std::exception_ptr e;
+                if constexpr (std::is_void_v<result>)
+                {
+                    try
+                    {
+                        f();
+                    } catch (...)
+                    {
+                        e = std::current_exception();
+                    }
+                    net::post(ex, beast::bind_front_handler(std::move(handler), e));
+                }
+                else
+                {
+                    result r{};
+                    try
+                    {
+                        r = f();
+                    } catch (...)
+                    {
+                        e = std::current_exception();
+                    }
+                    net::post(ex, beast::bind_front_handler(std::move(handler), e, std::move(r)));
+                }
+            };
+            if (hint == std::size_t(-1))
+                pool.submit(std::move(job));
+            else
+                pool.submit(std::move(job), hint);
+        },
+        token, std::move(f));
+    }
+
+}// namespace runtime
+
+#endif
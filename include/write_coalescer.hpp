@@ -0,0 +1,167 @@
+#ifndef WEBSOCKET_HANDSHAKE_WRITE_COALESCER_HPP
+#define WEBSOCKET_HANDSHAKE_WRITE_COALESCER_HPP
+
+#include "buffer_pool.hpp"
+#include "frame_writer.hpp"
+#include "handler_memory.hpp"
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+#include <cstddef>
+#include <ostream>
+#include <utility>
+
+namespace frame {
+
+    struct coalescer_stats
+    {
+        std::size_t messages = 0;
+        std::size_t writes = 0;
+        std::size_t bytes = 0;
+
+        // Messages carried by each write on the stream
+        double
+        batching_factor() const
+        {
+            return writes ? double(messages) / double(writes) : 0.0;
+        }
+    };
+
+    inline std::ostream &
+    operator<<(std::ostream &os, coalescer_stats const &s)
+    {
+        return os << "messages=" << s.messages
+                  << " writes=" << s.writes
+                  << " bytes=" << s.bytes
+                  << " batching=" << s.batching_factor();
+    }
+
+    // Per-connection outbound queue that packs small messages together.
+    //
+    // push() encodes a message into the pending batch right away, so the
+    // caller's payload can go out of scope. A flush hands the whole batch
+    // to the stream in one write: on a beast::ssl_stream that is one
+    // SSL_write, so up to 16 KiB of frames share a TLS record, and one
+    // send on the socket. Masking already copies every payload, so frames
+    // are laid out back to back in one pooled buffer rather than passed as
+    // a scatter list that flat_stream would linearize again.
+    //
+    // The frames go out as they are, so `Stream` is a byte stream the
+    // caller owns outright, such as the transport under the sans-I/O core.
+    // Between flushes the core may write its own output to it, but nothing
+    // may write while a flush is running. Never pass the next layer of a
+    // live websocket::stream.
+    template<class Stream>
+    class coalescing_writer
+    {
+    public:
+        // Batches reaching this size are flushed by push()
+        static constexpr std::size_t default_max_batch = 64 * 1024;
+
+        explicit coalescing_writer(Stream &s,
+                                   message_options mo = {},
+                                   std::size_t max_batch = default_max_batch)
+            : s_(s)
+            , mo_(std::move(mo))
+            , max_batch_(max_batch)
+        {
+        }
+
+        // Frames waiting for a flush, in bytes
+        std::size_t
+        pending() const noexcept
+        {
+            return pending_.size();
+        }
+
+        coalescer_stats const &
+        stats() const noexcept
+        {
+            return stats_;
+        }
+
+        // Queue a message. Returns true when the batch is full and should
+        // be flushed.
+        bool
+        push(net::const_buffer payload)
+        {
+            message_encoder enc{payload, mo_};
+            enc.encode(pending_);
+            ++queued_;
+            return pending_.size() >= max_batch_;
+        }
+
+        // Queue frames that are already encoded, such as the output of a
+        // sans-I/O core, to go out in the same write as the messages
+        void
+        append(net::const_buffer frames)
+        {
+            net::buffer_copy(pending_.prepare(frames.size()), frames);
+            pending_.commit(frames.size());
+        }
+
+        // Write every pending frame with a single write
+        std::size_t
+        flush()
+        {
+            if (!pending_.size())
+                return 0;
+            std::size_t const n = net::write(s_, pending_.data());
+            account(n, std::exchange(queued_, 0));
+            pending_.clear();
+            return n;
+        }
+
+        // Write pending frames until the queue is empty. Messages pushed
+        // while a write is in flight go out together in the next one. When
+        // a flush is already running this returns at once, as that flush
+        // will pick up the new frames.
+        net::awaitable<void>
+        async_flush()
+        {
+            if (writing_)
+                co_return;
+            writing_ = true;
+            try
+            {
+                while (pending_.size())
+                {
+                    std::swap(pending_, inflight_);
+                    std::size_t const messages = std::exchange(queued_, 0);
+                    std::size_t const n = co_await net::async_write(
+                    s_, inflight_.data(), memory::use_recycled_awaitable);
+                    account(n, messages);
+                    inflight_.clear();
+                }
+            } catch (...)
+            {
+                writing_ = false;
+                throw;
+            }
+            writing_ = false;
+        }
+
+    private:
+        void
+        account(std::size_t n, std::size_t messages)
+        {
+            stats_.messages += messages;
+            ++stats_.writes;
+            stats_.bytes += n;
+        }
+
+        Stream &s_;
+        message_options mo_;
+        std::size_t max_batch_;
+        buffers::pooled_buffer pending_;
+        buffers::pooled_buffer inflight_;
+        std::size_t queued_ = 0;
+        bool writing_ = false;
+        coalescer_stats stats_;
+    };
+
+}// namespace frame
+
+#endif
@@ -0,0 +1,197 @@
+//
+// Test: size-classed buffer pool and pooled_buffer
+//
+// Blocks must come back on the free list of their class, and the pool
+// must keep no more than its byte budget idle. A pooled_buffer must keep
+// its readable bytes intact, and prepare() in bounds, across every kind
+// of growth: reclaiming the consumed prefix, copying into a larger class
+// and remapping a mapped block, in place or at a new address.
+//
+
+#include "buffer_pool.hpp"
+#include "check.hpp"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+#include <cstddef>
+#include <stdexcept>
+
+namespace net = boost::asio;
+using test::check;
+
+// Write bytes first, first + 1, ... into `b`
+static void
+fill(net::mutable_buffer b, std::size_t first)
+{
+    auto *p = static_cast<unsigned char *>(b.data());
+    for (std::size_t i = 0; i < b.size(); ++i)
+        p[i] = static_cast<unsigned char>(first + i);
+}
+
+static bool
+filled(net::const_buffer b, std::size_t first)
+{
+    auto const *p = static_cast<unsigned char const *>(b.data());
+    for (std::size_t i = 0; i < b.size(); ++i)
+        if (p[i] != static_cast<unsigned char>(first + i))
+            return false;
+    return true;
+}
+
+static void
+test_classes()
+{
+    using buffers::pool;
+    check(pool::class_for(1) == 0, "smallest class");
+    check(pool::class_for(512) == 0, "512 bytes fit the first class");
+    check(pool::class_for(513) == 1, "513 bytes need the second class");
+    check(pool::class_for(std::size_t{16} << 20) == pool::class_count - 1, "16 MiB is the last class");
+    check(pool::class_for((std::size_t{16} << 20) + 1) == -1, "beyond 16 MiB has no class");
+}
+
+static void
+test_reuse()
+{
+    buffers::pool p;
+    auto a = p.acquire(1000);
+    check(a.size == 1024 && a.cls == 1, "acquire rounds up to its class");
+    p.release(a);
+    auto b = p.acquire(700);
+    check(b.data == a.data, "released block is reused");
+    check(p.stats().hits == 1, "reuse counted as a hit");
+    p.release(b);
+
+    // More blocks than a class keeps
+    buffers::block blocks[buffers::pool::max_cached_per_class + 2];
+    for (auto &blk : blocks)
+        blk = p.acquire(512);
+    for (auto &blk : blocks)
+        p.release(blk);
+    check(p.stats().trimmed == 2, "blocks past the class limit are freed");
+}
+
+static void
+test_byte_budget()
+{
+    // Two 16 MiB blocks fit the class limit for mapped blocks, but not
+    // the bytes the pool may keep idle
+    buffers::pool p;
+    auto a = p.acquire(std::size_t{16} << 20);
+    auto b = p.acquire(std::size_t{16} << 20);
+    p.release(a);
+    p.release(b);
+    check(p.stats().trimmed == 1, "idle bytes stay within max_cached_bytes");
+}
+
+static void
+test_reclaim_prefix()
+{
+    buffers::pooled_buffer buf;
+    fill(buf.prepare(400), 0);
+    buf.commit(400);
+    buf.consume(300);
+    auto const cap = buf.capacity();
+
+    // Fits only once the consumed 300 bytes are reclaimed
+    auto mb = buf.prepare(cap - 150);
+    check(buf.capacity() == cap, "prefix reclaimed without growing");
+    check(buf.size() == 100 && filled(buf.data(), 300), "readable bytes moved to the front");
+    check(mb.size() == cap - 150, "prepare returns what was asked");
+}
+
+static void
+test_grow_copied()
+{
+    buffers::pooled_buffer buf;
+    fill(buf.prepare(1000), 0);
+    buf.commit(1000);
+    buf.consume(10);
+    auto mb = buf.prepare(5000);
+    check(mb.size() == 5000, "prepare after a copying grow");
+    check(buf.size() == 990 && filled(buf.data(), 10), "bytes kept across a copying grow");
+    fill(mb, 1000);
+    buf.commit(5000);
+    check(filled(buf.data(), 10), "new bytes follow the old ones");
+}
+
+static void
+test_grow_remapped()
+{
+    // Start in a mapped class with a consumed prefix, then grow past it.
+    // The block is remapped with the data at its old offset, and the new
+    // class leaves too little room after it, so the data must move;
+    // prepare() asserts that the range it hands out stays in the block.
+    std::size_t const first = std::size_t{1} << buffers::pool::mmap_shift;
+    buffers::pooled_buffer buf;
+    fill(buf.prepare(first), 0);
+    buf.commit(first);
+    buf.consume(first / 2);
+    std::size_t const ask = 3 * first + first / 8;
+    auto mb = buf.prepare(ask);
+    check(mb.size() == ask, "prepare after a remapping grow");
+    check(buf.capacity() >= buf.size() + ask, "block holds the data and the prepared range");
+    check(static_cast<char *>(mb.data()) == static_cast<char const *>(buf.data().data()) + buf.size(),
+          "prepared range follows the readable bytes");
+    check(buf.size() == first / 2 && filled(buf.data(), first / 2), "bytes kept across a remapping grow");
+    fill(mb, first);
+    buf.commit(ask);
+    check(buf.size() == first / 2 + ask && filled(buf.data(), first / 2), "whole range readable after commit");
+}
+
+#if defined(__linux__)
+static void
+test_grow_moved()
+{
+    // A page mapped right after the block keeps mremap() from growing it
+    // where it is, so the grow is a move and must be counted as one
+    std::size_t const first = std::size_t{1} << buffers::pool::mmap_shift;
+    buffers::pooled_buffer buf;
+    fill(buf.prepare(first), 0);
+    buf.commit(first);
+    auto *const end = static_cast<char *>(const_cast<void *>(buf.data().data())) + first;
+    void *guard = ::mmap(end, 4096, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+    auto const before = buffers::pool::local().stats();
+    buf.prepare(first);
+    auto const after = buffers::pool::local().stats();
+    check(after.grows_moved == before.grows_moved + 1 && after.grows_in_place == before.grows_in_place,
+          "a remap to a new address is counted as moved");
+    check(buf.size() == first && filled(buf.data(), 0), "bytes kept across a moving grow");
+    if (guard != MAP_FAILED)
+        ::munmap(guard, 4096);
+}
+#endif
+
+static void
+test_limit()
+{
+    buffers::pooled_buffer buf{1000};
+    buf.commit(buf.prepare(600).size());
+    bool threw = false;
+    try
+    {
+        buf.prepare(500);
+    } catch (std::length_error const &)
+    {
+        threw = true;
+    }
+    check(threw, "prepare beyond max_size throws");
+}
+
+int
+main()
+{
+    test_classes();
+    test_reuse();
+    test_byte_budget();
+    test_reclaim_prefix();
+    test_grow_copied();
+    test_grow_remapped();
+#if defined(__linux__)
+    test_grow_moved();
+#endif
+    test_limit();
+    return test::result("buffer_pool");
+}
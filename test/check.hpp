@@ -0,0 +1,37 @@
+//
+// Checks shared by the tests
+//
+// A failed check is printed and counted, and the test carries on so that
+// one run shows every failure. main() returns test::result().
+//
+
+#ifndef WEBSOCKET_HANDSHAKE_TEST_CHECK_HPP
+#define WEBSOCKET_HANDSHAKE_TEST_CHECK_HPP
+
+#include <cstdio>
+
+namespace test {
+    inline int failures = 0;
+
+    inline void
+    check(bool ok, char const *what)
+    {
+        if (!ok)
+        {
+            std::fprintf(stderr, "FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    // The exit status, after saying `name` passed if it did
+    inline int
+    result(char const *name)
+    {
+        if (failures)
+            return 1;
+        std::printf("%s: ok\n", name);
+        return 0;
+    }
+}// namespace test
+
+#endif
@@ -0,0 +1,153 @@
+//
+// Test: compact handshake response
+//
+// The perfect hash must place every known field name and reject every
+// other one Beast knows. Lookups must agree with Beast's response for
+// known and unknown names in any case, and nothing may be lost when a
+// reply outgrows the inline bytes or field slots and spills to the heap.
+//
+
+#include "compact_response.hpp"
+#include "check.hpp"
+
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/beast/http/write.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace http = boost::beast::http;
+using test::check;
+
+static std::string
+upper(std::string_view s)
+{
+    std::string u{s};
+    for (auto &c : u)
+        if (c >= 'a' && c <= 'z')
+            c = static_cast<char>(c - 'a' + 'A');
+    return u;
+}
+
+static void
+test_perfect_hash()
+{
+    using namespace protocol::detail;
+    bool placed = true;
+    for (std::size_t i = 0; i < known_count; ++i)
+        placed = placed && known_index(known_names[i]) == static_cast<int>(i) &&
+                 known_index(upper(known_names[i])) == static_cast<int>(i);
+    check(placed, "every known name has its own slot, in any case");
+
+    // Every other name Beast knows misses, whatever slot it hashes to
+    bool rejected = true;
+    for (unsigned f = 1; f <= static_cast<unsigned>(http::field::xref); ++f)
+    {
+        auto const name = http::to_string(static_cast<http::field>(f));
+        bool const known = std::find_if(std::begin(known_names), std::end(known_names), [&](std::string_view k) {
+                               return equal_names(k, name);
+                           }) != std::end(known_names);
+        rejected = rejected && (known_index(name) >= 0) == known;
+    }
+    check(rejected, "names outside the table are not found");
+    check(known_index("") == -1 && known_index("upgradf") == -1 && known_index("sec-websocket-acceps") == -1,
+          "near misses are not found");
+}
+
+static void
+test_lookup()
+{
+    protocol::compact_response r;
+    r.insert("Upgrade", "websocket");
+    r.insert("CONNECTION", "Upgrade");
+    r.insert("X-Served-By", "cache-fra");
+    r.insert("Set-Cookie", "a=1");
+    r.insert("set-cookie", "b=2");
+    r.insert("x-served-by", "second");
+
+    check(r["upgrade"] == "websocket" && r[http::field::connection] == "Upgrade", "known fields in any case");
+    check(r["X-SERVED-BY"] == "cache-fra", "unknown field found by scan");
+    check(r[http::field::set_cookie] == "a=1", "first of a repeated known field");
+    check(r["x-served-by"] == "cache-fra", "first of a repeated unknown field");
+    check(!r.has(http::field::sec_websocket_accept) && r[http::field::sec_websocket_accept].empty(), "absent known field");
+    check(!r.has("X-Missing") && r["X-Missing"].empty(), "absent unknown field");
+    check(r.size() == 6 && !r.spilled(), "a small reply stays inline");
+
+    std::vector<std::string_view> names;
+    for (auto const &f : r)
+        names.push_back(f.name_string());
+    check(names == std::vector<std::string_view>{"Upgrade", "CONNECTION", "X-Served-By", "Set-Cookie", "set-cookie", "x-served-by"},
+          "fields kept in arrival order with their spelling");
+
+    r.clear();
+    check(r.size() == 0 && !r.has(http::field::upgrade) && !r.has("X-Served-By"), "clear forgets every field");
+    r.insert("Upgrade", "h2c");
+    check(r[http::field::upgrade] == "h2c", "storage reused after clear");
+}
+
+static void
+test_spill()
+{
+    // Four slots and 64 inline bytes: most of this reply goes to the heap
+    protocol::basic_compact_response<64, 4> r;
+    r.reason(std::string(40, 'r'));
+    std::vector<std::pair<std::string, std::string>> fields;
+    for (int i = 0; i < 10; ++i)
+        fields.emplace_back("X-Field-" + std::to_string(i), std::string(10 + i, static_cast<char>('a' + i)));
+    fields.emplace_back("Sec-WebSocket-Accept", "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+    fields.emplace_back("Via", "1.1 edge");
+    for (auto const &[name, value] : fields)
+        r.insert(name, value);
+
+    check(r.spilled() && r.size() == fields.size(), "reply past the inline storage spills");
+    check(r.reason() == std::string(40, 'r'), "reason kept");
+    bool ok = true;
+    std::size_t i = 0;
+    for (auto const &f : r)
+    {
+        ok = ok && f.name_string() == fields[i].first && f.value() == fields[i].second;
+        ++i;
+    }
+    check(ok && i == fields.size(), "every field intact and in order across the spill");
+    check(r[http::field::sec_websocket_accept] == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=" && r["via"] == "1.1 edge",
+          "known fields found beyond the inline slots");
+    check(r["x-field-9"] == fields[9].second, "unknown field found beyond the inline slots");
+}
+
+static void
+test_assign()
+{
+    http::response<http::string_body> res{http::status::forbidden, 11};
+    res.reason("Go Away");
+    res.set(http::field::server, "Boost.Beast");
+    res.set(http::field::content_type, "text/plain");
+    res.insert("X-Trace", "abc");
+    res.body() = "nope";
+    res.prepare_payload();
+
+    protocol::compact_response r;
+    r.assign(res);
+    check(r.result() == http::status::forbidden && r.version() == 11 && r.reason() == "Go Away", "status line copied");
+    check(r[http::field::content_length] == "4" && r["x-trace"] == "abc" && r.body() == "nope", "fields and body copied");
+
+    std::ostringstream ours, theirs;
+    ours << r;
+    theirs << res;
+    check(ours.str() == theirs.str(), "printed like Beast's response");
+}
+
+int
+main()
+{
+    test_perfect_hash();
+    test_lookup();
+    test_spill();
+    test_assign();
+    return test::result("compact_response");
+}
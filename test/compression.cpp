@@ -0,0 +1,66 @@
+//
+// Test: permessage-deflate negotiation
+//
+// A server may reply with client_max_window_bits=8, which zlib cannot
+// deflate with. The extension still holds, so we send uncompressed but
+// must keep inflating whatever the server compressed.
+//
+
+#include "protocol.hpp"
+#include "check.hpp"
+
+#include <string_view>
+
+namespace net = boost::asio;
+namespace websocket = boost::beast::websocket;
+using error_code = boost::beast::error_code;
+using test::check;
+
+static void
+test_window_bits_8()
+{
+    compression::options offer;
+    offer.window_bits = 9;
+    auto const o = compression::accepted(
+    "permessage-deflate; server_no_context_takeover; client_max_window_bits=8", offer);
+    check(!o.enable, "no outbound compression at window 8");
+    check(o.inflate, "inbound inflate stays on at window 8");
+
+    // "Hello" compressed by the server, RFC 7692 section 7.2.3.1
+    unsigned char const frame[] = {0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00};
+    protocol::connection c{{.deflate = o}};
+    c.receive(net::buffer(frame));
+    error_code ec;
+    auto const e = c.next(ec);
+    check(!ec, "compressed frame accepted");
+    check(e.kind == protocol::event_kind::message, "message event");
+    std::string_view const text{static_cast<char const *>(e.payload.data()), e.payload.size()};
+    check(text == "Hello", "message inflated");
+
+    // Our own messages go out without RSV1
+    c.send(net::buffer(std::string_view{"Hello"}));
+    auto const *out = static_cast<unsigned char const *>(c.output().data());
+    check(c.output().size() && !(out[0] & 0x40), "outbound message not compressed");
+}
+
+static void
+test_declined()
+{
+    auto const o = compression::accepted("", compression::options{});
+    check(!o.enable && !o.inflate, "declined extension is off both ways");
+
+    unsigned char const frame[] = {0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00};
+    protocol::connection c{{.deflate = o}};
+    c.receive(net::buffer(frame));
+    error_code ec;
+    c.next(ec);
+    check(ec == websocket::error::bad_reserved_bits, "RSV1 rejected without the extension");
+}
+
+int
+main()
+{
+    test_window_bits_8();
+    test_declined();
+    return test::result("compression");
+}
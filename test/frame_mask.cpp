@@ -0,0 +1,127 @@
+//
+// Test: client frame masking kernels
+//
+// Every kernel must match the byte-at-a-time reference for any length,
+// either buffer's alignment and every key phase, in place or not, and a
+// payload masked in pieces must match one masked in one go.
+//
+
+#include "frame_mask.hpp"
+#include "check.hpp"
+
+#include <cstring>
+#include <random>
+#include <vector>
+
+using test::check;
+
+struct candidate
+{
+    char const *name;
+    frame::mask_fn fn;
+};
+
+static std::vector<candidate>
+candidates()
+{
+    std::vector<candidate> v{{"scalar", &frame::detail::mask_scalar}};
+#if defined(WEBSOCKET_HANDSHAKE_X86)
+    if (__builtin_cpu_supports("sse2"))
+        v.push_back({"sse2", &frame::detail::mask_sse2});
+    if (__builtin_cpu_supports("avx2"))
+        v.push_back({"avx2", &frame::detail::mask_avx2});
+#endif
+    return v;
+}
+
+static std::vector<unsigned char>
+random_bytes(std::size_t n)
+{
+    std::mt19937 rng{29};
+    std::vector<unsigned char> v(n);
+    for (auto &b : v)
+        b = static_cast<unsigned char>(rng());
+    return v;
+}
+
+static void
+test_rfc_example()
+{
+    // RFC 6455 section 5.7, a masked "Hello"
+    frame::mask_key const key{0x37, 0xfa, 0x21, 0x3d};
+    unsigned char const hello[] = {'H', 'e', 'l', 'l', 'o'};
+    unsigned char const masked[] = {0x7f, 0x9f, 0x4d, 0x51, 0x58};
+    unsigned char out[5];
+    check(frame::mask(out, hello, 5, key) == 1, "phase after five bytes");
+    check(std::memcmp(out, masked, 5) == 0, "RFC 6455 example masked");
+}
+
+static void
+test_against_reference(candidate const &c)
+{
+    auto const src = random_bytes(1024 + 128);
+    std::vector<unsigned char> expect(src.size()), got(src.size());
+    frame::mask_key const key{0x12, 0x34, 0x56, 0x78};
+
+    bool ok = true;
+    for (std::size_t src_offset : {0, 1, 5, 16, 31})
+        for (std::size_t dst_offset = 0; dst_offset < 64 && ok; ++dst_offset)
+            for (std::size_t n : {0, 1, 3, 7, 15, 16, 31, 33, 63, 64, 65, 127, 128, 129, 1000})
+                for (std::size_t phase = 0; phase < 4; ++phase)
+                {
+                    auto const *s = src.data() + src_offset;
+                    auto const p1 = frame::detail::mask_bytes(expect.data() + dst_offset, s, n, key, phase);
+                    auto const p2 = c.fn(got.data() + dst_offset, s, n, key, phase);
+                    if (p1 != p2 || std::memcmp(expect.data() + dst_offset, got.data() + dst_offset, n) != 0)
+                        ok = false;
+                }
+    check(ok, c.name);
+}
+
+static void
+test_in_place(candidate const &c)
+{
+    auto const src = random_bytes(4096 + 64);
+    frame::mask_key const key{0xde, 0xad, 0xbe, 0xef};
+    bool ok = true;
+    for (std::size_t offset : {0, 3, 17, 32})
+    {
+        std::vector<unsigned char> expect(src.size()), buf = src;
+        frame::detail::mask_bytes(expect.data(), src.data() + offset, 4096, key, 1);
+        c.fn(buf.data() + offset, buf.data() + offset, 4096, key, 1);
+        ok = ok && std::memcmp(expect.data(), buf.data() + offset, 4096) == 0;
+    }
+    check(ok, "masking in place");
+}
+
+static void
+test_pieces()
+{
+    // A payload masked in uneven pieces, carrying the phase along
+    auto const src = random_bytes(3000);
+    frame::mask_key const key{0x01, 0x02, 0x03, 0x04};
+    std::vector<unsigned char> whole(src.size()), pieces(src.size());
+    frame::mask(whole.data(), src.data(), src.size(), key);
+
+    std::size_t phase = 0, at = 0;
+    for (std::size_t n : {1, 2, 37, 100, 513, 7, 1024})
+    {
+        phase = frame::mask(pieces.data() + at, src.data() + at, n, key, phase);
+        at += n;
+    }
+    frame::mask(pieces.data() + at, src.data() + at, src.size() - at, key, phase);
+    check(whole == pieces, "masking in pieces matches one pass");
+}
+
+int
+main()
+{
+    test_rfc_example();
+    for (auto const &c : candidates())
+    {
+        test_against_reference(c);
+        test_in_place(c);
+    }
+    test_pieces();
+    return test::result("frame_mask");
+}
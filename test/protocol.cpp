@@ -0,0 +1,329 @@
+//
+// Test: framing on the sans-I/O connection
+//
+// Server frames are built by hand and fed in whole or a byte at a time;
+// what the connection queues for the wire is unmasked and decoded. Every
+// length encoding, fragmentation with control frames in between, the
+// closing handshake from either side and each protocol violation the
+// connection must fail on are covered, with and without partial_messages.
+//
+
+#include "protocol.hpp"
+#include "check.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace net = boost::asio;
+namespace websocket = boost::beast::websocket;
+using error_code = boost::beast::error_code;
+using test::check;
+
+namespace op {
+    constexpr unsigned char cont = 0x0, text = 0x1, binary = 0x2, close = 0x8, ping = 0x9, pong = 0xa;
+}
+
+// An unmasked frame as a server sends it
+static std::string
+server_frame(unsigned char opcode, std::string_view payload, bool fin = true, unsigned char extra = 0)
+{
+    std::string f;
+    f += static_cast<char>((fin ? 0x80 : 0) | extra | opcode);
+    std::size_t const n = payload.size();
+    if (n < 126)
+        f += static_cast<char>(n);
+    else if (n <= 0xffff)
+    {
+        f += static_cast<char>(126);
+        f += static_cast<char>(n >> 8);
+        f += static_cast<char>(n);
+    }
+    else
+    {
+        f += static_cast<char>(127);
+        for (int shift = 56; shift >= 0; shift -= 8)
+            f += static_cast<char>(static_cast<std::uint64_t>(n) >> shift);
+    }
+    f += payload;
+    return f;
+}
+
+static std::string
+close_payload(std::uint16_t code, std::string_view reason = {})
+{
+    std::string p{static_cast<char>(code >> 8), static_cast<char>(code)};
+    p += reason;
+    return p;
+}
+
+struct client_frame
+{
+    unsigned char opcode = 0;
+    bool fin = false;
+    bool masked = false;
+    std::string payload;
+};
+
+// Decode and unmask every frame the connection queued, then drop them
+static std::vector<client_frame>
+drain_output(protocol::connection &c)
+{
+    std::vector<client_frame> frames;
+    auto const out = c.output();
+    auto const *p = static_cast<unsigned char const *>(out.data());
+    std::size_t at = 0;
+    while (at + 2 <= out.size())
+    {
+        client_frame f;
+        f.fin = p[at] & 0x80;
+        f.opcode = p[at] & 0x0f;
+        f.masked = p[at + 1] & 0x80;
+        std::uint64_t len = p[at + 1] & 0x7f;
+        at += 2;
+        if (len == 126)
+        {
+            len = (std::uint64_t{p[at]} << 8) | p[at + 1];
+            at += 2;
+        }
+        else if (len == 127)
+        {
+            len = 0;
+            for (int i = 0; i < 8; ++i)
+                len = (len << 8) | p[at + i];
+            at += 8;
+        }
+        unsigned char key[4] = {};
+        if (f.masked)
+        {
+            std::memcpy(key, p + at, 4);
+            at += 4;
+        }
+        for (std::uint64_t i = 0; i < len; ++i)
+            f.payload += static_cast<char>(p[at + i] ^ key[i & 3]);
+        at += len;
+        frames.push_back(std::move(f));
+    }
+    c.consume_output(out.size());
+    return frames;
+}
+
+static std::string_view
+text(net::const_buffer b)
+{
+    return {static_cast<char const *>(b.data()), b.size()};
+}
+
+static void
+test_lengths()
+{
+    // Seven-bit, 16-bit and 64-bit lengths, whole and a byte at a time
+    for (std::size_t n : {0, 125, 126, 0xffff, 0x10000 + 3})
+    {
+        std::string const body(n, 'x');
+        auto const wire = server_frame(op::binary, body);
+
+        protocol::connection whole;
+        whole.receive(net::buffer(wire));
+        auto const e = whole.next();
+        check(e.kind == protocol::event_kind::message && !e.text && text(e.payload) == body, "whole frame");
+
+        protocol::connection trickle;
+        bool early = false;
+        protocol::event got;
+        for (char ch : wire)
+        {
+            early = early || got.kind != protocol::event_kind::need_more;
+            trickle.receive(net::buffer(&ch, 1));
+            got = trickle.next();
+        }
+        check(!early && got.kind == protocol::event_kind::message && text(got.payload) == body,
+              "frame fed a byte at a time completes on its last byte");
+    }
+}
+
+static void
+test_send()
+{
+    protocol::connection c;
+    std::string const big(300, 'b');
+    c.send(net::buffer(std::string_view{"hello"}));
+    c.send(net::buffer(big), false);
+    c.ping(net::buffer(std::string_view{"p"}));
+    auto const frames = drain_output(c);
+    check(frames.size() == 3, "three frames queued");
+    check(frames[0].opcode == op::text && frames[0].fin && frames[0].masked && frames[0].payload == "hello", "text frame masked");
+    check(frames[1].opcode == op::binary && frames[1].payload == big, "binary frame with a 16-bit length");
+    check(frames[2].opcode == op::ping && frames[2].payload == "p", "ping");
+    check(c.output().size() == 0, "output consumed");
+}
+
+static void
+test_fragments()
+{
+    // A ping between fragments is answered and the message still joins
+    protocol::connection c;
+    std::string wire = server_frame(op::text, "Hel", false);
+    wire += server_frame(op::ping, "are you there");
+    wire += server_frame(op::cont, "lo, ", false);
+    wire += server_frame(op::cont, "w\xc3", false);
+    wire += server_frame(op::cont, "\xb6rld");
+    c.receive(net::buffer(wire));
+
+    auto e = c.next();
+    check(e.kind == protocol::event_kind::ping && text(e.payload) == "are you there", "ping between fragments");
+    auto const pong = drain_output(c);
+    check(pong.size() == 1 && pong[0].opcode == op::pong && pong[0].payload == "are you there", "ping answered");
+
+    e = c.next();
+    check(e.kind == protocol::event_kind::message && e.text && text(e.payload) == "Hello, w\xc3\xb6rld",
+          "fragments joined, UTF-8 split across them");
+    check(c.next().kind == protocol::event_kind::need_more, "nothing left");
+}
+
+static void
+test_partial_messages()
+{
+    protocol::connection_options opts;
+    opts.partial_messages = true;
+    protocol::connection c{opts};
+    std::string wire = server_frame(op::text, std::string(1000, 'a'), false);
+    wire += server_frame(op::pong, "");
+    wire += server_frame(op::cont, std::string(500, 'b') + "\xe2\x82\xac");
+
+    std::string message;
+    int pieces = 0, pongs = 0;
+    bool last = false;
+    for (std::size_t at = 0; at < wire.size(); at += 97)
+    {
+        c.receive(net::buffer(wire.data() + at, std::min<std::size_t>(97, wire.size() - at)));
+        for (auto e = c.next(); e.kind != protocol::event_kind::need_more; e = c.next())
+        {
+            if (e.kind == protocol::event_kind::pong)
+            {
+                ++pongs;
+                continue;
+            }
+            check(!last, "no piece after the last");
+            message += text(e.payload);
+            last = e.last;
+            ++pieces;
+        }
+    }
+    check(pongs == 1 && last && pieces > 3, "message handed out in pieces around the pong");
+    check(message == std::string(1000, 'a') + std::string(500, 'b') + "\xe2\x82\xac", "pieces add up to the message");
+
+    // A sequence still open when the message ends is caught at its end
+    protocol::connection bad{opts};
+    auto const w = server_frame(op::text, "ab\xe2\x82");
+    bad.receive(net::buffer(w));
+    error_code ec;
+    while (!ec && bad.next(ec).kind != protocol::event_kind::need_more)
+        ;
+    check(ec == websocket::error::bad_frame_payload, "truncated sequence at the end rejected");
+}
+
+static void
+test_close_from_server()
+{
+    protocol::connection c;
+    auto const wire = server_frame(op::close, close_payload(1001, "going away"));
+    c.receive(net::buffer(wire));
+    auto const e = c.next();
+    check(e.kind == protocol::event_kind::close, "close event");
+    check(e.reason.code == 1001 && std::string_view{e.reason.reason.data(), e.reason.reason.size()} == "going away",
+          "close code and reason");
+    check(c.closed(), "closed once the echo is queued");
+    auto const echo = drain_output(c);
+    check(echo.size() == 1 && echo[0].opcode == op::close && echo[0].payload == close_payload(1001), "status echoed");
+    check(!c.send(net::buffer(std::string_view{"late"})), "nothing sent after the close");
+    check(c.next().kind == protocol::event_kind::need_more, "no events after the close");
+}
+
+static void
+test_close_from_client()
+{
+    protocol::connection c;
+    c.close({websocket::close_code::normal, "done"});
+    check(c.close_sent() && !c.closed(), "waiting for the server's close");
+    auto const sent = drain_output(c);
+    check(sent.size() == 1 && sent[0].payload == close_payload(1000, "done"), "close frame with reason");
+
+    // Data the server sent before its close still arrives
+    std::string wire = server_frame(op::text, "last words");
+    wire += server_frame(op::close, close_payload(1000));
+    c.receive(net::buffer(wire));
+    check(text(c.next().payload) == "last words", "message before the server's close");
+    check(c.next().kind == protocol::event_kind::close && c.closed(), "closing handshake complete");
+    check(drain_output(c).empty(), "no second close frame");
+
+    // The longest reason Beast holds fills the control frame exactly
+    protocol::connection l;
+    std::string const reason(123, 'r');
+    l.close({websocket::close_code::normal, reason});
+    auto const full = drain_output(l);
+    check(full.size() == 1 && full[0].payload == close_payload(1000, reason), "125 byte close payload");
+}
+
+// Feed `wire` and expect the connection to fail with `expect`, queueing a
+// close with `code`
+static void
+expect_failure(std::string const &wire, error_code expect, std::uint16_t code, char const *what,
+               protocol::connection_options const &opts = {})
+{
+    protocol::connection c{opts};
+    c.receive(net::buffer(wire));
+    error_code ec;
+    for (int i = 0; i < 8 && !ec; ++i)
+        c.next(ec);
+    auto const out = drain_output(c);
+    bool const ok = ec == expect && out.size() == 1 && out.back().opcode == op::close &&
+                    out.back().payload.substr(0, 2) == close_payload(code);
+    check(ok, what);
+}
+
+static void
+test_violations()
+{
+    std::string masked = server_frame(op::text, "");
+    masked[1] = static_cast<char>(0x80);
+    masked += "\x01\x02\x03\x04";
+    expect_failure(masked, websocket::error::bad_masked_frame, 1002, "masked server frame");
+    expect_failure(server_frame(op::text, "x", true, 0x20), websocket::error::bad_reserved_bits, 1002, "RSV2 set");
+    expect_failure(server_frame(op::text, "x", true, 0x40), websocket::error::bad_reserved_bits, 1002, "RSV1 without deflate");
+    expect_failure(server_frame(0x3, "x"), websocket::error::bad_opcode, 1002, "reserved opcode");
+    expect_failure(server_frame(op::cont, "x"), websocket::error::bad_continuation, 1002, "continuation with no message");
+    expect_failure(server_frame(op::text, "a", false) + server_frame(op::text, "b"),
+                   websocket::error::bad_data_frame, 1002, "new message inside a fragmented one");
+    expect_failure(server_frame(op::ping, "x", false), websocket::error::bad_control_fragment, 1002, "fragmented ping");
+    expect_failure(server_frame(op::ping, std::string(126, 'x')), websocket::error::bad_control_size, 1002, "ping over 125 bytes");
+    expect_failure(std::string{"\x82\x7e\x00\x05hello", 9}, websocket::error::bad_size, 1002, "16-bit length under 126");
+    expect_failure(server_frame(op::text, "\xc0\x80"), websocket::error::bad_frame_payload, 1007, "invalid UTF-8");
+    expect_failure(server_frame(op::close, "\x03"), websocket::error::bad_close_size, 1002, "one byte close payload");
+    expect_failure(server_frame(op::close, close_payload(1005)), websocket::error::bad_close_code, 1002, "reserved close code");
+    expect_failure(server_frame(op::close, close_payload(1000, "\xff")), websocket::error::bad_close_payload, 1002,
+                   "invalid UTF-8 close reason");
+
+    protocol::connection_options small;
+    small.message_limit = 10;
+    expect_failure(server_frame(op::binary, std::string(11, 'x')), websocket::error::message_too_big, 1009,
+                   "frame over the message limit", small);
+    expect_failure(server_frame(op::binary, std::string(6, 'x'), false) + server_frame(op::cont, std::string(5, 'x')),
+                   websocket::error::message_too_big, 1009, "fragments over the message limit", small);
+}
+
+int
+main()
+{
+    test_lengths();
+    test_send();
+    test_fragments();
+    test_partial_messages();
+    test_close_from_server();
+    test_close_from_client();
+    test_violations();
+    return test::result("protocol");
+}
@@ -0,0 +1,120 @@
+//
+// Test: request/response correlation
+//
+// The client talks to an in-process server over Beast's test streams. The
+// server collects a batch of requests and answers them in reverse order,
+// skipping one, so every call must get its own response back and the
+// skipped one must time out. Responses are handled on a worker pool, which
+// must not take the matching off the connection's thread.
+//
+
+#include "rpc_client.hpp"
+#include "check.hpp"
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/beast/_experimental/test/stream.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/websocket/stream.hpp>
+
+#include <chrono>
+#include <exception>
+#include <string>
+#include <vector>
+
+namespace net = boost::asio;
+namespace beast = boost::beast;
+namespace websocket = beast::websocket;
+using test::check;
+
+static constexpr int batch = 20;
+
+// Read `batch` requests, then echo them newest first, except "skip"
+static net::awaitable<void>
+serve(websocket::stream<beast::test::stream> &ws)
+{
+    co_await ws.async_accept(net::use_awaitable);
+    std::vector<std::string> requests;
+    beast::flat_buffer buffer;
+    while (requests.size() < batch)
+    {
+        co_await ws.async_read(buffer, net::use_awaitable);
+        requests.push_back(beast::buffers_to_string(buffer.data()));
+        buffer.clear();
+    }
+    for (auto it = requests.rbegin(); it != requests.rend(); ++it)
+        if (!it->ends_with(" skip"))
+            co_await ws.async_write(net::buffer(*it), net::use_awaitable);
+
+    // Until the client closes
+    try
+    {
+        for (;;)
+        {
+            co_await ws.async_read(buffer, net::use_awaitable);
+            buffer.clear();
+        }
+    } catch (beast::system_error const &)
+    {
+    }
+}
+
+static void
+test_calls_with_workers()
+{
+    net::io_context ioc;
+    websocket::stream<beast::test::stream> client_ws{ioc};
+    websocket::stream<beast::test::stream> server_ws{ioc};
+    client_ws.next_layer().connect(server_ws.next_layer());
+
+    runtime::work_stealing_pool workers{4};
+    duplex::session_options opts;
+    opts.workers = &workers;
+    rpc::client client{client_ws, std::move(opts)};
+
+    int answered = 0, wrong = 0, timed_out = 0, finished = 0;
+    net::co_spawn(ioc, serve(server_ws), net::detached);
+    net::co_spawn(
+    ioc,
+    [&]() -> net::awaitable<void> {
+        co_await client_ws.async_handshake("localhost", "/", net::use_awaitable);
+        for (int i = 0; i < batch; ++i)
+            net::co_spawn(
+            ioc,
+            [&, i]() -> net::awaitable<void> {
+                std::string const body = i == 7 ? "skip" : "call " + std::to_string(i);
+                try
+                {
+                    auto const response = co_await client.async_call(body, std::chrono::milliseconds(500));
+                    ++(response == body ? answered : wrong);
+                } catch (beast::system_error const &e)
+                {
+                    timed_out += e.code() == net::error::timed_out;
+                }
+                if (++finished == batch)
+                    client.close();
+            },
+            net::detached);
+        co_await client.run();
+    },
+    [](std::exception_ptr e) {
+        if (e)
+            std::rethrow_exception(e);
+    });
+    ioc.run();
+
+    check(answered == batch - 1 && wrong == 0, "every response reaches its own call");
+    check(timed_out == 1, "the unanswered call times out");
+    auto const &s = client.stats();
+    check(s.calls == batch && s.completed == batch - 1 && s.timeouts == 1, "calls counted");
+    check(s.in_flight == 0 && s.peak_in_flight == batch && s.orphans == 0, "nothing left in flight");
+}
+
+int
+main()
+{
+    test_calls_with_workers();
+    return test::result("rpc_client");
+}
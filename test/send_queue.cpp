@@ -0,0 +1,309 @@
+//
+// Test: send queue backpressure
+//
+// The queue runs against a fake stream whose writes complete only when
+// the test says so, which makes every step of the queue observable. The
+// watermark callbacks must fire once per crossing, the overflow policies
+// must keep the queue within its limit, and async_push must wait for the
+// low watermark. Control frames must overtake bulk data at the next
+// fragment boundary.
+//
+
+#include "send_queue.hpp"
+#include "check.hpp"
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace net = boost::asio;
+namespace websocket = boost::beast::websocket;
+using error_code = boost::beast::error_code;
+using test::check;
+
+// Records each operation the queue starts and holds its completion
+class fake_stream
+{
+public:
+    explicit fake_stream(net::io_context &ioc)
+        : ioc_(ioc)
+    {
+    }
+
+    net::io_context::executor_type
+    get_executor()
+    {
+        return ioc_.get_executor();
+    }
+
+    void
+    text(bool) {}
+
+    template<class ConstBuffers, class Token>
+    auto
+    async_write_some(bool fin, ConstBuffers const &buffers, Token &&token)
+    {
+        auto const n = net::buffer_size(buffers);
+        return net::async_initiate<Token, void(error_code, std::size_t)>(
+        [this, fin, n](auto handler) {
+            ops.push_back((fin ? "fin " : "frag ") + std::to_string(n));
+            pending_ = [h = std::move(handler), n](error_code ec) mutable { std::move(h)(ec, n); };
+        },
+        token);
+    }
+
+    template<class Token>
+    auto
+    async_ping(websocket::ping_data const &, Token &&token)
+    {
+        return control("ping", std::forward<Token>(token));
+    }
+
+    template<class Token>
+    auto
+    async_pong(websocket::ping_data const &, Token &&token)
+    {
+        return control("pong", std::forward<Token>(token));
+    }
+
+    template<class Token>
+    auto
+    async_close(websocket::close_reason const &, Token &&token)
+    {
+        return control("close", std::forward<Token>(token));
+    }
+
+    bool
+    busy() const
+    {
+        return static_cast<bool>(pending_);
+    }
+
+    // Finish the operation in flight, which may start the next one
+    void
+    complete(error_code ec = {})
+    {
+        auto h = std::move(pending_);
+        pending_ = nullptr;
+        h(ec);
+    }
+
+    std::vector<std::string> ops;
+
+private:
+    template<class Token>
+    auto
+    control(char const *op, Token &&token)
+    {
+        return net::async_initiate<Token, void(error_code)>(
+        [this, op](auto handler) {
+            ops.push_back(op);
+            pending_ = [h = std::move(handler)](error_code ec) mutable { std::move(h)(ec); };
+        },
+        token);
+    }
+
+    net::io_context &ioc_;
+    std::function<void(error_code)> pending_;
+};
+
+// Every message goes out as one frame
+static outbound::queue_options
+small_queue(outbound::overflow_policy policy = outbound::overflow_policy::block)
+{
+    outbound::queue_options o;
+    o.high_watermark = 100;
+    o.low_watermark = 40;
+    o.limit = 200;
+    o.policy = policy;
+    o.min_fragment = o.max_fragment = 1000;
+    return o;
+}
+
+static void
+test_watermarks()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue()};
+    int highs = 0, lows = 0;
+    q.on_high_watermark([&] { ++highs; });
+    q.on_low_watermark([&] { ++lows; });
+
+    for (int i = 0; i < 3; ++i)
+        q.try_push(std::string(30, 'x'));
+    check(highs == 0, "below the high watermark");
+    q.try_push(std::string(30, 'x'));
+    check(highs == 1 && q.above_high_watermark(), "high watermark crossed");
+    q.try_push(std::string(10, 'x'));
+    check(highs == 1, "high watermark reported once");
+    check(ws.ops.size() == 1, "one write in flight");
+
+    ws.complete();
+    ws.complete();
+    check(lows == 0, "still above the low watermark");
+    ws.complete();
+    check(lows == 1 && !q.above_high_watermark(), "low watermark reached");
+    ws.complete();
+    ws.complete();
+    check(!ws.busy() && q.metrics().sent == 5 && q.metrics().bytes == 0, "queue drained");
+    check(q.metrics().peak_bytes == 130 && q.metrics().peak_depth == 5, "peaks recorded");
+    check(highs == 1 && lows == 1, "one report per crossing");
+}
+
+static void
+test_block_policy()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue()};
+    check(q.try_push(std::string(150, 'x')) == outbound::push_result::queued, "fits the limit");
+    check(q.try_push(std::string(60, 'x')) == outbound::push_result::would_block, "past the limit would block");
+    check(q.metrics().depth == 1 && q.metrics().dropped == 0, "refused message not queued");
+}
+
+static void
+test_drop_newest()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue(outbound::overflow_policy::drop_newest)};
+    q.try_push(std::string(150, 'x'));
+    check(q.try_push(std::string(60, 'x')) == outbound::push_result::dropped, "newest dropped");
+    check(q.metrics().dropped == 1 && q.metrics().bytes == 150, "queue unchanged");
+}
+
+static void
+test_drop_oldest()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue(outbound::overflow_policy::drop_oldest)};
+    q.try_push(std::string(80, 'a')); // in flight, never evicted
+    q.try_push(std::string(50, 'b'));
+    q.try_push(std::string(50, 'c'));
+    check(q.try_push(std::string(60, 'd')) == outbound::push_result::queued, "oldest queued message makes room");
+    check(q.metrics().dropped == 1 && q.metrics().bytes == 190, "one queued message evicted");
+    ws.complete();
+    ws.complete();
+    ws.complete();
+    check(ws.ops == std::vector<std::string>{"fin 80", "fin 50", "fin 60"}, "message in flight kept, then c and d");
+}
+
+static void
+test_async_push_waits()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue()};
+    q.try_push(std::string(150, 'x'));
+    q.try_push(std::string(30, 'x'));
+
+    bool done = false;
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        co_await q.async_push(std::string(60, 'y'));
+        done = true;
+    }, net::detached);
+    ioc.poll();
+    check(!done && q.metrics().blocked == 1, "async_push waits past the limit");
+
+    // 30 bytes left: under the limit and the low watermark
+    ws.complete();
+    ioc.poll();
+    check(done && q.metrics().depth == 2, "async_push resumes at the low watermark");
+}
+
+static void
+test_write_error()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue()};
+    q.try_push("a");
+    q.try_push("b");
+    ws.complete(net::error::connection_reset);
+    check(q.error() == net::error::connection_reset, "error kept");
+    check(!ws.busy(), "no write after an error");
+    check(q.try_push("c") == outbound::push_result::dropped, "push after an error dropped");
+}
+
+static void
+test_control_overtakes_bulk()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    auto o = small_queue();
+    o.limit = 10000;
+    outbound::send_queue q{ws, o};
+    q.try_push(std::string(2500, 'x'));
+    q.try_push(std::string(10, 'y'));
+    q.ping();
+    q.pong();
+    while (ws.busy())
+        ws.complete();
+    check(ws.ops == std::vector<std::string>{"frag 1000", "ping", "pong", "frag 1000", "fin 500", "fin 10"},
+          "controls go out at the next fragment boundary, in order");
+    check(q.metrics().control_sent == 2 && q.metrics().fragments == 4 && q.metrics().sent == 2, "control and bulk counted");
+}
+
+static void
+test_close_ends_bulk()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    auto o = small_queue();
+    o.limit = 10000;
+    outbound::send_queue q{ws, o};
+    q.try_push(std::string(2500, 'x'));
+    q.try_push(std::string(10, 'y'));
+    q.close();
+    q.close();
+    check(q.try_push("z") == outbound::push_result::dropped, "no data after a close");
+    while (ws.busy())
+        ws.complete();
+    check(ws.ops == std::vector<std::string>{"frag 1000", "close"}, "one close after the fragment in flight");
+    check(q.metrics().depth == 0 && q.metrics().bytes == 0, "bulk lane discarded");
+    check(q.metrics().dropped == 3, "the cut message, the one behind it and the late push dropped");
+}
+
+static void
+test_drain()
+{
+    net::io_context ioc;
+    fake_stream ws{ioc};
+    outbound::send_queue q{ws, small_queue()};
+    q.try_push("a");
+    q.ping();
+    bool drained = false;
+    net::co_spawn(ioc, [&]() -> net::awaitable<void> {
+        co_await q.async_drain();
+        drained = true;
+    }, net::detached);
+    ioc.poll();
+    ws.complete();
+    ioc.poll();
+    check(!drained, "drain waits for the control frame");
+    ws.complete();
+    ioc.poll();
+    check(drained, "drain completes once both lanes are empty");
+}
+
+int
+main()
+{
+    test_watermarks();
+    test_block_policy();
+    test_drop_newest();
+    test_drop_oldest();
+    test_async_push_waits();
+    test_write_error();
+    test_control_overtakes_bulk();
+    test_close_ends_bulk();
+    test_drain();
+    return test::result("send_queue");
+}
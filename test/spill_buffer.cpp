@@ -0,0 +1,156 @@
+//
+// Test: spilling large messages to a temp file
+//
+// A message stays in memory up to the threshold and moves to an unlinked,
+// mapped file past it. Either way the bytes read back must be the bytes
+// appended, and a spilled file must end up exactly as long as the message
+// however far ahead of the writes it was reserved.
+//
+
+#include "spill_buffer.hpp"
+#include "check.hpp"
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace net = boost::asio;
+using test::check;
+
+static std::string
+pattern(std::size_t n, std::size_t first)
+{
+    std::string s(n, '\0');
+    for (std::size_t i = 0; i < n; ++i)
+        s[i] = static_cast<char>((first + i) * 7);
+    return s;
+}
+
+static std::string_view
+view(inbound::message const &m)
+{
+    return {static_cast<char const *>(m.data().data()), m.data().size()};
+}
+
+// Size of the open spill file, found through /proc since it has no name
+static long
+spill_file_size()
+{
+    long size = -1;
+    DIR *d = ::opendir("/proc/self/fd");
+    if (!d)
+        return size;
+    while (dirent *e = ::readdir(d))
+    {
+        std::string const link = std::string{"/proc/self/fd/"} + e->d_name;
+        char target[4096];
+        ssize_t const n = ::readlink(link.c_str(), target, sizeof(target) - 1);
+        if (n <= 0)
+            continue;
+        target[n] = '\0';
+        struct stat st;
+        if (std::strstr(target, "websocket-spill-") && ::stat(link.c_str(), &st) == 0)
+            size = static_cast<long>(st.st_size);
+    }
+    ::closedir(d);
+    return size;
+}
+
+static void
+test_in_memory()
+{
+    inbound::spill_options opts;
+    opts.threshold = 100;
+    inbound::spill_writer w{opts};
+    auto const body = pattern(100, 0);
+    w.append(net::buffer(body.data(), 60));
+    w.append(net::buffer(body.data() + 60, 40));
+    auto const m = w.finish(false);
+    check(!m.spilled(), "a message at the threshold stays in memory");
+    check(!m.text() && view(m) == body, "in-memory message intact");
+}
+
+static void
+test_spilled()
+{
+    inbound::spill_options opts;
+    opts.threshold = 100;
+    inbound::spill_writer w{opts};
+
+    // Crosses the threshold on the second chunk, then grows the file
+    // several times with uneven chunks
+    std::string body;
+    for (std::size_t n : {60, 60, 1000, 3, 4096, 17, 65536, 1})
+    {
+        auto const chunk = pattern(n, body.size());
+        w.append(net::buffer(chunk));
+        body += chunk;
+    }
+    auto m = w.finish(true);
+    check(m.spilled(), "past the threshold the message spills");
+    check(m.text() && m.size() == body.size() && view(m) == body, "spilled message intact");
+    check(spill_file_size() == static_cast<long>(body.size()), "spill file trimmed to the message");
+
+    auto moved = std::move(m);
+    check(moved.spilled() && view(moved) == body, "mapping moves with the message");
+    check(!m.spilled() && m.size() == 0, "moved-from message is empty");
+}
+
+static void
+test_unlinked()
+{
+    char dir[] = "/tmp/spill-test-XXXXXX";
+    check(::mkdtemp(dir) != nullptr, "temp directory");
+    inbound::spill_options opts;
+    opts.threshold = 10;
+    opts.directory = dir;
+    {
+        inbound::spill_writer w{opts};
+        auto const body = pattern(5000, 0);
+        w.append(net::buffer(body));
+        auto const m = w.finish(false);
+        check(m.spilled() && view(m) == body, "spilled into the given directory");
+
+        int entries = 0;
+        DIR *d = ::opendir(dir);
+        while (dirent *e = ::readdir(d))
+            entries += e->d_name[0] != '.';
+        ::closedir(d);
+        check(entries == 0, "spill file has no name");
+    }
+    check(spill_file_size() == -1, "spill file closed with its message");
+    ::rmdir(dir);
+}
+
+static void
+test_bad_directory()
+{
+    inbound::spill_options opts;
+    opts.threshold = 10;
+    opts.directory = "/nonexistent/spill";
+    inbound::spill_writer w{opts};
+    auto const body = pattern(100, 0);
+    bool threw = false;
+    try
+    {
+        w.append(net::buffer(body));
+    } catch (boost::beast::system_error const &)
+    {
+        threw = true;
+    }
+    check(threw, "an unusable directory throws");
+}
+
+int
+main()
+{
+    test_in_memory();
+    test_spilled();
+    test_unlinked();
+    test_bad_directory();
+    return test::result("spill_buffer");
+}
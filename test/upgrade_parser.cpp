@@ -0,0 +1,259 @@
+//
+// Test: the vectorized upgrade response parser
+//
+// Every scanner must find the same field boundaries as the scalar one,
+// wherever a stop byte falls relative to the 16 and 32 byte blocks; any
+// reply it accepts must parse to the same fields in Beast's parser, and
+// anything outside its common shape must fall back so that the handshake
+// ends exactly as it would through Beast.
+//
+
+#include "protocol.hpp"
+#include "check.hpp"
+
+#include <boost/beast/http/parser.hpp>
+#include <boost/beast/http/string_body.hpp>
+
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace net = boost::asio;
+namespace http = boost::beast::http;
+namespace websocket = boost::beast::websocket;
+using test::check;
+
+struct candidate
+{
+    char const *name;
+    protocol::detail::scanner scanner;
+};
+
+static std::vector<candidate>
+candidates()
+{
+    using namespace protocol::detail;
+    std::vector<candidate> v{{"scalar", {"scalar", &value_end_scalar, &name_end_scalar}}};
+#if defined(WEBSOCKET_HANDSHAKE_UPGRADE_X86)
+    if (__builtin_cpu_supports("sse4.2"))
+        v.push_back({"sse4.2", {"sse4.2", &value_end_sse42, &name_end_sse42}});
+    if (__builtin_cpu_supports("avx2"))
+        v.push_back({"avx2", {"avx2", &value_end_avx2, &name_end_avx2}});
+#endif
+    return v;
+}
+
+static std::string
+reply(std::string_view accept, std::string_view extra = {})
+{
+    std::string r = "HTTP/1.1 101 Switching Protocols\r\n"
+                    "Upgrade: websocket\r\n"
+                    "Connection: Upgrade\r\n"
+                    "Sec-WebSocket-Accept: ";
+    r += accept;
+    r += "\r\n";
+    r += extra;
+    r += "\r\n";
+    return r;
+}
+
+static std::string const sample = reply("s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+                                        "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=15\r\n"
+                                        "Sec-WebSocket-Protocol: chat.v2\r\n"
+                                        "Via: 1.1 edge-proxy-17.example.net (squid/5.7)\r\n"
+                                        "X-Request-Id: 4f1c2b7e-9d3a-4e61-a8c5-0b2f6d9e1a73\r\n");
+
+static bool
+same(std::string_view ours, http::response<http::string_body> const &res, http::field f)
+{
+    auto const it = res.find(f);
+    if (it == res.end())
+        return ours.data() == nullptr;
+    return ours.data() && ours == std::string_view{it->value().data(), it->value().size()};
+}
+
+// True when `in` parses completely and Beast sees the same fields
+static bool
+agrees_with_beast(std::string_view in, protocol::detail::scanner const &s)
+{
+    protocol::upgrade_response r;
+    if (parse_upgrade_response(in, r, s) != protocol::parse_result::complete)
+        return false;
+    http::response_parser<http::string_body> p;
+    p.eager(true);
+    boost::beast::error_code ec;
+    p.put(net::buffer(in.data(), r.size), ec);
+    if (ec || !p.is_done())
+        return false;
+    auto const &res = p.get();
+    return res.result_int() == 101 && res.reason() == r.reason &&
+           same(r.connection, res, http::field::connection) &&
+           same(r.upgrade, res, http::field::upgrade) &&
+           same(r.sec_accept, res, http::field::sec_websocket_accept) &&
+           same(r.extensions, res, http::field::sec_websocket_extensions) &&
+           same(r.subprotocol, res, http::field::sec_websocket_protocol) &&
+           r.fields == static_cast<std::size_t>(std::distance(res.begin(), res.end()));
+}
+
+static void
+test_sample(candidate const &c)
+{
+    check(agrees_with_beast(sample, c.scanner), c.name);
+    bool incomplete = true;
+    for (std::size_t n = 0; n < sample.size(); ++n)
+    {
+        protocol::upgrade_response r;
+        incomplete = incomplete && parse_upgrade_response(std::string_view{sample}.substr(0, n), r, c.scanner) ==
+                                   protocol::parse_result::incomplete;
+    }
+    check(incomplete, "every proper prefix is incomplete");
+}
+
+static void
+test_stop_bytes(std::vector<candidate> const &cs)
+{
+    // A stop byte at every position of a long name and value, so that it
+    // lands in every lane of the vector scanners
+    std::string const name(70, 'n'), value(70, 'v');
+    bool agree = true;
+    for (char stop : {'\x01', '\x7f', '\r', ' ', ':'})
+        for (std::size_t at = 0; at < 70; ++at)
+            for (bool in_name : {true, false})
+            {
+                std::string n = name, v = value;
+                (in_name ? n : v)[at] = stop;
+                std::vector<char> const in = [&] {
+                    auto const s = reply("x", n + ": " + v + "\r\n");
+                    return std::vector<char>(s.begin(), s.end());
+                }();
+                std::string_view const bytes{in.data(), in.size()};
+
+                protocol::upgrade_response first;
+                auto const result = parse_upgrade_response(bytes, first, cs.front().scanner);
+                for (auto const &c : cs)
+                {
+                    protocol::upgrade_response r;
+                    agree = agree && parse_upgrade_response(bytes, r, c.scanner) == result &&
+                            r.size == first.size && r.fields == first.fields;
+                }
+            }
+    check(agree, "scanners agree on every stop byte position");
+}
+
+static void
+test_fallbacks()
+{
+    // Valid or not, none of these take the fast path
+    for (std::string_view in : {
+         "HTTP/1.1 200 OK\r\n\r\n",
+         "HTTP/1.0 101 Switching Protocols\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\nUpgrade: websocket\n\n",
+         "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n folded\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nUpgrade : websocket\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nX-A: a\tb\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nUpgrade: websocket\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nContent-Length: 5\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nTransfer-Encoding: chunked\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nConnection: up\"grade\r\n\r\n",
+         "HTTP/1.1 101 Switching Protocols\r\nX(y): z\r\n\r\n"})
+    {
+        protocol::upgrade_response r;
+        check(parse_upgrade_response(in, r) == protocol::parse_result::fallback, std::string{in}.c_str());
+    }
+}
+
+// Run a handshake on `response` built for its key, fed in `piece` bytes
+// at a time
+template<class MakeResponse>
+static protocol::handshake &
+run(protocol::handshake &hs, MakeResponse make, std::size_t piece, std::string_view after = {})
+{
+    auto const bytes = make(protocol::sec_accept_for(hs.key())) + std::string{after};
+    for (std::size_t at = 0; at < bytes.size(); at += piece)
+        hs.receive(net::buffer(bytes.data() + at, std::min(piece, bytes.size() - at)));
+    return hs;
+}
+
+static void
+test_handshake()
+{
+    auto const upgrade = [](std::string const &accept) { return reply(accept); };
+    for (std::size_t piece : {std::size_t{1}, std::size_t{7}, std::size_t{4096}})
+    {
+        protocol::handshake hs{"example.com", "/"};
+        run(hs, upgrade, piece, "\x81\x02hi");
+        check(hs.done() && !hs.error() && hs.parsed_fast(), "upgrade on the fast path");
+        auto const left = hs.leftover();
+        check(std::string_view{static_cast<char const *>(left.data()), left.size()} == "\x81\x02hi",
+              "frame bytes after the reply kept");
+    }
+
+    // A repeated field is left to Beast, which checks the first one
+    protocol::handshake twice{"example.com", "/"};
+    run(twice, [](std::string const &accept) { return reply(accept, "Sec-WebSocket-Accept: " + accept + "\r\n"); }, 5);
+    check(twice.done() && !twice.parsed_fast() && !twice.error(), "repeated accept falls back");
+
+    protocol::handshake declined{"example.com", "/"};
+    run(declined, [](std::string const &) { return std::string{"HTTP/1.1 403 Forbidden\r\nContent-Length: 5\r\n\r\nnope!"}; }, 3);
+    check(declined.error() == websocket::error::upgrade_declined && declined.response().result_int() == 403,
+          "refusal read by the fallback");
+
+    protocol::handshake wrong{"example.com", "/"};
+    run(wrong, [](std::string const &) { return reply("s3pPLMBiTxaQ9kYGzzhZRbK+xOo="); }, 4096);
+    check(wrong.parsed_fast() && wrong.error() == websocket::error::bad_sec_accept, "wrong accept rejected");
+}
+
+static void
+test_mutations(std::vector<candidate> const &cs)
+{
+    // Random edits of the sample: the scanners must agree, and whatever
+    // they accept Beast must read the same way
+    std::mt19937 rng{48};
+    static constexpr char interesting[] = {'\r', '\n', ':', ' ', '\t', '\0', '\x7f', '\x80', '\xff', ',', 'a', '1'};
+    bool ok = true;
+    for (int round = 0; round < 20000 && ok; ++round)
+    {
+        std::string s = sample;
+        for (int edits = 1 + rng() % 3; edits > 0 && !s.empty(); --edits)
+        {
+            std::size_t const at = rng() % s.size();
+            char const c = interesting[rng() % sizeof(interesting)];
+            switch (rng() % 3)
+            {
+            case 0: s[at] = c; break;
+            case 1: s.insert(s.begin() + at, c); break;
+            case 2: s.erase(at, 1 + rng() % 3); break;
+            }
+        }
+        std::vector<char> const exact(s.begin(), s.end());
+        std::string_view const in{exact.data(), exact.size()};
+
+        protocol::upgrade_response first;
+        auto const result = parse_upgrade_response(in, first, cs.front().scanner);
+        for (auto const &c : cs)
+        {
+            protocol::upgrade_response r;
+            ok = ok && parse_upgrade_response(in, r, c.scanner) == result && r.size == first.size &&
+                 r.fields == first.fields && r.sec_accept == first.sec_accept;
+        }
+        if (result == protocol::parse_result::complete)
+            ok = ok && agrees_with_beast(in, cs.front().scanner);
+    }
+    check(ok, "mutated replies parse as in Beast");
+}
+
+int
+main()
+{
+    auto const cs = candidates();
+    for (auto const &c : cs)
+        test_sample(c);
+    test_stop_bytes(cs);
+    test_fallbacks();
+    test_handshake();
+    test_mutations(cs);
+    return test::result("upgrade_parser");
+}
@@ -0,0 +1,173 @@
+//
+// Test: UTF-8 validation of text messages
+//
+// Each kernel must accept and reject exactly what table 3-7 of the
+// Unicode standard does, wherever a sequence falls relative to the vector
+// blocks and however the message is split across write() calls.
+//
+
+#include "utf8.hpp"
+#include "check.hpp"
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using test::check;
+
+struct candidate
+{
+    char const *name;
+    utf8::detail::blocks_fn fn;
+};
+
+static std::vector<candidate>
+candidates()
+{
+    std::vector<candidate> v{{"scalar", nullptr}};
+#if defined(WEBSOCKET_HANDSHAKE_UTF8_X86)
+    if (__builtin_cpu_supports("ssse3"))
+        v.push_back({"ssse3", &utf8::detail::blocks_ssse3});
+    if (__builtin_cpu_supports("avx2"))
+        v.push_back({"avx2", &utf8::detail::blocks_avx2});
+#endif
+    return v;
+}
+
+struct sample
+{
+    std::string_view bytes;
+    bool valid;
+};
+
+// The edges of every row of table 3-7, and the ways to fall off them
+constexpr sample samples[] = {
+{"", true},
+{"plain ascii", true},
+{"\x7f", true},
+{"\xc2\x80", true},
+{"\xdf\xbf", true},
+{"\xe0\xa0\x80", true},
+{"\xe1\x80\x80", true},
+{"\xec\xbf\xbf", true},
+{"\xed\x80\x80", true},
+{"\xed\x9f\xbf", true},
+{"\xee\x80\x80", true},
+{"\xef\xbf\xbf", true},
+{"\xf0\x90\x80\x80", true},
+{"\xf3\xbf\xbf\xbf", true},
+{"\xf4\x80\x80\x80", true},
+{"\xf4\x8f\xbf\xbf", true},
+{"\x80", false},            // lone continuation
+{"\xbf", false},
+{"\xc0\x80", false},        // overlong two byte
+{"\xc1\xbf", false},
+{"\xc2", false},            // truncated
+{"\xc2\x41", false},
+{"\xc2\x80\x80", false},    // extra continuation
+{"\xe0\x80\x80", false},    // overlong three byte
+{"\xe0\x9f\xbf", false},
+{"\xe1\x80", false},
+{"\xed\xa0\x80", false},    // surrogates
+{"\xed\xbf\xbf", false},
+{"\xf0\x80\x80\x80", false},// overlong four byte
+{"\xf0\x8f\xbf\xbf", false},
+{"\xf4\x90\x80\x80", false},// beyond U+10FFFF
+{"\xf5\x80\x80\x80", false},
+{"\xf8\x88\x80\x80\x80", false},
+{"\xfe", false},
+{"\xff", false},
+{"\xf0\x90\x80", false},
+};
+
+static bool
+run(candidate const &c, std::string_view s, std::size_t piece)
+{
+    utf8::validator v{c.fn};
+    for (std::size_t at = 0; at < s.size(); at += piece)
+        v.write(s.data() + at, std::min(piece, s.size() - at));
+    return v.finish();
+}
+
+static void
+test_samples(candidate const &c)
+{
+    // Each sample at every offset into the first blocks, padded with ASCII
+    // on both sides, in one write and one byte at a time
+    bool ok = true;
+    for (auto const &s : samples)
+        for (std::size_t lead = 0; lead < 70; ++lead)
+        {
+            std::string msg(lead, 'a');
+            msg += s.bytes;
+            msg.append(lead % 7, 'b');
+            ok = ok && run(c, msg, msg.size() + 1) == s.valid;
+            ok = ok && run(c, msg, 1) == s.valid;
+        }
+    check(ok, c.name);
+}
+
+static void
+test_splits(candidate const &c)
+{
+    // Multibyte text split at every byte, so sequences straddle writes
+    std::string msg;
+    for (int i = 0; i < 12; ++i)
+        msg += "h\xc3\xa9llo w\xc3\xb6rld \xe2\x82\xac \xf0\x9f\x98\x80 ";
+    bool ok = true;
+    for (std::size_t piece = 1; piece <= 70; ++piece)
+        ok = ok && run(c, msg, piece);
+    msg.back() = '\xe2';
+    for (std::size_t piece = 1; piece <= 70; ++piece)
+        ok = ok && !run(c, msg, piece);
+    check(ok, "valid text split at any byte, open sequence at the end");
+}
+
+static void
+test_reuse(candidate const &c)
+{
+    // finish() resets: a bad message must not poison the next one
+    utf8::validator v{c.fn};
+    v.write("\xc0\x80", 2);
+    check(!v.finish(), "bad message rejected");
+    v.write("\xc2\x80", 2);
+    check(v.finish(), "next message starts clean");
+}
+
+static void
+test_random(candidate const &c)
+{
+    // Random bytes weighted towards sequence starts and continuations,
+    // compared with the scalar validator
+    std::mt19937 rng{30};
+    unsigned char const pool[] = {'a', 'z', 0x80, 0x8f, 0x90, 0x9f, 0xa0, 0xbf,
+                                  0xc2, 0xdf, 0xe0, 0xe1, 0xed, 0xef, 0xf0, 0xf4};
+    bool ok = true;
+    for (int round = 0; round < 20000; ++round)
+    {
+        std::string msg(rng() % 80, 'x');
+        for (auto &ch : msg)
+            if (rng() % 3 == 0)
+                ch = static_cast<char>(pool[rng() % sizeof(pool)]);
+        utf8::scalar_validator ref;
+        ref.write(msg.data(), msg.size());
+        ok = ok && run(c, msg, 1 + rng() % 40) == ref.finish();
+    }
+    check(ok, "random input agrees with the scalar validator");
+}
+
+int
+main()
+{
+    for (auto const &c : candidates())
+    {
+        test_samples(c);
+        test_splits(c);
+        test_reuse(c);
+        test_random(c);
+    }
+    check(utf8::validate("caf\xc3\xa9", 5) && !utf8::validate("\xed\xa0\x80", 3), "validate() with the active kernel");
+    return test::result("utf8");
+}
@@ -0,0 +1,101 @@
+//------------------------------------------------------------------------------
+//
+// Tool: print a binary log written by console::set_binary_output()
+//
+//     binlog_decode [file]
+//
+// Reads standard input when no file is given. Each entry is printed as
+// its wall-clock time, seconds.microseconds since the epoch, followed by
+// the rendered line.
+//
+//------------------------------------------------------------------------------
+
+#include "binlog.hpp"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <unordered_map>
+
+int
+main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        std::cerr << "Usage: binlog_decode [file]\n";
+        return EXIT_FAILURE;
+    }
+
+    std::string data;
+    if (argc == 2)
+    {
+        std::ifstream in{argv[1], std::ios::binary};
+        if (!in)
+        {
+            std::cerr << "Cannot open " << argv[1] << "\n";
+            return EXIT_FAILURE;
+        }
+        data.assign(std::istreambuf_iterator<char>{in}, {});
+    }
+    else
+        data.assign(std::istreambuf_iterator<char>{std::cin}, {});
+
+    if (data.compare(0, binlog::file_magic.size(), binlog::file_magic) != 0)
+    {
+        std::cerr << "Not a binary log\n";
+        return EXIT_FAILURE;
+    }
+
+    binlog::cursor c{std::string_view{data}.substr(binlog::file_magic.size())};
+    if (c.get<std::uint32_t>() != binlog::byte_order_mark)
+    {
+        std::cerr << "Binary log written with another byte order\n";
+        return EXIT_FAILURE;
+    }
+
+    std::unordered_map<std::uint32_t, std::string> formats;
+    std::string line;
+    while (!c.empty())
+    {
+        auto const kind = c.get<char>();
+        auto const id = c.get<std::uint32_t>();
+        if (!kind || !id)
+            break;
+        if (*kind == char(binlog::record::definition))
+        {
+            auto format = c.get_string();
+            if (!format)
+                break;
+            formats[*id] = *format;
+            continue;
+        }
+        if (*kind != char(binlog::record::entry))
+        {
+            std::cerr << "Unknown record type\n";
+            return EXIT_FAILURE;
+        }
+        auto const ns = c.get<std::uint64_t>();
+        auto const args = c.get_string();
+        if (!ns || !args)
+            break;
+
+        line.clear();
+        auto const it = formats.find(*id);
+        if (it == formats.end())
+            line = "<format " + std::to_string(*id) + " not defined>";
+        else
+            binlog::render(it->second, *args, line);
+        std::printf("%" PRIu64 ".%06" PRIu64 " %s\n", *ns / 1000000000, *ns % 1000000000 / 1000, line.c_str());
+    }
+
+    if (!c.empty())
+    {
+        std::cerr << "Truncated record at end of log\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
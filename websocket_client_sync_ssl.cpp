@@ -13,23 +13,41 @@
 //
 //------------------------------------------------------------------------------
 
+#include "blocking_pool.hpp"
+#include "buffer_pool.hpp"
+#include "chunk_reader.hpp"
+#include "compression.hpp"
+#include "connection_arena.hpp"
+#include "console.hpp"
+#include "duplex_session.hpp"
+#include "handler_memory.hpp"
+#include "io_pool.hpp"
+#include "protocol_io.hpp"
+#include "report.hpp"
 #include "root_certificates.hpp"
+#include "task.hpp"
+#include "transport.hpp"
+#include "work_stealing.hpp"
 
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/connect.hpp>
 #include <boost/asio/detached.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/redirect_error.hpp>
 #include <boost/asio/ssl/stream.hpp>
+#include <boost/asio/strand.hpp>
 #include <boost/asio/use_awaitable.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/ssl.hpp>
 #include <boost/beast/websocket.hpp>
 #include <boost/beast/websocket/ssl.hpp>
+#include <cstdio>
 #include <cstdlib>
-#include <future>
 #include <iostream>
+#include <memory>
+#include <memory_resource>
 #include <string>
 
 namespace beast = boost::beast;        // from <boost/beast.hpp>
@@ -39,186 +57,369 @@ namespace net = boost::asio;           // from <boost/asio.hpp>
 namespace ssl = boost::asio::ssl;      // from <boost/asio/ssl.hpp>
 using tcp = boost::asio::ip::tcp;      // from <boost/asio/ip/tcp.hpp>
 
-namespace console {
-    std::mutex iomutex;
-    template<class... Args>
-    void
-    println(Args const &...args)
-    {
-        using expand = int[];
-
-        std::lock_guard<std::mutex> g{iomutex};
-        expand{0, ((std::cout << args), 0)...};
-        std::cout << '\n';
-    }
-}// namespace console
-
-// Sends a WebSocket message and prints the response
+// Sends a WebSocket message and prints the reply. The upgrade and the
+// framing run in the sans-I/O core; this function only connects the
+// transport and moves bytes between it and the core, and the reply is
+// received in chunks as the core hands out its data. The outcome of the
+// upgrade goes to `sink` to be printed off this thread.
 
 void
 sync_test(net::io_context &ioc, ssl::context &sslctx, std::string host,
-          std::string port, std::string path, std::string text)
-try
+          std::string port, std::string path, std::string text,
+          compression::options deflate, report::sink &sink)
 {
+    report::stopwatch clock;
+    report::timings times;
 
-    // These objects perform our I/O
-    tcp::resolver resolver{ioc};
-    websocket::stream<beast::ssl_stream<tcp::socket>> ws{ioc, sslctx};
-
-    // Look up the domain name
-    auto const results = resolver.resolve(host, port);
-
-    // Make the connection on the IP address we get from a lookup
-    auto ep = net::connect(get_lowest_layer(ws), results);
-
-    // Set SNI Hostname (many hosts need this to handshake successfully)
-    if (!SSL_set_tlsext_host_name(ws.next_layer().native_handle(), host.c_str()))
-        throw beast::system_error(
-        beast::error_code(static_cast<int>(::ERR_get_error()),
-                          net::error::get_ssl_category()),
-        "Failed to set SNI Hostname");
-
-    // Update the host_ string. This will provide the value of the
-    // Host HTTP header during the WebSocket handshake.
-    // See https://tools.ietf.org/html/rfc7230#section-5.4
-    host += ':' + std::to_string(ep.port());
-
-    // Perform the SSL handshake
-    ws.next_layer().handshake(ssl::stream_base::client);
-
-    // Set a decorator to change the User-Agent of the handshake
-    ws.set_option(
-    websocket::stream_base::decorator([](websocket::request_type &req) {
-        req.set(http::field::user_agent,
-                std::string(BOOST_BEAST_VERSION_STRING) +
-                " websocket-client-coro");
-    }));
-
-    // Perform the websocket handshake
-    boost::beast::websocket::response_type response;
-    boost::system::error_code ec;
-    ws.handshake(response, host, path, ec);
-    console::println("[sync] ", ec.message());
-    console::println("[sync] ", response);
-
-    if (ec)
-        return;
-
-    // Send the message
-    ws.write(net::buffer(std::string(text)));
-
-    // This buffer will hold the incoming message
-    beast::flat_buffer buffer;
-
-    // Read a message into our buffer
-    ws.read(buffer);
-
-    // Close the WebSocket connection
-    ws.close(websocket::close_code::normal);
-
-    // If we get here then the connection is closed gracefully
-
-    // The make_printable() function helps print a ConstBufferSequence
-    console::println("[sync] ", beast::make_printable(buffer.data()));
-
-} catch (std::exception &e)
-{
-    console::println("[sync] ", "Error: ", e.what());
+    // Until the upgrade is in the sink, a failure is recorded there with
+    // the timings taken so far
+    bool reported = false;
+    try
+    {
+        // These objects perform our I/O
+        tcp::resolver resolver{ioc};
+        beast::ssl_stream<tcp::socket> stream{ioc, sslctx};
+
+        // Look up the domain name
+        auto const results = resolver.resolve(host, port);
+        times.resolve = clock.lap();
+
+        // Make the connection on the IP address we get from a lookup
+        auto ep = net::connect(get_lowest_layer(stream), results);
+        times.connect = clock.lap();
+
+        // Set SNI Hostname (many hosts need this to handshake successfully)
+        if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str()))
+            throw beast::system_error(
+            beast::error_code(static_cast<int>(::ERR_get_error()),
+                              net::error::get_ssl_category()),
+            "Failed to set SNI Hostname");
+
+        // Perform the SSL handshake
+        stream.handshake(ssl::stream_base::client);
+        times.tls = clock.lap();
+
+        // Update the host_ string. This will provide the value of the
+        // Host HTTP header during the WebSocket handshake.
+        // See https://tools.ietf.org/html/rfc7230#section-5.4
+        host += ':' + std::to_string(ep.port());
+
+        // Perform the websocket handshake, offering permessage-deflate with
+        // the requested window and memory settings
+        protocol::handshake hs{host, path,
+                               {.user_agent = BOOST_BEAST_VERSION_STRING " websocket-client-coro",
+                                .deflate = deflate}};
+        protocol::upgrade(stream, hs);
+        times.upgrade = clock.lap();
+        sink.push(report::make_record("[sync]", hs, times));
+        reported = true;
+
+        if (hs.error())
+            return;
+
+        // Send the message. It is framed, masked and compressed into the
+        // coalescing writer's batch, which takes anything the core has queued
+        // as well, so they share one write and one TLS record.
+        protocol::connection conn{{.deflate = hs.accepted(), .partial_messages = true}};
+        conn.receive(hs.leftover());
+        frame::coalescing_writer outbound{stream, {.compression = hs.accepted()}};
+        outbound.push(net::buffer(text));
+        protocol::flush_output(outbound, conn);
+
+        // Read the reply a chunk at a time, logging each one as it arrives,
+        // so memory stays bounded however large the message is. The chunk is
+        // copied into the log as raw bytes and only printed by the flusher;
+        // chunks are kept well under the largest entry the log accepts.
+        protocol::message_stream reply{stream, conn};
+        inbound::read_chunks(reply, [](net::const_buffer chunk, bool) {
+            console::log<"[sync] {}">(chunk);
+        }, {.chunk_size = 8 * 1024});
+
+        // Close the WebSocket connection, then TLS. The server may drop the
+        // connection without a close_notify once the close is answered.
+        protocol::close(stream, conn, websocket::close_code::normal);
+        boost::system::error_code ec;
+        stream.shutdown(ec);
+
+        // If we get here then the connection is closed gracefully
+        console::println("[sync] writes: ", outbound.stats());
+        console::println("[sync] buffer pool: ", buffers::pool::local().stats());
+    } catch (beast::system_error const &e)
+    {
+        if (!reported)
+            sink.push(report::make_record("[sync]", e.code(), times));
+        console::println("[sync] ", "Error: ", e.what());
+    } catch (std::exception const &e)
+    {
+        console::println("[sync] ", "Error: ", e.what());
+    }
 }
 
+// GCC 12 reports -Wmismatched-new-delete for the awaitable frames of this
+// coroutine. It is a false positive: Asio's awaitable_frame_base::operator
+// new is inlined down to the ::operator new it calls, while the matching
+// operator delete is not, so GCC pairs a frame's delete with the global new.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
 boost::asio::awaitable<void>
 async_test(ssl::context &sslctx, std::string host,
-           std::string port, std::string path, std::string text)
-try
+           std::string port, std::string path, std::string text,
+           compression::options deflate, runtime::work_stealing_pool &workers, report::sink &sink)
 {
-    using boost::asio::redirect_error;
-    using boost::asio::use_awaitable;
-
-    auto exec = co_await boost::asio::this_coro::executor;
-
-    // These objects perform our I/O
-    tcp::resolver resolver{exec};
-    websocket::stream<beast::ssl_stream<tcp::socket>> ws{exec, sslctx};
-
-    // Look up the domain name
-    auto const results = co_await resolver.async_resolve(host, port, use_awaitable);
-
-    // Make the connection on the IP address we get from a lookup
-    auto ep = co_await net::async_connect(get_lowest_layer(ws), results, use_awaitable);
-
-    // Set SNI Hostname (many hosts need this to handshake successfully)
-    if (!SSL_set_tlsext_host_name(ws.next_layer().native_handle(), host.c_str()))
-        throw beast::system_error(
-        beast::error_code(static_cast<int>(::ERR_get_error()),
-                          net::error::get_ssl_category()),
-        "Failed to set SNI Hostname");
-
-    // Update the host_ string. This will provide the value of the
-    // Host HTTP header during the WebSocket handshake.
-    // See https://tools.ietf.org/html/rfc7230#section-5.4
-    host += ':' + std::to_string(ep.port());
-
-    // Perform the SSL handshake
-    co_await ws.next_layer().async_handshake(ssl::stream_base::client, use_awaitable);
-
-    // Set a decorator to change the User-Agent of the handshake
-    ws.set_option(
-    websocket::stream_base::decorator([](websocket::request_type &req) {
-        req.set(http::field::user_agent,
-                std::string(BOOST_BEAST_VERSION_STRING) +
-                " websocket-client-coro");
-    }));
-
-    // Perform the websocket handshake
-    boost::beast::websocket::response_type response;
-    boost::system::error_code ec;
-    co_await ws.async_handshake(response, host, path, redirect_error(use_awaitable, ec));
-    console::println("[async] ", ec.message());
-    console::println("[async] ", response);
-
-    if (ec)
-        co_return;
-
-    // Send the message
-    co_await ws.async_write(net::buffer(std::string(text)), use_awaitable);
-
-    // This buffer will hold the incoming message
-    beast::flat_buffer buffer;
-
-    // Read a message into our buffer
-    co_await ws.async_read(buffer, use_awaitable);
-
-    // Close the WebSocket connection
-    co_await ws.async_close(websocket::close_code::normal, use_awaitable);
-
-    // If we get here then the connection is closed gracefully
-
-    // The make_printable() function helps print a ConstBufferSequence
-    console::println("[async] ", beast::make_printable(buffer.data()));
-
-} catch (std::exception &e)
+    report::stopwatch clock;
+    report::timings times;
+    bool reported = false;
+    try
+    {
+        using boost::asio::redirect_error;
+        using boost::asio::use_awaitable;
+
+        auto exec = co_await boost::asio::this_coro::executor;
+
+        // The resolver, connect and handshake operations and the Host string
+        // allocate from this arena, which is emptied in one step once the
+        // connection is upgraded. The session then takes its operations'
+        // memory from this thread's recycler.
+        memory::connection_arena arena;
+        auto const handshake_token = arena.bind(use_awaitable);
+
+        // These objects perform our I/O. This flow stays on Beast's stream:
+        // the session's read loop and its send queue run at the same time,
+        // and Beast serializes its own pongs and close replies with our
+        // writes.
+        tcp::resolver resolver{exec};
+        websocket::stream<beast::ssl_stream<tcp::socket>> ws{exec, sslctx};
+
+        // Look up the domain name
+        auto const results = co_await resolver.async_resolve(host, port, handshake_token);
+        times.resolve = clock.lap();
+
+        // Make the connection on the IP address we get from a lookup
+        auto ep = co_await net::async_connect(get_lowest_layer(ws), results, handshake_token);
+        times.connect = clock.lap();
+
+        // Set SNI Hostname (many hosts need this to handshake successfully)
+        if (!SSL_set_tlsext_host_name(ws.next_layer().native_handle(), host.c_str()))
+            throw beast::system_error(
+            beast::error_code(static_cast<int>(::ERR_get_error()),
+                              net::error::get_ssl_category()),
+            "Failed to set SNI Hostname");
+
+        // Perform the SSL handshake
+        co_await ws.next_layer().async_handshake(ssl::stream_base::client, handshake_token);
+        times.tls = clock.lap();
+
+        // Set a decorator to change the User-Agent of the handshake
+        ws.set_option(
+        websocket::stream_base::decorator([](websocket::request_type &req) {
+            req.set(http::field::user_agent,
+                    BOOST_BEAST_VERSION_STRING " websocket-client-coro");
+        }));
+
+        // Offer permessage-deflate with the requested window and memory settings
+        compression::apply(ws, deflate);
+
+        // Perform the websocket handshake. The reply cannot be read into a
+        // compact response directly: websocket::stream only takes its own
+        // response_type, and it must run the handshake itself to negotiate
+        // permessage-deflate and arm its reader. The reply is copied into a
+        // compact one and freed at once. The Host header lives in the arena,
+        // so it goes out of scope before the arena is emptied.
+        protocol::compact_response response;
+        boost::system::error_code ec;
+        {
+            // Build the value of the Host HTTP header for the WebSocket handshake.
+            // See https://tools.ietf.org/html/rfc7230#section-5.4
+            std::pmr::string host_header = arena.string(host);
+            host_header += ':';
+            host_header += std::to_string(ep.port());
+
+            websocket::response_type res;
+            co_await ws.async_handshake(res, host_header, path, redirect_error(handshake_token, ec));
+            response.assign(res);
+        }
+        times.upgrade = clock.lap();
+        sink.push(report::make_record("[async]", response, ec, times));
+        reported = true;
+        arena.release();
+
+        if (ec)
+            co_return;
+
+        // Run the connection full duplex: the read loop below and the send
+        // queue's writes proceed independently on the same strand. Every reply
+        // is handled on the worker pool and printed, and the first one ends
+        // the exchange with a close, posted back to the strand.
+        duplex::session_options opts;
+        opts.workers = &workers;
+        duplex::session session{ws, std::move(opts)};
+        session.send(text);
+        co_await session.run([&](inbound::message message) {
+            // Only a prefix is copied into the log: a spilled message stays in
+            // its mapping rather than being brought back onto the heap
+            console::log<"[async] {}">(net::buffer(message.data(), 4 * 1024));
+            console::log<"[async] message: size={} spilled={}">(message.size(), message.spilled() ? "yes" : "no");
+            net::post(session.get_executor(), [&session] { session.close(); });
+        });
+
+        // If we get here then the connection is closed gracefully
+        console::println("[async] session: ", session.stats());
+        console::println("[async] send queue: ", session.queue().metrics());
+        console::println("[async] buffer pool: ", buffers::pool::local().stats());
+        console::println("[async] handler memory: ", memory::recycler::local().stats());
+        console::println("[async] arena: ", arena.stats());
+    } catch (beast::system_error const &e)
+    {
+        if (!reported)
+            sink.push(report::make_record("[async]", e.code(), times));
+        console::println("[async] ", "Error: ", e.what());
+    } catch (std::exception const &e)
+    {
+        console::println("[async] ", "Error: ", e.what());
+    }
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+// The exchange of async_test as a coro::task, run on the sans-I/O core
+// like sync_test. Operations complete on the strand the I/O objects were
+// made with and resume the task from there.
+coro::task<void>
+task_test(net::any_io_executor exec, ssl::context &sslctx, std::string host,
+          std::string port, std::string path, std::string text,
+          compression::options deflate, report::sink &sink)
 {
-    console::println("[async] ", "Error: ", e.what());
+    report::stopwatch clock;
+    report::timings times;
+    bool reported = false;
+    try
+    {
+        using coro::use_task;
+
+        // These objects perform our I/O
+        tcp::resolver resolver{exec};
+        beast::ssl_stream<tcp::socket> stream{exec, sslctx};
+
+        // Look up the domain name
+        auto const results = co_await resolver.async_resolve(host, port, use_task);
+        times.resolve = clock.lap();
+
+        // Make the connection on the IP address we get from a lookup
+        auto ep = co_await net::async_connect(get_lowest_layer(stream), results, use_task);
+        times.connect = clock.lap();
+
+        // Set SNI Hostname (many hosts need this to handshake successfully)
+        if (!SSL_set_tlsext_host_name(stream.native_handle(), host.c_str()))
+            throw beast::system_error(
+            beast::error_code(static_cast<int>(::ERR_get_error()),
+                              net::error::get_ssl_category()),
+            "Failed to set SNI Hostname");
+
+        // Update the host_ string. This will provide the value of the
+        // Host HTTP header during the WebSocket handshake.
+        // See https://tools.ietf.org/html/rfc7230#section-5.4
+        host += ':' + std::to_string(ep.port());
+
+        // Perform the SSL handshake
+        co_await stream.async_handshake(ssl::stream_base::client, use_task);
+        times.tls = clock.lap();
+
+        // Perform the websocket handshake. The reply is read straight into
+        // the handshake's compact response.
+        protocol::handshake hs{host, path,
+                               {.user_agent = BOOST_BEAST_VERSION_STRING " websocket-client-task",
+                                .deflate = deflate}};
+        co_await protocol::tasks::async_upgrade(stream, hs);
+        times.upgrade = clock.lap();
+        sink.push(report::make_record("[task]", hs, times));
+        reported = true;
+
+        if (hs.error())
+            co_return;
+
+        // Send the message and read the reply
+        protocol::connection conn{{.deflate = hs.accepted()}};
+        conn.receive(hs.leftover());
+        conn.send(net::buffer(text));
+        auto const reply = co_await protocol::tasks::async_read_message(stream, conn);
+        console::log<"[task] {}">(net::buffer(reply.payload, 4 * 1024));
+        console::log<"[task] message: size={}">(reply.payload.size());
+
+        // Close the WebSocket connection, then TLS. The server may drop the
+        // connection without a close_notify once the close is answered.
+        co_await protocol::tasks::async_close(stream, conn);
+        boost::system::error_code ec;
+        co_await stream.async_shutdown(net::redirect_error(use_task, ec));
+
+        // If we get here then the connection is closed gracefully
+        console::println("[task] handler memory: ", memory::recycler::local().stats());
+    } catch (beast::system_error const &e)
+    {
+        if (!reported)
+            sink.push(report::make_record("[task]", e.code(), times));
+        console::println("[task] ", "Error: ", e.what());
+    } catch (std::exception const &e)
+    {
+        console::println("[task] ", "Error: ", e.what());
+    }
 }
 
 int
 main(int argc, char **argv)
 {
     // Check command line arguments.
-    if (argc != 4)
+    if (argc < 4 || argc > 6)
     {
-        std::cerr << "Usage: websocket-client-sync-ssl <host> <port> <text>\n"
+        std::cerr << "Usage: websocket-client-sync-ssl <host> <port> <text> [binary-log] [results-csv]\n"
                   << "Example:\n"
                   << "    websocket-client-sync-ssl echo.websocket.org 443 "
-                     "\"Hello, world!\"\n";
+                     "\"Hello, world!\"\n"
+                  << "A binary log is read back with binlog_decode. Pass \"\" to skip it.\n";
         return EXIT_FAILURE;
     }
     std::string host = argv[1];
     auto const port = argv[2];
     auto const text = argv[3];
 
-    // The io_context is required for all I/O
-    net::io_context ioc;
+    // Structured log entries go to the binary log unformatted when one is
+    // given, and are rendered to stdout otherwise
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> binary_log{nullptr, std::fclose};
+    if (argc >= 5 && *argv[4])
+    {
+        binary_log.reset(std::fopen(argv[4], "wb"));
+        if (!binary_log)
+        {
+            std::cerr << "Cannot open " << argv[4] << "\n";
+            return EXIT_FAILURE;
+        }
+        console::set_binary_output(binary_log.get());
+    }
+
+    // Handshake outcomes are printed by the sink's own thread, and also
+    // written as CSV rows when a file is given
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> results_csv{nullptr, std::fclose};
+    if (argc == 6)
+    {
+        results_csv.reset(std::fopen(argv[5], "w"));
+        if (!results_csv)
+        {
+            std::cerr << "Cannot open " << argv[5] << "\n";
+            return EXIT_FAILURE;
+        }
+    }
+    report::sink sink{{.csv = results_csv.get()}};
+
+    // Coroutines run on one io_context per core. Blocking calls get their
+    // own worker threads, each with a private io_context for its I/O
+    // objects, so neither kind of work holds up the other. Message
+    // handling is offloaded to the work-stealing pool.
+    runtime::io_context_pool pool;
+    runtime::blocking_pool blocking{1};
+    runtime::work_stealing_pool workers;
+    console::println("transport: ", transport::backend());
 
     // The SSL context is required, and holds certificates
     ssl::context ctx{ssl::context::tlsv12_client};
@@ -226,14 +427,36 @@ main(int argc, char **argv)
     // This holds the root certificate used for verification
     load_root_certificates(ctx);
 
-    auto sync_future = std::async(std::launch::async, [=, &ioc, &ctx] {
-        sync_test(ioc, ctx, host, port, "/401", text);
+    // Compression settings offered on every connection
+    compression::options deflate;
+    console::println("deflate offer: ", deflate);
+
+    auto sync_future = blocking.submit([=, &ctx, &sink](net::io_context &ioc) {
+        sync_test(ioc, ctx, host, port, "/401", text, deflate, sink);
     });
 
-    boost::asio::co_spawn(ioc, async_test(ctx, host, port, "/401", text), boost::asio::detached);
+    // Each connection lives on one core's context. The strand costs
+    // nothing there and keeps the read and write loops serialized should
+    // a context ever be run by more than one thread.
+    auto placement = pool.place();
+    boost::asio::co_spawn(net::make_strand(placement.context()),
+                          async_test(ctx, host, port, "/401", text, deflate, workers, sink), boost::asio::detached);
+
+    // The same exchange again on the lighter coroutine type
+    auto task_placement = pool.place();
+    auto task_strand = net::make_strand(task_placement.context());
+    coro::spawn(task_strand, task_test(task_strand, ctx, host, port, "/401", text, deflate, sink),
+                [](std::exception_ptr) {});
 
-    ioc.run();
+    pool.run();
     sync_future.wait();
+    sink.flush();
+    console::println("handshakes: ", sink.stats());
+    console::println("blocking pool: ", blocking.metrics());
+    console::println("work stealing: ", workers.stats());
+    console::println("console: ", console::stats());
+    console::flush();
+    console::set_binary_output(nullptr);
 
 
     return EXIT_SUCCESS;